@@ -0,0 +1,26 @@
+#include "accesslog.h"
+
+#include <fcntl.h>
+#include <string.h>
+
+access_log::access_log() : m_file(FLUSH_SIZE) {}
+
+bool access_log::open(const char* path) {
+    if (!m_file.open(path, O_WRONLY | O_CREAT | O_APPEND, 0644)) {
+        return false;
+    }
+    // 新文件先写入文件头
+    if (m_file.written() == 0) {
+        char header[sizeof(ACCESS_MAGIC) + sizeof(ACCESS_VERSION)];
+        memcpy(header, ACCESS_MAGIC, sizeof(ACCESS_MAGIC));
+        memcpy(header + sizeof(ACCESS_MAGIC), &ACCESS_VERSION, sizeof(ACCESS_VERSION));
+        m_file.append(header, sizeof(header));
+    }
+    return true;
+}
+
+void access_log::append(const access_record& rec, const char* url, size_t url_len) {
+    m_file.append(&rec, sizeof(rec), url, url_len);
+}
+
+void access_log::flush() { m_file.flush(); }
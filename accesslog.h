@@ -0,0 +1,52 @@
+#ifndef ACCESSLOG_H
+#define ACCESSLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "filewriter.h"
+
+/*
+    访问日志: 每个完成的请求一条定长的二进制记录，后跟url原文，
+    由 tools/access_stats 离线统计各url、各状态码的延迟分位数。
+
+    文件布局: 8字节魔数 "WSACCESS" + 4字节版本号，之后是若干条 access_record
+*/
+
+const char     ACCESS_MAGIC[8] = {'W', 'S', 'A', 'C', 'C', 'E', 'S', 'S'};
+const uint32_t ACCESS_VERSION  = 1;
+
+struct access_record {
+    uint64_t time_ns;     // 请求完成时的 CLOCK_REALTIME，纳秒
+    uint64_t bytes_sent;  // 发送的字节数，包括响应头
+    uint32_t ttfb_us;     // 从请求开始到发出第一个字节的时间，微秒
+    uint32_t total_us;    // 从请求开始到发完最后一个字节的时间，微秒
+    uint8_t  addr[16];    // 客户端地址，IPv4只使用前4字节
+    uint16_t family;      // AF_INET / AF_INET6 / AF_UNIX，Unix域套接字没有地址与端口
+    uint16_t port;        // 客户端端口，主机字节序
+    uint16_t status;      // HTTP状态码
+    uint8_t  method;      // METHOD 枚举值
+    uint8_t  keep_alive;  // 是否为长连接
+    uint16_t url_len;     // 紧随其后的url字节数
+    uint16_t reserved[3];
+};
+
+/*
+    二进制访问日志的写入端：记录追加到 file_writer 的缓冲区，攒满一批由日志后台线程写出，
+    完成请求的线程不会阻塞在 write 上
+*/
+class access_log {
+public:
+    access_log();
+
+    bool open(const char* path);
+    void append(const access_record& rec, const char* url, size_t url_len);
+    void flush();
+
+private:
+    static const size_t FLUSH_SIZE = 64 * 1024;  // 缓冲区攒到这么多字节就交给后台线程写入文件
+
+    file_writer m_file;
+};
+
+#endif
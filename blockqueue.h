@@ -1,210 +1,535 @@
-/*************************************************************
-*循环数组实现的阻塞队列，m_back = (m_back + 1) % m_max_size;  
-*线程安全，每个操作前都要先加互斥锁，操作完后，再解锁
-**************************************************************/
-
-#ifndef BLOCKQUEUE_H
-#define BLOCKQUEUE_H
-
-#include "cond.h"
-#include "locker.h"
-
-template <class T>
-class blockqueue {
-private:
-    locker m_mutex;
-    cond   m_cond;
-
-    T *m_array;
-
-    int m_size;
-    int m_max_size;
-    int m_front;
-    int m_back;
-
-public:
-    blockqueue(int max_size = 1000);
-    ~blockqueue();
-
-    bool empty();
-    bool full();
-    bool front(T &value);
-    bool back(T &value);
-    void clear();
-
-    int size();
-    int max_size();
-
-    bool push(const T &item);
-    bool pop(T &item);
-    bool pop(T &item, int ms_timeout);
-};
-
-template <class T>
-blockqueue<T>::blockqueue(int max_size) {
-    if (max_size <= 0) {
-        exit(-1);
-    }
-
-    m_max_size = max_size;
-    m_array    = new T[m_max_size];
-    m_size     = 0;
-    m_front    = -1;
-    m_back     = -1;
-}
-
-template <class T>
-blockqueue<T>::~blockqueue() {
-    m_mutex.lock();
-    if (m_array != NULL) delete[] m_array;
-    m_mutex.unlock();
-}
-
-template <class T>
-void blockqueue<T>::clear() {
-    m_mutex.lock();
-    m_size  = 0;
-    m_front = -1;
-    m_back  = -1;
-    m_mutex.unlock();
-}
-
-//判断队列是否满了
-template <class T>
-bool blockqueue<T>::full() {
-    m_mutex.lock();
-    if (m_size >= m_max_size) {
-        m_mutex.unlock();
-        return true;
-    }
-    m_mutex.unlock();
-    return false;
-}
-
-//判断队列是否为空
-template <class T>
-bool blockqueue<T>::empty() {
-    m_mutex.lock();
-    if (0 == m_size) {
-        m_mutex.unlock();
-        return true;
-    }
-    m_mutex.unlock();
-    return false;
-}
-
-//返回队首元素
-template <class T>
-bool blockqueue<T>::front(T &value) {
-    m_mutex.lock();
-    if (0 == m_size) {
-        m_mutex.unlock();
-        return false;
-    }
-    value = m_array[m_front];
-    m_mutex.unlock();
-    return true;
-}
-
-//返回队尾元素
-template <class T>
-bool blockqueue<T>::back(T &value) {
-    m_mutex.lock();
-    if (0 == m_size) {
-        m_mutex.unlock();
-        return false;
-    }
-    value = m_array[m_back];
-    m_mutex.unlock();
-    return true;
-}
-
-template <class T>
-int blockqueue<T>::size() {
-    int tmp = 0;
-
-    m_mutex.lock();
-    tmp = m_size;
-    m_mutex.unlock();
-
-    return tmp;
-}
-
-template <class T>
-int blockqueue<T>::max_size() {
-    int tmp = 0;
-
-    m_mutex.lock();
-    tmp = m_max_size;
-    m_mutex.unlock();
-
-    return tmp;
-}
-
-//往队列添加元素，需要将所有使用队列的线程先唤醒
-//当有元素push进队列,相当于生产者生产了一个元素
-//若当前没有线程等待条件变量,则唤醒无意义
-template <class T>
-bool blockqueue<T>::push(const T &item) {
-    m_mutex.lock();
-    if (m_size >= m_max_size) {
-        m_cond.broadcast();
-        m_mutex.unlock();
-        return false;
-    }
-    m_back = (m_back + 1) % m_max_size;
-
-    m_array[m_back] = item;
-    m_size++;
-    m_cond.broadcast();
-    m_mutex.unlock();
-    return true;
-}
-
-//pop时,如果当前队列没有元素,将会等待条件变量
-template <class T>
-bool blockqueue<T>::pop(T &item) {
-    m_mutex.lock();
-    while (m_size <= 0) {
-        if (!m_cond.wait(m_mutex.get())) {
-            m_mutex.unlock();
-            return false;
-        }
-    }
-    m_front = (m_front + 1) % m_max_size;
-
-    item = m_array[m_front];
-    m_size--;
-    m_mutex.unlock();
-    return true;
-}
-
-//增加了超时处理
-template <class T>
-bool blockqueue<T>::pop(T &item, int ms_timeout) {
-    struct timespec t   = {0, 0};
-    struct timeval  now = {0, 0};
-    gettimeofday(&now, nullptr);
-    m_mutex.lock();
-    if (m_size <= 0) {
-        t.tv_sec  = now.tv_sec + ms_timeout / 1000;
-        t.tv_nsec = (ms_timeout % 1000) * 1000;
-        if (!m_cond.timewait(m_mutex.get(), t)) {
-            m_mutex.unlock();
-            return false;
-        }
-    }
-
-    if (m_size <= 0) {
-        m_mutex.unlock();
-        return false;
-    }
-
-    m_front = (m_front + 1) % m_max_size;
-    item    = m_array[m_front];
-    m_size--;
-    m_mutex.unlock();
-    return true;
-}
-
-#endif
+/*************************************************************
+*循环数组实现的阻塞队列，m_back = (m_back + 1) % m_max_size;
+*线程安全，每个操作前都要先加互斥锁，操作完后，再解锁
+*元素只移动不拷贝，只有消费者在等待时才唤醒，
+*push_bulk/pop_all 一次加锁搬运多个元素
+*pop_spin 先在锁外自旋等待一段时间，仍为空才阻塞在条件变量上
+*blockqueue<T, true> 为单生产者单消费者的无锁版本
+**************************************************************/
+
+#ifndef BLOCKQUEUE_H
+#define BLOCKQUEUE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <atomic>
+#include <utility>
+#include <vector>
+
+#include "cond.h"
+#include "locker.h"
+#include "sem.h"
+
+// 自旋等待时让出流水线资源，同一物理核上的另一个超线程可以继续执行
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+inline uint64_t monotonic_us() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+// 计算 pthread_cond_timedwait/sem_timedwait 使用的绝对超时时间
+inline struct timespec deadline_after(int ms_timeout) {
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    t.tv_sec += ms_timeout / 1000;
+    t.tv_nsec += (long)(ms_timeout % 1000) * 1000000;
+    if (t.tv_nsec >= 1000000000) {
+        t.tv_sec += 1;
+        t.tv_nsec -= 1000000000;
+    }
+    return t;
+}
+
+template <class T, bool SPSC = false>
+class blockqueue {
+private:
+    locker m_mutex;
+    cond   m_cond;
+
+    T *m_array;
+
+    int m_size;
+    int m_max_size;
+    int m_front;
+    int m_back;
+    int m_waiting;  // 正在等待条件变量的消费者数量
+
+    std::atomic<int> m_ready;  // m_size的副本，持锁时更新，自旋等待的消费者在锁外读取
+
+public:
+    blockqueue(int max_size = 1000);
+    ~blockqueue();
+
+    bool empty();
+    bool full();
+    bool front(T &value);
+    bool back(T &value);
+    void clear();
+
+    int size();
+    int max_size();
+
+    bool push(T &&item);
+    int  push_bulk(T *items, int n);  // 返回实际放入的个数，队列满时只放入前面一部分
+    bool pop(T &item);
+    bool pop(T &item, int ms_timeout);
+    bool pop_spin(T &item, int spin_us);  // 先自旋spin_us微秒再阻塞，spin_us为0时与pop相同
+    int  pop_all(std::vector<T> &items, int ms_timeout = -1);  // 取出所有元素追加到items，返回个数
+
+private:
+    bool wait_not_empty(const struct timespec *deadline);  // 需持有m_mutex
+    void take(T &item);                                    // 需持有m_mutex
+};
+
+template <class T, bool SPSC>
+blockqueue<T, SPSC>::blockqueue(int max_size) {
+    if (max_size <= 0) {
+        exit(-1);
+    }
+
+    m_max_size = max_size;
+    m_array    = new T[m_max_size];
+    m_size     = 0;
+    m_front    = -1;
+    m_back     = -1;
+    m_waiting  = 0;
+    m_ready.store(0, std::memory_order_relaxed);
+}
+
+template <class T, bool SPSC>
+blockqueue<T, SPSC>::~blockqueue() {
+    m_mutex.lock();
+    if (m_array != NULL) delete[] m_array;
+    m_mutex.unlock();
+}
+
+template <class T, bool SPSC>
+void blockqueue<T, SPSC>::clear() {
+    m_mutex.lock();
+    m_size  = 0;
+    m_front = -1;
+    m_back  = -1;
+    m_ready.store(0, std::memory_order_relaxed);
+    m_mutex.unlock();
+}
+
+//判断队列是否满了
+template <class T, bool SPSC>
+bool blockqueue<T, SPSC>::full() {
+    m_mutex.lock();
+    if (m_size >= m_max_size) {
+        m_mutex.unlock();
+        return true;
+    }
+    m_mutex.unlock();
+    return false;
+}
+
+//判断队列是否为空
+template <class T, bool SPSC>
+bool blockqueue<T, SPSC>::empty() {
+    m_mutex.lock();
+    if (0 == m_size) {
+        m_mutex.unlock();
+        return true;
+    }
+    m_mutex.unlock();
+    return false;
+}
+
+//返回队首元素
+template <class T, bool SPSC>
+bool blockqueue<T, SPSC>::front(T &value) {
+    m_mutex.lock();
+    if (0 == m_size) {
+        m_mutex.unlock();
+        return false;
+    }
+    value = m_array[(m_front + 1) % m_max_size];
+    m_mutex.unlock();
+    return true;
+}
+
+//返回队尾元素
+template <class T, bool SPSC>
+bool blockqueue<T, SPSC>::back(T &value) {
+    m_mutex.lock();
+    if (0 == m_size) {
+        m_mutex.unlock();
+        return false;
+    }
+    value = m_array[m_back];
+    m_mutex.unlock();
+    return true;
+}
+
+template <class T, bool SPSC>
+int blockqueue<T, SPSC>::size() {
+    int tmp = 0;
+
+    m_mutex.lock();
+    tmp = m_size;
+    m_mutex.unlock();
+
+    return tmp;
+}
+
+template <class T, bool SPSC>
+int blockqueue<T, SPSC>::max_size() {
+    int tmp = 0;
+
+    m_mutex.lock();
+    tmp = m_max_size;
+    m_mutex.unlock();
+
+    return tmp;
+}
+
+//往队列添加元素，相当于生产者生产了一个元素
+//只有消费者正在等待时才唤醒，且在解锁后唤醒，被唤醒的线程不必再等锁
+//队列满时直接返回，没有人在等待"不满"，不需要唤醒
+template <class T, bool SPSC>
+bool blockqueue<T, SPSC>::push(T &&item) {
+    m_mutex.lock();
+    if (m_size >= m_max_size) {
+        m_mutex.unlock();
+        return false;
+    }
+    m_back = (m_back + 1) % m_max_size;
+
+    m_array[m_back] = std::move(item);
+    m_size++;
+    m_ready.store(m_size, std::memory_order_relaxed);
+    bool wake = m_waiting > 0;
+    m_mutex.unlock();
+    if (wake) {
+        m_cond.signal();
+    }
+    return true;
+}
+
+//一次加锁放入多个元素，按放入的个数唤醒等待的消费者
+template <class T, bool SPSC>
+int blockqueue<T, SPSC>::push_bulk(T *items, int n) {
+    m_mutex.lock();
+    int count = m_max_size - m_size;
+    if (count > n) {
+        count = n;
+    }
+    for (int i = 0; i < count; ++i) {
+        m_back          = (m_back + 1) % m_max_size;
+        m_array[m_back] = std::move(items[i]);
+    }
+    m_size += count;
+    m_ready.store(m_size, std::memory_order_relaxed);
+    int wake = m_waiting < count ? m_waiting : count;
+    m_mutex.unlock();
+    if (wake == 1) {
+        m_cond.signal();
+    } else if (wake > 1) {
+        m_cond.broadcast();
+    }
+    return count;
+}
+
+//等待队列非空，deadline为空时一直等待，超时或出错返回false
+template <class T, bool SPSC>
+bool blockqueue<T, SPSC>::wait_not_empty(const struct timespec *deadline) {
+    while (m_size <= 0) {
+        ++m_waiting;
+        bool ok = deadline ? m_cond.timewait(m_mutex.get(), *deadline) : m_cond.wait(m_mutex.get());
+        --m_waiting;
+        if (!ok && m_size <= 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <class T, bool SPSC>
+void blockqueue<T, SPSC>::take(T &item) {
+    m_front = (m_front + 1) % m_max_size;
+    item    = std::move(m_array[m_front]);
+    m_size--;
+    m_ready.store(m_size, std::memory_order_relaxed);
+}
+
+//pop时,如果当前队列没有元素,将会等待条件变量
+template <class T, bool SPSC>
+bool blockqueue<T, SPSC>::pop(T &item) {
+    m_mutex.lock();
+    if (!wait_not_empty(nullptr)) {
+        m_mutex.unlock();
+        return false;
+    }
+    take(item);
+    m_mutex.unlock();
+    return true;
+}
+
+//增加了超时处理，超时时间从调用时刻算起
+template <class T, bool SPSC>
+bool blockqueue<T, SPSC>::pop(T &item, int ms_timeout) {
+    struct timespec t = deadline_after(ms_timeout);
+    m_mutex.lock();
+    if (!wait_not_empty(&t)) {
+        m_mutex.unlock();
+        return false;
+    }
+    take(item);
+    m_mutex.unlock();
+    return true;
+}
+
+//自旋期间只读m_ready，看到有元素才加锁去取，避免与生产者争锁；
+//多个消费者可能同时看到同一个元素，没抢到的继续自旋
+template <class T, bool SPSC>
+bool blockqueue<T, SPSC>::pop_spin(T &item, int spin_us) {
+    if (spin_us > 0) {
+        uint64_t deadline = monotonic_us() + spin_us;
+        for (unsigned i = 1;; ++i) {
+            if (m_ready.load(std::memory_order_relaxed) > 0) {
+                m_mutex.lock();
+                if (m_size > 0) {
+                    take(item);
+                    m_mutex.unlock();
+                    return true;
+                }
+                m_mutex.unlock();
+            }
+            cpu_relax();
+            // 每自旋64次看一次时间
+            if ((i & 63) == 0 && monotonic_us() >= deadline) {
+                break;
+            }
+        }
+    }
+    return pop(item);
+}
+
+//等到至少有一个元素后一次取走全部元素，ms_timeout小于0时一直等待
+template <class T, bool SPSC>
+int blockqueue<T, SPSC>::pop_all(std::vector<T> &items, int ms_timeout) {
+    struct timespec t = {0, 0};
+    if (ms_timeout >= 0) {
+        t = deadline_after(ms_timeout);
+    }
+    m_mutex.lock();
+    if (!wait_not_empty(ms_timeout >= 0 ? &t : nullptr)) {
+        m_mutex.unlock();
+        return 0;
+    }
+    int count = m_size;
+    items.reserve(items.size() + count);
+    for (int i = 0; i < count; ++i) {
+        m_front = (m_front + 1) % m_max_size;
+        items.push_back(std::move(m_array[m_front]));
+    }
+    m_size = 0;
+    m_ready.store(0, std::memory_order_relaxed);
+    m_mutex.unlock();
+    return count;
+}
+
+/*
+    单生产者单消费者的无锁环形队列:
+        生产者只写m_tail，消费者只写m_head，两者放在不同的缓存行上；
+        各自缓存对方的位置，只有看起来满/空时才读取对方的原子变量。
+    消费者无元素可取时先置m_sleeping再复查一次，生产者放入元素后看到m_sleeping才post信号量，
+    两边都用seq_cst保证不会出现"消费者睡下而生产者没看到"的情况。
+    front/back/clear 在无锁版本中没有意义，不提供。
+*/
+template <class T>
+class blockqueue<T, true> {
+public:
+    blockqueue(int max_size = 1024);
+    ~blockqueue();
+
+    bool empty() const;
+    bool full() const;
+    int  size() const;
+    int  max_size() const;
+
+    // 只能由生产者线程调用
+    bool push(T &&item);
+    int  push_bulk(T *items, int n);
+
+    // 只能由消费者线程调用
+    bool try_pop(T &item);
+    bool pop(T &item);
+    bool pop(T &item, int ms_timeout);
+    int  pop_all(std::vector<T> &items, int ms_timeout = -1);
+
+private:
+    bool wait_not_empty(int ms_timeout);
+    void wake_consumer();
+
+    T     *m_array;
+    size_t m_capacity;  // 2的幂
+    size_t m_mask;
+
+    alignas(64) std::atomic<size_t> m_head;  // 消费者的读取位置
+    size_t m_cached_tail;                    // 消费者缓存的写入位置
+
+    alignas(64) std::atomic<size_t> m_tail;  // 生产者的写入位置
+    size_t m_cached_head;                    // 生产者缓存的读取位置
+
+    alignas(64) std::atomic<bool> m_sleeping;  // 消费者是否准备睡眠
+    sem m_sem;
+};
+
+template <class T>
+blockqueue<T, true>::blockqueue(int max_size)
+    : m_head(0), m_cached_tail(0), m_tail(0), m_cached_head(0), m_sleeping(false) {
+    if (max_size <= 0) {
+        exit(-1);
+    }
+    m_capacity = 1;
+    while (m_capacity < (size_t)max_size) {
+        m_capacity <<= 1;
+    }
+    m_mask  = m_capacity - 1;
+    m_array = new T[m_capacity];
+}
+
+template <class T>
+blockqueue<T, true>::~blockqueue() {
+    delete[] m_array;
+}
+
+template <class T>
+bool blockqueue<T, true>::empty() const {
+    return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+}
+
+template <class T>
+bool blockqueue<T, true>::full() const {
+    return size() >= max_size();
+}
+
+template <class T>
+int blockqueue<T, true>::size() const {
+    return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+}
+
+template <class T>
+int blockqueue<T, true>::max_size() const {
+    return m_capacity;
+}
+
+template <class T>
+bool blockqueue<T, true>::push(T &&item) {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail - m_cached_head >= m_capacity) {
+        m_cached_head = m_head.load(std::memory_order_acquire);
+        if (tail - m_cached_head >= m_capacity) {
+            return false;
+        }
+    }
+    m_array[tail & m_mask] = std::move(item);
+    m_tail.store(tail + 1, std::memory_order_release);
+    wake_consumer();
+    return true;
+}
+
+template <class T>
+int blockqueue<T, true>::push_bulk(T *items, int n) {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail - m_cached_head + n > m_capacity) {
+        m_cached_head = m_head.load(std::memory_order_acquire);
+    }
+    size_t room  = m_capacity - (tail - m_cached_head);
+    int    count = room < (size_t)n ? room : n;
+    for (int i = 0; i < count; ++i) {
+        m_array[(tail + i) & m_mask] = std::move(items[i]);
+    }
+    if (count > 0) {
+        m_tail.store(tail + count, std::memory_order_release);
+        wake_consumer();
+    }
+    return count;
+}
+
+template <class T>
+void blockqueue<T, true>::wake_consumer() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleeping.load(std::memory_order_relaxed) && m_sleeping.exchange(false)) {
+        m_sem.post();
+    }
+}
+
+template <class T>
+bool blockqueue<T, true>::try_pop(T &item) {
+    size_t head = m_head.load(std::memory_order_relaxed);
+    if (head == m_cached_tail) {
+        m_cached_tail = m_tail.load(std::memory_order_acquire);
+        if (head == m_cached_tail) {
+            return false;
+        }
+    }
+    item = std::move(m_array[head & m_mask]);
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+// 队列为空时睡眠等待生产者唤醒，ms_timeout小于0时一直等待
+template <class T>
+bool blockqueue<T, true>::wait_not_empty(int ms_timeout) {
+    while (true) {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head != m_cached_tail || head != (m_cached_tail = m_tail.load(std::memory_order_acquire))) {
+            return true;
+        }
+        m_sleeping.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (head != (m_cached_tail = m_tail.load(std::memory_order_acquire))) {
+            // 没有睡下，多余的post只会造成一次额外的循环
+            m_sleeping.store(false);
+            return true;
+        }
+        bool ok = ms_timeout < 0 ? m_sem.wait() : m_sem.timewait(ms_timeout);
+        if (!ok) {
+            m_sleeping.store(false);
+            return head != (m_cached_tail = m_tail.load(std::memory_order_acquire));
+        }
+    }
+}
+
+template <class T>
+bool blockqueue<T, true>::pop(T &item) {
+    return wait_not_empty(-1) && try_pop(item);
+}
+
+template <class T>
+bool blockqueue<T, true>::pop(T &item, int ms_timeout) {
+    return wait_not_empty(ms_timeout) && try_pop(item);
+}
+
+template <class T>
+int blockqueue<T, true>::pop_all(std::vector<T> &items, int ms_timeout) {
+    if (!wait_not_empty(ms_timeout)) {
+        return 0;
+    }
+    size_t head  = m_head.load(std::memory_order_relaxed);
+    size_t tail  = m_tail.load(std::memory_order_acquire);
+    int    count = tail - head;
+    items.reserve(items.size() + count);
+    for (size_t i = head; i != tail; ++i) {
+        items.push_back(std::move(m_array[i & m_mask]));
+    }
+    m_cached_tail = tail;
+    m_head.store(tail, std::memory_order_release);
+    return count;
+}
+
+#endif
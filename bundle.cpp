@@ -0,0 +1,118 @@
+#include "bundle.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+
+// [offset, offset+len) 是否落在长度为end的映射中，不会溢出
+static bool in_range(uint64_t offset, uint64_t len, uint64_t end) { return offset <= end && len <= end - offset; }
+
+// 条目引用的url、响应头与响应体都必须在映射之内，ETag必须以'\0'结尾
+static bool entry_valid(const bundle_entry& e, uint64_t end) {
+    if (!in_range(e.url_offset, e.url_len, end)) {
+        return false;
+    }
+    for (int v = 0; v < BUNDLE_VARIANT_NUM; ++v) {
+        const bundle_variant& var = e.variants[v];
+        if (var.present &&
+            (!in_range(var.header_offset, var.header_len, end) || !in_range(var.body_offset, var.body_size, end) ||
+             var.etag[BUNDLE_ETAG_LEN - 1] != '\0')) {
+            return false;
+        }
+    }
+    // 服务时总可以退回原始内容
+    return e.variants[BUNDLE_IDENTITY].present;
+}
+
+static_bundle::static_bundle() : base(nullptr), length(0), header(nullptr), buckets(nullptr), entries(nullptr) {}
+
+static_bundle::~static_bundle() {
+    if (base) {
+        munmap(base, length);
+    }
+}
+
+bool static_bundle::open(const char* path, bool populate, bool hugepage) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        LOG_ERROR("open bundle %s failed, errno is: %d", path, errno);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(bundle_header)) {
+        LOG_ERROR("bundle %s is too small", path);
+        close(fd);
+        return false;
+    }
+
+    int flags = MAP_PRIVATE;
+    if (populate) {
+        flags |= MAP_POPULATE;
+    }
+    char* addr = (char*)mmap(0, st.st_size, PROT_READ, flags, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        LOG_ERROR("mmap bundle %s failed, errno is: %d", path, errno);
+        return false;
+    }
+
+    // 普通文件无法使用 MAP_HUGETLB，只能建议内核将其折叠为透明大页
+    if (hugepage) {
+        madvise(addr, st.st_size, MADV_HUGEPAGE);
+    }
+
+    const bundle_header* hdr = (const bundle_header*)addr;
+    uint64_t             end = (uint64_t)st.st_size;
+    bool valid = memcmp(hdr->magic, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC)) == 0 && hdr->version == BUNDLE_VERSION &&
+                 hdr->total_size == end && hdr->bucket_count != 0 &&
+                 (hdr->bucket_count & (hdr->bucket_count - 1)) == 0 &&
+                 in_range(hdr->index_offset, (uint64_t)hdr->bucket_count * sizeof(uint32_t), end) &&
+                 in_range(hdr->entry_offset, (uint64_t)hdr->entry_count * sizeof(bundle_entry), end);
+    // 截断或损坏的资源包在这里拒绝，服务时不再检查偏移
+    const bundle_entry* ents = (const bundle_entry*)(addr + hdr->entry_offset);
+    for (uint32_t i = 0; valid && i < hdr->entry_count; ++i) {
+        valid = entry_valid(ents[i], end);
+    }
+    if (!valid) {
+        LOG_ERROR("bundle %s is corrupted or has a wrong version", path);
+        munmap(addr, st.st_size);
+        return false;
+    }
+
+    if (base) {
+        munmap(base, length);
+    }
+    base    = addr;
+    length  = st.st_size;
+    header  = hdr;
+    buckets = (const uint32_t*)(base + hdr->index_offset);
+    entries = (const bundle_entry*)(base + hdr->entry_offset);
+    LOG_INFO("load bundle %s, %u entries, %lu bytes", path, hdr->entry_count, (unsigned long)length);
+    return true;
+}
+
+const bundle_entry* static_bundle::find(const char* url, size_t len) const {
+    if (!header) {
+        return nullptr;
+    }
+    uint64_t h    = bundle_hash(url, len);
+    uint32_t mask = header->bucket_count - 1;
+    // 线性探测，遇到空槽即未命中
+    uint32_t i = (uint32_t)h & mask;
+    for (uint32_t n = 0; n < header->bucket_count; ++n, i = (i + 1) & mask) {
+        uint32_t slot = buckets[i];
+        if (slot == 0 || slot > header->entry_count) {
+            return nullptr;
+        }
+        const bundle_entry* e = entries + (slot - 1);
+        if (e->hash == h && e->url_len == len && memcmp(base + e->url_offset, url, len) == 0) {
+            return e;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,90 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+    静态资源包格式，由 tools/bundle_pack 把 doc_root 整棵目录树打包成一个文件，
+    服务器启动时一次性mmap，之后的查找不再需要任何文件系统调用。
+
+    文件布局（所有整数均为本机字节序）:
+        bundle_header                       :   文件头
+        uint32_t buckets[bucket_count]      :   开放寻址哈希索引，存 entry下标+1，0表示空槽
+        bundle_entry entries[entry_count]   :   资源条目
+        字符串区                             :   url 与预生成的响应头
+        响应体区                             :   每个响应体按页对齐存放
+*/
+
+const char     BUNDLE_MAGIC[8]    = {'W', 'S', 'B', 'U', 'N', 'D', 'L', 'E'};
+const uint32_t BUNDLE_VERSION     = 2;
+const uint32_t BUNDLE_PAGE_SIZE   = 4096;
+const int      BUNDLE_ETAG_LEN    = 24;
+const int      BUNDLE_IDENTITY    = 0;  // 原始内容
+const int      BUNDLE_GZIP        = 1;  // 预压缩的gzip内容
+const int      BUNDLE_VARIANT_NUM = 2;
+
+struct bundle_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t page_size;
+    uint32_t entry_count;
+    uint32_t bucket_count;  // 2的幂
+    uint64_t index_offset;
+    uint64_t entry_offset;
+    uint64_t total_size;
+};
+
+// 一个资源的某种编码形式，header 不含 Connection 与结尾空行，由服务器按连接补齐；
+// 有gzip形式的资源两种形式的header都带 Vary: Accept-Encoding
+struct bundle_variant {
+    uint64_t header_offset;
+    uint64_t body_offset;
+    uint64_t body_size;
+    uint32_t header_len;
+    uint32_t present;
+    char     etag[BUNDLE_ETAG_LEN];  // 带引号，'\0'结尾；gzip形式是原始内容的ETag加"-gz"，两种表示不共用ETag
+};
+
+struct bundle_entry {
+    uint64_t       hash;
+    uint64_t       url_offset;
+    uint32_t       url_len;
+    uint32_t       reserved;
+    bundle_variant variants[BUNDLE_VARIANT_NUM];
+};
+
+// url 与资源内容共用的 FNV-1a 哈希
+inline uint64_t bundle_hash(const char* data, size_t len, uint64_t h = 14695981039346656037ULL) {
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// 只读的静态资源包，启动时映射一次，之后所有连接共享
+class static_bundle {
+public:
+    static_bundle();
+    ~static_bundle();
+
+    // populate: MAP_POPULATE 预先建立页表；hugepage: 建议内核使用透明大页
+    bool open(const char* path, bool populate, bool hugepage);
+
+    // 按url查找资源，未命中返回nullptr
+    const bundle_entry* find(const char* url, size_t len) const;
+
+    const char* at(uint64_t offset) const { return base + offset; }
+    uint32_t    size_of_entries() const { return header ? header->entry_count : 0; }
+
+private:
+    char*                base;
+    size_t               length;
+    const bundle_header* header;
+    const uint32_t*      buckets;
+    const bundle_entry*  entries;
+};
+
+#endif
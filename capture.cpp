@@ -0,0 +1,45 @@
+#include "capture.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+
+static uint64_t clock_ns(clockid_t id) {
+    struct timespec t;
+    clock_gettime(id, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+traffic_capture::traffic_capture() : m_start(0), m_full(false), m_file(FLUSH_SIZE, MAX_SIZE) {}
+
+bool traffic_capture::open(const char* path) {
+    // 时间戳相对于抓取开始，每次都重新开始一个文件
+    if (!m_file.open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) {
+        return false;
+    }
+    capture_file_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+    header.version  = CAPTURE_VERSION;
+    header.start_ns = clock_ns(CLOCK_REALTIME);
+    m_start         = clock_ns(CLOCK_MONOTONIC);
+    m_file.append(&header, sizeof(header));
+    return true;
+}
+
+void traffic_capture::record(capture_type type, uint32_t conn_id, const char* data, size_t len) {
+    capture_record rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.time_ns = clock_ns(CLOCK_MONOTONIC) - m_start;
+    rec.conn_id = conn_id;
+    rec.len     = len;
+    rec.type    = type;
+
+    if (!m_file.append(&rec, sizeof(rec), data, len) && !m_full.exchange(true)) {
+        LOG_WARN("traffic capture reached %llu bytes, stop recording", (unsigned long long)m_file.written());
+    }
+}
+
+void traffic_capture::flush() { m_file.flush(); }
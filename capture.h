@@ -0,0 +1,65 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "filewriter.h"
+
+/*
+    流量抓取: 按到达顺序记录每个连接的建立、收到的原始请求字节与关闭，
+    由 tools/replay 按原来的连接与时间节奏(或加速)重放到本地实例，用于复现线上问题、在同样的流量上比较不同版本。
+    记录的是请求原文，可能包含Cookie等敏感信息。
+
+    文件布局: 8字节魔数 "WSCAPTUR" + 4字节版本号 + 4字节保留 + 8字节抓取开始时的 CLOCK_REALTIME(纳秒)，
+    之后是若干条 capture_record，DATA 记录后跟 len 字节的请求数据
+*/
+
+const char     CAPTURE_MAGIC[8] = {'W', 'S', 'C', 'A', 'P', 'T', 'U', 'R'};
+const uint32_t CAPTURE_VERSION  = 1;
+
+enum capture_type {
+    CAPTURE_OPEN = 1,  // 接受连接
+    CAPTURE_DATA,      // 收到一段数据，即一次recv的结果
+    CAPTURE_CLOSE      // 服务器关闭连接，包括对端关闭、超时与出错
+};
+
+struct capture_file_header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t start_ns;  // 抓取开始时的 CLOCK_REALTIME，纳秒
+};
+
+struct capture_record {
+    uint64_t time_ns;  // 相对抓取开始的时间，CLOCK_MONOTONIC，纳秒
+    uint32_t conn_id;  // 连接编号，同一个fd先后承载的连接编号不同
+    uint32_t len;      // 紧随其后的数据字节数，只有 DATA 记录不为0
+    uint8_t  type;     // capture_type
+    uint8_t  reserved[7];
+};
+
+/*
+    抓取文件的写入端，与访问日志一样通过 file_writer 成批交给日志后台线程写出；
+    文件达到 MAX_SIZE 后停止记录
+*/
+class traffic_capture {
+public:
+    traffic_capture();
+
+    bool open(const char* path);
+    void record(capture_type type, uint32_t conn_id, const char* data, size_t len);
+    void flush();
+
+private:
+    static const size_t   FLUSH_SIZE = 256 * 1024;               // 缓冲区攒到这么多字节就交给后台线程写入文件
+    static const uint64_t MAX_SIZE   = 1024ULL * 1024 * 1024;    // 抓取文件的大小上限
+
+    uint64_t          m_start;  // 抓取开始时的 CLOCK_MONOTONIC，纳秒
+    std::atomic<bool> m_full;   // 达到大小上限，只用于输出一次警告
+    file_writer       m_file;
+};
+
+#endif
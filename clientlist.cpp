@@ -1,6 +1,12 @@
 #include "clientlist.h"
+
+#include <sys/socket.h>
+
+#include <vector>
+
 #include "log.h"
 #include "connection.h"
+#include "stats.h"
 
 client_timer_list::client_timer_list() : head(nullptr), tail(nullptr) {}
 
@@ -21,6 +27,8 @@ void client_timer_list::tick() {
         return;
     }
 
+    std::vector<client_timer*> deferred;  // 到期但连接还在别的线程手里的定时器
+
     client_timer* tmp = head;
     while (tmp) {
         // 比较定时器的超时值和系统当前时间，以判断定时器是否到期
@@ -30,9 +38,31 @@ void client_timer_list::tick() {
 
         head = tmp->next;//更新头节点位置
 
+        // 工作线程或磁盘线程还在用这个连接，它的命令节点也可能还在队列中，顺延到处理完之后
+        bool busy = tmp->http_conn->in_flight;
+        // 领导者/跟随者模式下连接可能正在别的线程中处理，这里只关闭socket的读写，
+        // 由取到 EPOLLRDHUP 或读写出错的线程自己关闭连接、删除定时器
+        if (!busy && connection::leader_follower) {
+            LOG_INFO("find a timeout connection, shut down sockfd %d", tmp->http_conn->sockfd);
+            shutdown(tmp->http_conn->sockfd, SHUT_RDWR);
+            server_stats::add(STAT_TIMEOUTS);
+            busy = true;
+        }
+        if (busy) {
+            if (head) {
+                head->prev = nullptr;
+            }
+            tmp->prev = tmp->next = nullptr;
+            tmp->renew_expire_time();
+            deferred.push_back(tmp);
+            tmp = head;
+            continue;
+        }
+
         // 超时就先关闭连接，后删除相应定时器；
         LOG_INFO("find a timeout connection, which sockfd is %d", tmp->http_conn->sockfd);
         tmp->http_conn->close_sock();
+        server_stats::add(STAT_TIMEOUTS);
         
         // 执行完定时器中的定时任务之后，就将它从链表中删除，并重置链表头节点
         head = tmp->next;
@@ -42,6 +72,10 @@ void client_timer_list::tick() {
         delete tmp;
         tmp = head;
     }
+
+    for (client_timer* timer : deferred) {
+        add_timer_to_list(timer);
+    }
 }
 
 void client_timer_list::del_timer_from_list(client_timer* timer) {
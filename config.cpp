@@ -0,0 +1,244 @@
+#include "config.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "log.h"
+
+void config_table::add_item(const char* key, config_type type, void* value, const char* help) {
+    config_item item;
+    item.key   = key;
+    item.type  = type;
+    item.value = value;
+    item.help  = help;
+    m_items.push_back(item);
+}
+
+void config_table::add(const char* key, int* value, const char* help) { add_item(key, CONFIG_INT, value, help); }
+
+void config_table::add(const char* key, size_t* value, const char* help) { add_item(key, CONFIG_SIZE, value, help); }
+
+void config_table::add(const char* key, bool* value, const char* help) { add_item(key, CONFIG_BOOL, value, help); }
+
+void config_table::add(const char* key, std::string* value, const char* help) {
+    add_item(key, CONFIG_STRING, value, help);
+}
+
+void config_table::add(const char* key, std::vector<std::string>* value, const char* help) {
+    add_item(key, CONFIG_LIST, value, help);
+}
+
+// 整数可以带k/m/g后缀，按1024进位
+static bool parse_number(const char* text, long long& out) {
+    char* end;
+    errno        = 0;
+    long long n  = strtoll(text, &end, 0);
+    if (errno != 0 || end == text) {
+        return false;
+    }
+    switch (tolower((unsigned char)*end)) {
+        case 'k':
+            n <<= 10;
+            ++end;
+            break;
+        case 'm':
+            n <<= 20;
+            ++end;
+            break;
+        case 'g':
+            n <<= 30;
+            ++end;
+            break;
+    }
+    out = n;
+    return *end == '\0';
+}
+
+bool config_table::set(const char* key, const char* value) {
+    for (const config_item& item : m_items) {
+        if (strcmp(item.key, key) != 0) {
+            continue;
+        }
+        long long n;
+        switch (item.type) {
+            case CONFIG_INT:
+                if (!parse_number(value, n)) {
+                    return false;
+                }
+                *(int*)item.value = (int)n;
+                return true;
+            case CONFIG_SIZE:
+                if (!parse_number(value, n) || n < 0) {
+                    return false;
+                }
+                *(size_t*)item.value = (size_t)n;
+                return true;
+            case CONFIG_BOOL:
+                if (strcmp(value, "1") == 0 || strcmp(value, "true") == 0 || strcmp(value, "on") == 0) {
+                    *(bool*)item.value = true;
+                } else if (strcmp(value, "0") == 0 || strcmp(value, "false") == 0 || strcmp(value, "off") == 0) {
+                    *(bool*)item.value = false;
+                } else {
+                    return false;
+                }
+                return true;
+            case CONFIG_STRING:
+                *(std::string*)item.value = value;
+                return true;
+            case CONFIG_LIST:
+                ((std::vector<std::string>*)item.value)->push_back(value);
+                return true;
+        }
+    }
+    return false;
+}
+
+bool config_table::set_arg(const char* arg) {
+    const char* eq = strchr(arg, '=');
+    if (!eq) {
+        return false;
+    }
+    std::string key(arg, eq - arg);
+    return set(key.c_str(), eq + 1);
+}
+
+// 去掉首尾空白
+static char* trim(char* s) {
+    while (isspace((unsigned char)*s)) {
+        ++s;
+    }
+    char* end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) {
+        *--end = '\0';
+    }
+    return s;
+}
+
+bool config_table::load_file(const char* path) {
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        printf("打开配置文件 %s 失败\n", path);
+        return false;
+    }
+    char line[1024];
+    int  lineno = 0;
+    bool ok     = true;
+    while (fgets(line, sizeof(line), fp)) {
+        ++lineno;
+        char* hash = strchr(line, '#');
+        if (hash) {
+            *hash = '\0';
+        }
+        char* text = trim(line);
+        if (*text == '\0') {
+            continue;
+        }
+        char* eq = strchr(text, '=');
+        if (!eq) {
+            printf("%s:%d: 缺少'='\n", path, lineno);
+            ok = false;
+            continue;
+        }
+        *eq         = '\0';
+        char* key   = trim(text);
+        char* value = trim(eq + 1);
+        if (!set(key, value)) {
+            printf("%s:%d: 无效的配置 %s = %s\n", path, lineno, key, value);
+            ok = false;
+        }
+    }
+    fclose(fp);
+    return ok;
+}
+
+void config_table::log() const {
+    for (const config_item& item : m_items) {
+        switch (item.type) {
+            case CONFIG_INT:
+                LOG_INFO("config %s = %d", item.key, *(int*)item.value);
+                break;
+            case CONFIG_SIZE:
+                LOG_INFO("config %s = %lu", item.key, (unsigned long)*(size_t*)item.value);
+                break;
+            case CONFIG_BOOL:
+                LOG_INFO("config %s = %d", item.key, (int)*(bool*)item.value);
+                break;
+            case CONFIG_STRING:
+                LOG_INFO("config %s = %s", item.key, ((std::string*)item.value)->c_str());
+                break;
+            case CONFIG_LIST:
+                for (const std::string& v : *(std::vector<std::string>*)item.value) {
+                    LOG_INFO("config %s = %s", item.key, v.c_str());
+                }
+                break;
+        }
+    }
+}
+
+void config_table::usage() const {
+    printf("配置项(配置文件中写\"键 = 值\"，命令行写 --键=值)：\n");
+    for (const config_item& item : m_items) {
+        printf("  %-24s %s\n", item.key, item.help);
+    }
+}
+
+// 从 /proc/meminfo 读 MemAvailable，读不到时用空闲页数
+static size_t read_mem_available() {
+    FILE* fp = fopen("/proc/meminfo", "r");
+    if (fp) {
+        char          line[128];
+        unsigned long kb = 0;
+        while (fgets(line, sizeof(line), fp)) {
+            if (sscanf(line, "MemAvailable: %lu kB", &kb) == 1) {
+                fclose(fp);
+                return (size_t)kb * 1024;
+            }
+        }
+        fclose(fp);
+    }
+    return (size_t)sysconf(_SC_AVPHYS_PAGES) * sysconf(_SC_PAGESIZE);
+}
+
+static int read_somaxconn() {
+    int   n  = SOMAXCONN;
+    FILE* fp = fopen("/proc/sys/net/core/somaxconn", "r");
+    if (fp) {
+        if (fscanf(fp, "%d", &n) != 1) {
+            n = SOMAXCONN;
+        }
+        fclose(fp);
+    }
+    return n;
+}
+
+machine_info machine_info::probe() {
+    machine_info info;
+    info.cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (info.cpus < 1) {
+        info.cpus = 1;
+    }
+
+    // 默认的软限制通常只有1024，先提高到硬限制
+    rlimit rl;
+    info.nofile = 1024;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        if (rl.rlim_cur < rl.rlim_max) {
+            rlim_t old  = rl.rlim_cur;
+            rl.rlim_cur = rl.rlim_max;
+            if (setrlimit(RLIMIT_NOFILE, &rl) != 0) {
+                rl.rlim_cur = old;
+            }
+        }
+        info.nofile = rl.rlim_cur == RLIM_INFINITY ? (1L << 20) : (long)rl.rlim_cur;
+    }
+
+    info.mem_avail = read_mem_available();
+    info.somaxconn = read_somaxconn();
+    return info;
+}
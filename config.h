@@ -0,0 +1,59 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+/*
+    运行参数:
+        所有可调的上限登记在一张"键 -> 变量"的表中，来源依次为：
+            编译时的默认值，其中写0表示"自动"的几项在启动时按CPU数、RLIMIT_NOFILE与可用内存推算；
+            -f 指定的配置文件，每行"键 = 值"，#之后为注释，可以出现多次的键(如 listen、proxy_route)每行追加一项；
+            命令行的 --键=值；
+            原有的短选项(-w、-L等)，它们直接写同一个变量。
+        后者覆盖前者。启动后把生效的配置逐项写入日志，性能实验可以按日志复现。
+*/
+
+enum config_type { CONFIG_INT = 0, CONFIG_SIZE, CONFIG_BOOL, CONFIG_STRING, CONFIG_LIST };
+
+class config_table {
+public:
+    void add(const char* key, int* value, const char* help);
+    void add(const char* key, size_t* value, const char* help);
+    void add(const char* key, bool* value, const char* help);
+    void add(const char* key, std::string* value, const char* help);
+    void add(const char* key, std::vector<std::string>* value, const char* help);  // 每设置一次追加一项
+
+    bool set(const char* key, const char* value);  // 未知的键或无效的值返回false
+    bool set_arg(const char* arg);                 // "键=值"的形式
+    bool load_file(const char* path);              // 出错时打印行号并返回false
+
+    void log() const;    // 把所有项的当前值写入日志
+    void usage() const;  // 打印所有键与说明
+
+private:
+    struct config_item {
+        const char* key;
+        config_type type;
+        void*       value;
+        const char* help;
+    };
+
+    void add_item(const char* key, config_type type, void* value, const char* help);
+
+    std::vector<config_item> m_items;
+};
+
+// 推算默认值用到的机器资源，启动时探测一次
+struct machine_info {
+    int    cpus;        // 在线CPU数
+    long   nofile;      // 文件描述符上限，探测时已把软限制提高到硬限制
+    size_t mem_avail;   // 可用内存，字节
+    int    somaxconn;   // 内核允许的最大监听队列长度
+
+    static machine_info probe();
+};
+
+#endif
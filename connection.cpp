@@ -1,55 +1,128 @@
 #include "connection.h"
 
+#include <algorithm>
+
 #include "clientlist.h"
+#include "diskio.h"
 #include "log.h"
+#include "perfctr.h"
+#include "proxy.h"
+#include "response.h"
+#include "stats.h"
 #include "timer.h"
 
-// 定义HTTP响应的一些状态信息
-const char* ok_200_title    = "OK";
-const char* error_400_title = "Bad Request";
-const char* error_400_form  = "Your request has bad syntax or is inherently impossible to satisfy.\n";
-const char* error_403_title = "Forbidden";
-const char* error_403_form  = "You do not have permission to get file from this server.\n";
-const char* error_404_title = "Not Found";
-const char* error_404_form  = "The requested file was not found on this server.\n";
-const char* error_500_title = "Internal Error";
-const char* error_500_form  = "There was an unusual problem serving the requested file.\n";
-
-// 网站的根目录
-const char* doc_root = "/home/zyue/lesson/resources";
+// 网站的根目录，可由配置项 doc_root 修改
+std::string doc_root = "/home/zyue/lesson/resources";
 
-int connection::epollfd    = -1;
-int connection::user_count = 0;
+int              connection::epollfd       = -1;
+bool             connection::leader_follower = false;
+std::atomic<int> connection::user_count(0);
+size_t           connection::write_budget  = 256 * 1024;
+int              connection::notsent_lowat = 128 * 1024;
+int              connection::send_buffer   = 0;
+int              connection::busy_poll     = 0;
+int              connection::read_buf_size  = 2048;
+int              connection::write_buf_size = 2048;
 
 client_timer_list* connection::timer_list = nullptr;
+static_bundle*     connection::bundle     = nullptr;
+access_log*        connection::access     = nullptr;
+bool               connection::stats_page = false;
+trace_dump*        connection::tracer     = nullptr;
+traffic_capture*   connection::capture    = nullptr;
+reverse_proxy*     connection::proxy      = nullptr;
+tls_context*       connection::tls        = nullptr;
+loop_channel*      connection::channel    = nullptr;
+file_cache         connection::files;
+client_limiter*    connection::limiter    = nullptr;
+locker             connection::timer_lock;
+
+static uint32_t next_conn_id = 0;  // 只在事件循环中分配
+
+threadpool<connection, &connection::load_file>* connection::disk_pool = nullptr;
+
+connection::connection()
+    : sockfd(-1), timer(nullptr), upstream(nullptr), tls_sess(nullptr), in_flight(false), read_buf(nullptr),
+      write_buf(nullptr), file_ref(nullptr) {
+    cmd.conn = this;
+}
 
-connection::connection() : sockfd(-1), timer(nullptr) {}
-connection::~connection() {}
+connection::~connection() {
+    delete[] read_buf;
+    delete[] write_buf;
+}
 
 void connection::init_conn() {
     LOG_INFO("accept a new connection, which sockfd is %d", sockfd);
+    conn_id = ++next_conn_id;
+    if (capture) {
+        capture->record(CAPTURE_OPEN, conn_id, nullptr, 0);
+    }
     init_timer();
     print_client_info(client_address);
-    add_fd_to_epoll(epollfd, sockfd, true, true);
+    if (client_address.ss_family != AF_UNIX) {
+        set_send_limits(sockfd, notsent_lowat, send_buffer);
+        if (busy_poll > 0) {
+            set_socket_busy_poll(sockfd, busy_poll);
+        }
+    }
     init_parse();
+    trace.stamp(TRACE_START);
+    keep_alive_used = false;
+    in_flight       = false;
     ++user_count;
-    LOG_INFO("after init, we have %d connection in all now", user_count);
+    server_stats::add(STAT_ACCEPTS);
+    server_stats::add(STAT_ACTIVE_CONNS);
+    LOG_INFO("after init, we have %d connection in all now", user_count.load());
+    // 最后注册，领导者/跟随者模式下注册之后别的线程可能马上读这个连接
+    add_fd_to_epoll(epollfd, sockfd, true, true);
+}
+
+// 半同步/半反应堆模式下定时器只在事件循环中修改，不需要加锁
+static void lock_timers() {
+    if (connection::leader_follower) {
+        connection::timer_lock.lock();
+    }
+}
+
+static void unlock_timers() {
+    if (connection::leader_follower) {
+        connection::timer_lock.unlock();
+    }
 }
 
 void connection::init_timer() {
     timer->renew_expire_time();
+    lock_timers();
     timer_list->add_timer_to_list(timer);
+    unlock_timers();
 }
 
 void connection::update_timer() {
-    timer->renew_expire_time();
     LOG_INFO("update timer, which sockfd is %d", sockfd);
-    timer_list->adjust_timer_on_list(timer);
+    // 重新注册事件之后连接可能已经在别的线程中被关闭，定时器随之删除
+    lock_timers();
+    if (sockfd != -1) {
+        timer->renew_expire_time();
+        timer_list->adjust_timer_on_list(timer);
+    }
+    unlock_timers();
+}
+
+void connection::tick_timers() {
+    lock_timers();
+    timer_list->tick();
+    unlock_timers();
 }
 
 void connection::init_parse() {
-    bzero(read_buf, READ_BUF_SIZE);
-    bzero(write_buf, WRITE_BUF_SIZE);
+    // 连接表按最大描述符数预先分配，缓冲区等到槽位第一次使用时再分配，没用到的槽位不占内存
+    if (!read_buf) {
+        read_buf  = new char[read_buf_size];
+        write_buf = new char[write_buf_size];
+    }
+    bzero(read_buf, read_buf_size);
+    bzero(write_buf, write_buf_size);
     bzero(file_path, FILENAME_LEN);
 
     //struct stat  file_stat;  // 目标文件的状态。
@@ -64,38 +137,85 @@ void connection::init_parse() {
     bytes_had_send = 0;
     iv_count       = 0;
 
-    url          = nullptr;
-    version      = nullptr;
-    host         = nullptr;
-    file_address = nullptr;
+    url           = nullptr;
+    version       = nullptr;
+    host          = nullptr;
+    if_none_match = nullptr;
+    file_address  = nullptr;
+    body_address  = nullptr;
+    body_size     = 0;
+    resident_end  = 0;
+    bundle_hit    = nullptr;
+    proxy_hit     = nullptr;
+    header_idx    = 0;
+
+    bundle_encoding = BUNDLE_IDENTITY;
+    accept_gzip     = false;
 
     check_state   = CHECK_STATE_REQUESTLINE;
     method        = GET;
     is_keep_alive = false;
+
+    status_code = 0;
+    trace.reset();
 }
 
 void connection::close_sock() {
     if (sockfd == -1) return;
     LOG_INFO("close a connection, which sockfd is %d", sockfd);
-    remove_fd_from_epoll(epollfd, sockfd);
+    if (capture) {
+        capture->record(CAPTURE_CLOSE, conn_id, nullptr, 0);
+    }
+    if (upstream) {
+        proxy->abort(*this);
+    }
+    // 发送途中断开的连接也要归还文件映射
+    unmap();
+    if (tls_sess) {
+        tls_sess->shutdown();
+        delete tls_sess;
+        tls_sess = nullptr;
+    }
+    if (limiter) {
+        limiter->on_close(client_address);
+    }
+    int fd = sockfd;
     sockfd = -1;
     --user_count;
-    LOG_INFO("after close, there have %d conn in all", user_count);
+    server_stats::add(STAT_ACTIVE_CONNS, -1);
+    if (keep_alive_used) {
+        server_stats::add(STAT_KEEPALIVE_CONNS, -1);
+    }
+    LOG_INFO("after close, there have %d conn in all", user_count.load());
+    // 最后关闭，关闭之后同一个fd可能马上被事件循环accept，这个槽位交给新连接
+    remove_fd_from_epoll(epollfd, fd);
 }
 
 void connection::close_conn() {
-    if (sockfd == -1) return;
-    close_sock();
-    timer_list->del_timer_from_list(timer);
+    // 领导者/跟随者模式下与定时器tick、其他线程互斥，同一个连接不会被关闭两次
+    lock_timers();
+    if (sockfd != -1) {
+        timer_list->del_timer_from_list(timer);
+        close_sock();
+    }
+    unlock_timers();
 }
 
 bool connection::read() {
-    if (read_idx >= READ_BUF_SIZE) {
+    if (read_idx >= read_buf_size) {
         return false;
     }
+    // 长连接上的后续请求从收到第一个字节开始计时
+    if (!trace.points[TRACE_START]) {
+        trace.stamp(TRACE_START);
+    }
     int bytes_of_read = 0;
     while (1) {
-        bytes_of_read = recv(sockfd, read_buf + read_idx, READ_BUF_SIZE - read_idx, 0);
+        if (tls_sess) {
+            bytes_of_read = tls_sess->read(read_buf + read_idx, read_buf_size - read_idx);
+        } else {
+            bytes_of_read = recv(sockfd, read_buf + read_idx, read_buf_size - read_idx, 0);
+        }
         if (bytes_of_read == -1) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
                 //modify_fd_from_epoll(epollfd, sockfd, EPOLLIN);
@@ -107,9 +227,14 @@ bool connection::read() {
             // 对方关闭连接
             return false;
         }
+        if (capture) {
+            capture->record(CAPTURE_DATA, conn_id, read_buf + read_idx, bytes_of_read);
+        }
         read_idx += bytes_of_read;
+        server_stats::add(STAT_BYTES_IN, bytes_of_read);
     }
     //LOG_INFO("\n接收到请求:\n%s", read_buf);
+    trace.stamp(TRACE_READ_DONE);
     return true;
 }
 
@@ -158,6 +283,16 @@ HTTP_CODE connection::parse_http_request(char* text) {
     char* _method = text;
     if (strcasecmp(_method, "GET") == 0) {  // 忽略大小写比较
         method = GET;
+    } else if (proxy) {
+        // 其余方法只能转发给上游，找到url之后在 fetch_file 中检查
+        int m = POST;
+        while (m < CONNECT && strcasecmp(_method, method_names[m]) != 0) {
+            ++m;
+        }
+        if (m == CONNECT) {
+            return BAD_REQUEST;
+        }
+        method = (METHOD)m;
     } else {
         return BAD_REQUEST;
     }
@@ -220,6 +355,14 @@ HTTP_CODE connection::parse_http_header(char* text) {
         text += 5;
         text += strspn(text, " \t");
         host = text;
+    } else if (strncasecmp(text, "Accept-Encoding:", 16) == 0) {
+        // 处理Accept-Encoding头部字段 Accept-Encoding: gzip, deflate
+        text += 16;
+        accept_gzip = strstr(text, "gzip") != nullptr;
+    } else if (strncasecmp(text, "If-None-Match:", 14) == 0) {
+        text += 14;
+        text += strspn(text, " \t");
+        if_none_match = text;
     } else {
         LOG_INFO("unknow header %s, which sockfd is %d", text, sockfd);
     }
@@ -254,6 +397,7 @@ HTTP_CODE connection::parse_http() {
                 if (ret_code == BAD_REQUEST) {
                     return BAD_REQUEST;
                 }
+                header_idx = parse_line;  // 转发时从这里开始重写头部
                 break;
             }
 
@@ -262,6 +406,7 @@ HTTP_CODE connection::parse_http() {
                 if (ret_code == BAD_REQUEST) {
                     return BAD_REQUEST;
                 } else if (ret_code == GET_REQUEST) {
+                    trace.stamp(TRACE_PARSE_DONE);
                     return fetch_file();
                 }
                 break;
@@ -272,6 +417,7 @@ HTTP_CODE connection::parse_http() {
                 if (ret_code == BAD_REQUEST) {
                     return BAD_REQUEST;
                 } else if (ret_code == GET_REQUEST) {
+                    trace.stamp(TRACE_PARSE_DONE);
                     return fetch_file();
                 }
                 line_status = LINE_OPEN;
@@ -292,55 +438,112 @@ HTTP_CODE connection::parse_http() {
     映射到内存地址file_address处，并告诉调用者获取文件成功
 */
 HTTP_CODE connection::fetch_file() {
+    perf_scope perf(PERF_STAGE_RESPONSE);  // 在解析阶段中调用，查找文件计入响应阶段
+    if (stats_page && strcmp(url, "/__stats") == 0) {
+        return STATS_REQUEST;
+    }
+    if (proxy && (proxy_hit = proxy->match(url))) {
+        return PROXY_REQUEST;
+    }
+    if (method != GET) {
+        return BAD_REQUEST;
+    }
+    if (bundle) {
+        return fetch_bundle();
+    }
     // "/home/nowcoder/webserver/resources"
-    strcpy(file_path, doc_root);
-    int len = strlen(doc_root);
+    int len = std::min(doc_root.size(), (size_t)FILENAME_LEN - 1);
+    memcpy(file_path, doc_root.data(), len);
     strncpy(file_path + len, url, FILENAME_LEN - len - 1);
-    // 获取real_file文件的相关的状态信息，-1失败，0成功
-    if (stat(file_path, &file_stat) < 0) {
-        return NO_RESOURCE;
+    // 同一文件的并发查找合并成一次 stat/open/mmap，结果与映射由这些连接共享
+    file_ref = files.acquire(file_path);
+    if (file_ref->result != FILE_REQUEST) {
+        HTTP_CODE ret = file_ref->result;
+        unmap();
+        return ret;
     }
+    file_stat    = file_ref->st;
+    file_address = file_ref->address;
+    return FILE_REQUEST;
+}
 
-    // 判断访问权限
-    if (!(file_stat.st_mode & S_IROTH)) {
-        return FORBIDDEN_REQUEST;
+// 资源包启动时已整体映射，这里只做一次哈希查找，不产生任何文件系统调用
+HTTP_CODE connection::fetch_bundle() {
+    bundle_hit = bundle->find(url, strlen(url));
+    if (!bundle_hit) {
+        return NO_RESOURCE;
     }
-
-    // 判断是否是目录
-    if (S_ISDIR(file_stat.st_mode)) {
-        return BAD_REQUEST;
+    bundle_encoding = BUNDLE_IDENTITY;
+    if (accept_gzip && bundle_hit->variants[BUNDLE_GZIP].present) {
+        bundle_encoding = BUNDLE_GZIP;
     }
-
-    // 以只读方式打开文件
-    int fd = open(file_path, O_RDONLY);
-    // 创建内存映射
-    file_address = (char*)mmap(0, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    close(fd);
-    return FILE_REQUEST;
+    // 先选定编码形式，再与这种形式的ETag比较
+    if (if_none_match && strcmp(if_none_match, bundle_hit->variants[bundle_encoding].etag) == 0) {
+        return NOT_MODIFIED;
+    }
+    return BUNDLE_REQUEST;
 }
 
-// 对内存映射区执行munmap操作
+// 归还共享的文件映射，最后一个持有者负责munmap
 void connection::unmap() {
-    if (file_address) {
-        munmap(file_address, file_stat.st_size);
+    if (file_ref) {
+        files.release(file_ref);
+        file_ref     = nullptr;
         file_address = 0;
     }
 }
 
 // 写HTTP响应
 bool connection::write() {
-    int temp = 0;
+    // 转发中的响应由代理从上游搬过来
+    if (upstream) {
+        return proxy->on_client_writable(*this);
+    }
+
+    perf_scope perf(PERF_STAGE_WRITE);
+    int        temp = 0;
 
     if (bytes_to_send == 0) {
         // 将要发送的字节为0，这一次响应结束。
-        modify_fd_from_epoll(epollfd, sockfd, EPOLLIN);
         init_parse();
+        modify_fd_from_epoll(epollfd, sockfd, EPOLLIN);
         return true;
     }
 
+    size_t round_sent = 0;  // 本次唤醒已发送的字节数
     while (1) {
-        // 分散写
-        temp = writev(sockfd, iv, iv_count);
+        // 本次唤醒的发送额度用完，让出事件循环；重新注册EPOLLOUT后套接字仍可写，下一轮epoll_wait会再次返回
+        if (write_budget > 0 && round_sent >= write_budget) {
+            modify_fd_from_epoll(epollfd, sockfd, EPOLLOUT);
+            return true;
+        }
+
+        size_t header_sent = bytes_had_send < (size_t)write_idx ? bytes_had_send : write_idx;
+        size_t body_sent   = bytes_had_send - header_sent;
+
+        // 即将发送的响应体不在页缓存中时交给磁盘线程加载，加载完成后由磁盘线程重新注册EPOLLOUT
+        if (body_sent < body_size && body_sent >= resident_end) {
+            resident_end = std::min(body_size, body_sent + DISK_PROBE_WINDOW);
+            if (!page_resident(body_address + body_sent, resident_end - body_sent) && load_async()) {
+                return true;
+            }
+        }
+
+        // 每次只发送已确认在内存中的部分
+        iv[0].iov_base = write_buf + header_sent;
+        iv[0].iov_len  = write_idx - header_sent;
+        iv[1].iov_base = (char*)body_address + body_sent;
+        iv[1].iov_len  = resident_end - body_sent;
+        if (write_budget > 0) {
+            iv[1].iov_len = std::min(iv[1].iov_len, write_budget - round_sent);
+        }
+
+        // 分散写，用户态TLS时逐段加密后发送
+        if (plain_send()) {
+            temp = writev(sockfd, iv, iv_count);
+        } else {
+            temp = tls_sess->writev(iv, iv_count);
+        }
         if (temp <= -1) {
             // 如果TCP写缓冲没有空间，则等待下一轮EPOLLOUT事件，虽然在此期间，
             // 服务器无法立即接收到同一客户的下一个请求，但可以保证连接的完整性。
@@ -352,147 +555,437 @@ bool connection::write() {
             return false;
         }
 
+        if (bytes_had_send == 0) {
+            trace.stamp(TRACE_FIRST_WRITE);
+        }
         bytes_had_send += temp;
         bytes_to_send -= temp;
-
-        if (bytes_had_send >= iv[0].iov_len) {
-            iv[0].iov_len  = 0;
-            iv[1].iov_base = file_address + (bytes_had_send - write_idx);
-            iv[1].iov_len  = bytes_to_send;
-        } else {
-            iv[0].iov_base = write_buf + bytes_had_send;
-            iv[0].iov_len  = iv[0].iov_len - temp;
-        }
+        round_sent += temp;
+        server_stats::add(STAT_BYTES_OUT, temp);
 
         if (bytes_to_send <= 0) {
             // 没有数据要发送了
             unmap();
+            return end_response();
+        }
+    }
+}
+
+bool connection::plain_send() const { return !tls_sess || tls_sess->ktls_send(); }
+
+ssize_t connection::send_bytes(const char* data, size_t len) {
+    if (plain_send()) {
+        return send(sockfd, data, len, MSG_NOSIGNAL);
+    }
+    struct iovec v = {(void*)data, len};
+    return tls_sess->writev(&v, 1);
+}
+
+// 每次可读或可写时推进一步，握手完成后等待第一个请求
+bool connection::tls_handshake() {
+    switch (tls_sess->handshake()) {
+        case TLS_WANT_READ:
+            modify_fd_from_epoll(epollfd, sockfd, EPOLLIN);
+            return true;
+        case TLS_WANT_WRITE:
+            modify_fd_from_epoll(epollfd, sockfd, EPOLLOUT);
+            return true;
+        case TLS_DONE:
+            LOG_INFO("tls handshake done, ktls send: %d, which sockfd is %d", tls_sess->ktls_send(), sockfd);
             modify_fd_from_epoll(epollfd, sockfd, EPOLLIN);
+            return true;
+        default:
+            LOG_INFO("tls handshake failed, which sockfd is %d", sockfd);
+            return false;
+    }
+}
 
-            if (is_keep_alive) {
-                init_parse();
-                return true;
-            } else {
-                return false;
-            }
+bool connection::end_response() {
+    trace.stamp(TRACE_LAST_WRITE);
+    trace_finish(trace, tracer, conn_id, url, status_code);
+    if (access) {
+        log_access();
+    }
+
+    if (is_keep_alive) {
+        if (!keep_alive_used) {
+            keep_alive_used = true;
+            server_stats::add(STAT_KEEPALIVE_CONNS);
         }
+        // 先复位再注册EPOLLIN，领导者/跟随者模式下注册之后下一个请求可能马上在别的线程中被读取
+        init_parse();
+        modify_fd_from_epoll(epollfd, sockfd, EPOLLIN);
+        return true;
     }
+    return false;
 }
 
-// 往写缓冲中写入待发送的数据
-bool connection::add_response(const char* format, ...) {
-    if (write_idx >= WRITE_BUF_SIZE) {
+// 记录客户端地址、请求、状态码、发送字节数与耗时，格式见 accesslog.h
+void connection::log_access() {
+    access_record rec;
+    memset(&rec, 0, sizeof(rec));
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    rec.time_ns    = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    rec.bytes_sent = bytes_had_send;
+    rec.ttfb_us    = trace.between(TRACE_START, TRACE_FIRST_WRITE) / 1000;
+    rec.total_us   = trace.between(TRACE_START, TRACE_LAST_WRITE) / 1000;
+    rec.family     = client_address.ss_family;
+    rec.status     = status_code;
+    rec.method     = method;
+    rec.keep_alive = is_keep_alive;
+    if (client_address.ss_family == AF_INET) {
+        const sockaddr_in* in = (const sockaddr_in*)&client_address;
+        rec.port              = ntohs(in->sin_port);
+        memcpy(rec.addr, &in->sin_addr, sizeof(in->sin_addr));
+    } else if (client_address.ss_family == AF_INET6) {
+        const sockaddr_in6* in6 = (const sockaddr_in6*)&client_address;
+        rec.port                = ntohs(in6->sin6_port);
+        memcpy(rec.addr, &in6->sin6_addr, sizeof(in6->sin6_addr));
+    }
+
+    // 请求行不完整时没有url
+    const char* path = url ? url : "-";
+    size_t      len  = std::min(strlen(path), (size_t)UINT16_MAX);
+    rec.url_len      = len;
+    access->append(rec, path, len);
+}
+
+// 把冷数据交给磁盘线程池，队列已满时返回false，由事件循环直接发送
+bool connection::load_async() {
+    if (!disk_pool) {
         return false;
     }
-    va_list arg_list;
-    va_start(arg_list, format);
-    int len = vsnprintf(write_buf + write_idx, WRITE_BUF_SIZE - 1 - write_idx, format, arg_list);
-    if (len >= (WRITE_BUF_SIZE - 1 - write_idx)) {
+    ++disk_counters.inflight;
+    // 加载期间磁盘线程读这个连接的响应体位置与映射，定时器不能关闭它，磁盘线程的命令执行时清除
+    in_flight = true;
+    if (!disk_pool->append(this)) {
+        in_flight = false;
+        --disk_counters.inflight;
+        ++disk_counters.rejected;
         return false;
     }
-    write_idx += len;
-    va_end(arg_list);
+    ++disk_counters.queued;
     return true;
 }
 
-bool connection::add_status_line(int status, const char* title) {
-    return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
+// 由磁盘线程调用，把当前发送窗口读入页缓存后重新等待EPOLLOUT
+void connection::load_file() {
+    size_t header_sent = bytes_had_send < (size_t)write_idx ? bytes_had_send : write_idx;
+    size_t body_sent   = bytes_had_send - header_sent;
+    load_pages(body_address + body_sent, resident_end - body_sent);
+    --disk_counters.inflight;
+    post(LOOP_CMD_WRITE);
+}
+
+void connection::post(LOOP_CMD type) {
+    cmd.type    = type;
+    cmd.conn_id = conn_id;
+    channel->post(&cmd);
+}
+
+void connection::finish(LOOP_CMD type) {
+    if (leader_follower) {
+        run_command(type);
+    } else {
+        post(type);
+    }
+}
+
+void connection::run_command(int type) {
+    switch (type) {
+        case LOOP_CMD_READ:
+            modify_fd_from_epoll(epollfd, sockfd, EPOLLIN);
+            break;
+        case LOOP_CMD_WRITE:
+            // 不等下一轮EPOLLOUT，直接写；写不完时write自己注册EPOLLOUT
+            if (!write()) {
+                close_conn();
+            } else {
+                update_timer();
+            }
+            break;
+        case LOOP_CMD_CLOSE:
+            close_conn();
+            break;
+        case LOOP_CMD_PROXY:
+            if (proxy->start(*this, proxy_hit)) {
+                break;
+            }
+            if (!reply_http(BAD_GATEWAY)) {
+                close_conn();
+                break;
+            }
+            trace.stamp(TRACE_RESPONSE_READY);
+            run_command(LOOP_CMD_WRITE);
+            break;
+    }
+}
+
+void connection::run_commands() {
+    channel->begin_drain();
+    while (loop_cmd* c = channel->pop()) {
+        connection& conn = *c->conn;
+        conn.in_flight   = false;
+        if (conn.sockfd == -1 || conn.conn_id != c->conn_id) {
+            // 定时器不关闭在途的连接，这里只防御意外情况
+            ++loop_channel::stats.stale;
+            continue;
+        }
+        conn.run_command(c->type);
+    }
 }
 
-bool connection::add_headers(int content_len) {
-    add_content_length(content_len);
-    add_content_type();
-    add_linger();
-    add_blank_line();
+// 往写缓冲中追加一段已经拼好的数据
+bool connection::add_response(const char* data, size_t len) {
+    if (write_idx + len > (size_t)write_buf_size - 1) {
+        return false;
+    }
+    memcpy(write_buf + write_idx, data, len);
+    write_idx += len;
     return true;
 }
 
-bool connection::add_content_length(int content_len) { return add_response("Content-Length: %d\r\n", content_len); }
+bool connection::add_status_line(const const_str<64>& line) { return add_response(line.data, line.len); }
+
+bool connection::add_headers(size_t content_len) {
+    return add_content_length(content_len) && add_content_type() && add_date() && add_linger() && add_blank_line();
+}
+
+bool connection::add_content_length(size_t content_len) {
+    static const char prefix[] = "Content-Length: ";
+    char              line[sizeof(prefix) + 24];
+    size_t            len = sizeof(prefix) - 1;
+    memcpy(line, prefix, len);
+    len += u64_to_dec(line + len, content_len);
+    line[len++] = '\r';
+    line[len++] = '\n';
+    return add_response(line, len);
+}
 
 bool connection::add_linger() {
-    return add_response("Connection: %s\r\n", (is_keep_alive == true) ? "keep-alive" : "close");
+    static const char keep_alive[] = "Connection: keep-alive\r\n";
+    static const char close[]      = "Connection: close\r\n";
+    if (is_keep_alive) {
+        return add_response(keep_alive, sizeof(keep_alive) - 1);
+    }
+    return add_response(close, sizeof(close) - 1);
+}
+
+bool connection::add_date() {
+    size_t      len;
+    const char* date = http_date_header(len);
+    return add_response(date, len);
 }
 
-bool connection::add_blank_line() { return add_response("%s", "\r\n"); }
+// 资源包中预生成了状态行、Content-Length、Content-Type和ETag，只需补上与连接相关的部分
+bool connection::add_bundle_headers() {
+    const bundle_variant& v = bundle_hit->variants[bundle_encoding];
+    return add_response(bundle->at(v.header_offset), v.header_len) && add_date() && add_linger() && add_blank_line();
+}
+
+bool connection::add_blank_line() { return add_response("\r\n", 2); }
+
+bool connection::add_content(const char* content, size_t len) { return add_response(content, len); }
 
-bool connection::add_content(const char* content) { return add_response("%s", content); }
+bool connection::add_content_type() {
+    static const char prefix[] = "Content-Type: ";
+    const char*       type     = mime_type_of(url, strlen(url));
+    return add_response(prefix, sizeof(prefix) - 1) && add_response(type, strlen(type)) && add_response("\r\n", 2);
+}
+
+// 运行时统计直接从内存生成，不经过文件系统，响应体与文件一样通过iv[1]发送
+bool connection::add_stats() {
+    static const char type[] = "Content-Type: application/json\r\nCache-Control: no-store\r\n";
+    // 槽表较大或打开了硬件计数器时一次可能写不下，按所需长度放大后重新生成，不返回被截断的JSON
+    size_t            len = 0;
+    generated_body.resize(8192);
+    while ((len = server_stats::render_json(&generated_body[0], generated_body.size())) >= generated_body.size()) {
+        generated_body.resize(len + 1024);
+    }
+    generated_body.resize(len);
+    if (!add_status_line(status_200) || !add_content_length(len) || !add_response(type, sizeof(type) - 1) ||
+        !add_date() || !add_linger() || !add_blank_line()) {
+        return false;
+    }
+    body_address = generated_body.data();
+    body_size    = generated_body.size();
+    return true;
+}
 
-bool connection::add_content_type() { return add_response("Content-Type:%s\r\n", "text/html"); }
+// 错误响应的状态行、Content-Length和Content-Type在编译期就已拼好
+bool connection::add_error(const error_response& resp) {
+    return add_response(resp.head.data, resp.head.len) && add_date() && add_linger() && add_blank_line() &&
+           add_content(resp.body, resp.body_len);
+}
 
 // 根据服务器处理HTTP请求的结果，决定返回给客户端的内容
 bool connection::reply_http(HTTP_CODE ret) {
+    status_code = 200;
     switch (ret) {
         case INTERNAL_ERROR: {
-            add_status_line(500, error_500_title);
-            add_headers(strlen(error_500_form));
-            if (!add_content(error_500_form)) {
+            status_code = 500;
+            if (!add_error(error_500)) {
                 return false;
             }
             break;
         }
         case BAD_REQUEST: {
-            add_status_line(400, error_400_title);
-            add_headers(strlen(error_400_form));
-            if (!add_content(error_400_form)) {
+            status_code = 400;
+            if (!add_error(error_400)) {
                 return false;
             }
             break;
         }
         case NO_RESOURCE: {
-            add_status_line(404, error_404_title);
-            add_headers(strlen(error_404_form));
-            if (!add_content(error_404_form)) {
+            status_code = 404;
+            if (!add_error(error_404)) {
                 return false;
             }
             break;
         }
         case FORBIDDEN_REQUEST: {
-            add_status_line(403, error_403_title);
-            add_headers(strlen(error_403_form));
-            if (!add_content(error_403_form)) {
+            status_code = 403;
+            if (!add_error(error_403)) {
+                return false;
+            }
+            break;
+        }
+        case TOO_MANY_REQUESTS: {
+            status_code = 429;
+            if (!add_error(error_429)) {
+                return false;
+            }
+            break;
+        }
+        case BAD_GATEWAY: {
+            status_code = 502;
+            if (!add_error(error_502)) {
+                return false;
+            }
+            break;
+        }
+        case GATEWAY_TIMEOUT: {
+            status_code = 504;
+            if (!add_error(error_504)) {
+                return false;
+            }
+            break;
+        }
+        case NOT_MODIFIED: {
+            status_code = 304;
+            static const char etag[] = "ETag: ";
+            static const char vary[] = "Vary: Accept-Encoding\r\n";
+            const char*       tag    = bundle_hit->variants[bundle_encoding].etag;
+            if (!add_status_line(status_304) || !add_response(etag, sizeof(etag) - 1) ||
+                !add_response(tag, strlen(tag)) || !add_response("\r\n", 2) ||
+                (bundle_hit->variants[BUNDLE_GZIP].present && !add_response(vary, sizeof(vary) - 1)) ||
+                !add_date() || !add_linger() || !add_blank_line()) {
                 return false;
             }
             break;
         }
         case FILE_REQUEST: {
-            add_status_line(200, ok_200_title);
-            add_headers(file_stat.st_size);
-            iv[0].iov_base = write_buf;
-            iv[0].iov_len  = write_idx;
-            iv[1].iov_base = file_address;
-            iv[1].iov_len  = file_stat.st_size;
-            iv_count       = 2;
-
-            bytes_to_send = write_idx + file_stat.st_size;
-
-            return true;
+            if (!add_status_line(status_200) || !add_headers(file_stat.st_size)) {
+                return false;
+            }
+            body_address = file_address;
+            body_size    = file_stat.st_size;
+            break;
+        }
+        case STATS_REQUEST: {
+            if (!add_stats()) {
+                return false;
+            }
+            break;
+        }
+        case BUNDLE_REQUEST: {
+            if (!add_bundle_headers()) {
+                return false;
+            }
+            const bundle_variant& v = bundle_hit->variants[bundle_encoding];
+            body_address            = bundle->at(v.body_offset);
+            body_size               = v.body_size;
+            break;
         }
         default: {
             return false;
         }
     }
 
+    server_stats::count_status(status_code);
+
     iv[0].iov_base = write_buf;
     iv[0].iov_len  = write_idx;
     iv_count       = 1;
     bytes_to_send  = write_idx;
+    if (body_size > 0) {
+        iv[1].iov_base = (char*)body_address;
+        iv[1].iov_len  = body_size;
+        iv_count       = 2;
+        bytes_to_send += body_size;
+    }
     return true;
 }
 
 void connection::process() {
+    server_stats::add(STAT_QUEUE_DEPTH, -1);
+    trace.stamp(TRACE_DEQUEUE);
+    trace.points[TRACE_PARSE_DONE] = 0;
+
     // 解析HTTP请求
-    HTTP_CODE read_ret = parse_http();
+    HTTP_CODE read_ret;
+    {
+        perf_scope perf(PERF_STAGE_PARSE);
+        read_ret = parse_http();
+    }
     if (read_ret == NO_REQUEST) {
-        modify_fd_from_epoll(epollfd, sockfd, EPOLLIN);
+        finish(LOOP_CMD_READ);
+        return;
+    }
+
+    // 请求有误时没有走到查找文件那一步
+    if (!trace.points[TRACE_PARSE_DONE]) {
+        trace.stamp(TRACE_PARSE_DONE);
+    }
+
+    // 转发给上游，取上游连接与之后的收发都在事件循环中进行；领导者/跟随者模式不支持反向代理
+    if (read_ret == PROXY_REQUEST) {
+        post(LOOP_CMD_PROXY);
         return;
     }
 
     // 生成响应
-    bool write_ret = reply_http(read_ret);
+    bool write_ret;
+    {
+        perf_scope perf(PERF_STAGE_RESPONSE);
+        write_ret = reply_http(read_ret);
+    }
     if (!write_ret) {
         LOG_ERROR("response failed, which sockfd is %d", sockfd);
+        finish(LOOP_CMD_CLOSE);
+        return;
+    }
+    trace.stamp(TRACE_RESPONSE_READY);
+    finish(LOOP_CMD_WRITE);
+}
+
+void connection::serve() {
+    // 没有任务队列，入队与出队是同一时刻
+    server_stats::add(STAT_QUEUE_DEPTH);
+    trace.stamp(TRACE_ENQUEUE);
+    process();
+}
+
+// 请求还没有解析，回送429后关闭连接，不占用工作线程
+void connection::reject_request() {
+    server_stats::add(STAT_SHED);
+    trace.stamp(TRACE_PARSE_DONE);
+    if (!reply_http(TOO_MANY_REQUESTS)) {
         close_conn();
         return;
     }
+    trace.stamp(TRACE_RESPONSE_READY);
     modify_fd_from_epoll(epollfd, sockfd, EPOLLOUT);
-}
\ No newline at end of file
+}
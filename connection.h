@@ -1,30 +1,75 @@
 #ifndef CONNECTION_H
 #define CONNECTION_H
 
+#include <atomic>
+#include <string>
+
+#include "accesslog.h"
+#include "bundle.h"
+#include "capture.h"
 #include "epfd.h"
+#include "filecache.h"
+#include "locker.h"
+#include "loopcmd.h"
+#include "ratelimit.h"
+#include "response.h"
 #include "state.h"
+#include "tls.h"
+#include "trace.h"
 
 class client_timer;
 class client_timer_list;
+class reverse_proxy;
+struct proxy_route;
+struct upstream_conn;
+
+extern std::string doc_root;  // 网站的根目录
 
 class connection {
+    friend class connection_bench;  // tools/microbench 直接驱动解析与响应函数
+    friend class reverse_proxy;     // 转发时由代理改写请求、回送响应并结束请求
+
 public:
-    static int user_count;  // 统计目前用户数量
-    static int epollfd;     // 所有socket上的事件都被注册到同一个epoll对象中
+    static std::atomic<int> user_count;  // 统计目前用户数量，事件循环与工作线程都会修改
+    static int              epollfd;     // 客户端socket注册在这个epoll对象中，领导者/跟随者模式下与事件循环分开
+    static bool             leader_follower;  // 领导者/跟随者模式，取到事件的线程自己完成读、处理与写
 
-    static client_timer_list* timer_list;  // 每个HTTP连接的定时器的列表
+    static size_t write_budget;   // 每次EPOLLOUT唤醒最多发送的字节数，0表示不限制
+    static int    notsent_lowat;  // TCP_NOTSENT_LOWAT，内核中未发送数据的低水位，0表示不设置
+    static int    send_buffer;    // SO_SNDBUF，0表示由内核自动调节
+    static int    busy_poll;      // SO_BUSY_POLL，微秒，0表示不忙轮询
+    static int    read_buf_size;   // 读缓冲区大小，一个请求的请求行与头部必须能放下
+    static int    write_buf_size;  // 写缓冲区大小，响应头必须能放下
 
-    sockaddr_in   client_address;  // 客户端地址
-    int           sockfd;          // socket文件描述符
-    client_timer* timer;           // 定时器
+    static client_timer_list* timer_list;  // 每个HTTP连接的定时器的列表
+    static static_bundle*     bundle;      // 静态资源包，非空时从资源包而不是doc_root提供文件
+    static access_log*        access;      // 访问日志，为空时不记录
+    static bool               stats_page;  // 是否通过 /__stats 提供运行时统计
+    static trace_dump*        tracer;      // 采样请求时间线的输出，为空时只记录直方图
+    static traffic_capture*   capture;     // 抓取收到的原始请求，为空时不抓取
+    static reverse_proxy*     proxy;       // 反向代理规则，为空时所有请求都在本地处理
+    static tls_context*       tls;         // TLS证书与配置，有TLS监听地址时非空
+    static loop_channel*      channel;     // 工作线程与磁盘线程向事件循环投递命令
+    static file_cache         files;       // 按路径合并并发的文件查找
+    static client_limiter*    limiter;     // 按客户端IP限流，为空时不限制
+    static locker             timer_lock;  // 保护定时器链表，只在领导者/跟随者模式下使用，此时多个线程会修改它
+
+    sockaddr_storage client_address;  // 客户端地址，IPv4、IPv6或Unix域
+    int              sockfd;          // socket文件描述符
+    uint32_t         conn_id;         // 连接编号，在事件循环中分配，fd会被复用而编号不会
+    client_timer*    timer;           // 定时器
+    request_trace    trace;           // 当前请求各阶段的时间戳
+    upstream_conn*   upstream;        // 转发中的上游连接，只在事件循环中修改
+    tls_session*     tls_sess;        // TLS会话，明文连接为空，在init_conn之前设置
+    loop_cmd         cmd;             // 投递给事件循环的命令节点，同一时刻最多在途一条
+
+    std::atomic<bool> in_flight;  // 已交给工作线程或磁盘线程、命令还没执行，定时器不能关闭它
 
 private:
-    static const int READ_BUF_SIZE  = 2048;  // 读缓冲区大小
-    static const int WRITE_BUF_SIZE = 2048;  // 写缓冲区大小
-    static const int FILENAME_LEN   = 200;   // 文件名的最大长度
+    static const int FILENAME_LEN = 200;  // 文件名的最大长度
 
 private:
-    char        read_buf[READ_BUF_SIZE];  // 读缓冲区
+    char*       read_buf;                 // 读缓冲区，第一次使用这个槽位时分配
     int         read_idx;                 // 在读缓冲区读取数据时的索引
     int         parse_idx;                // 当前正在解析的请求的字符在读缓冲区的位置
     int         parse_line;               // 当前正在解析的请求的所在行，即行的起始位置
@@ -32,21 +77,37 @@ private:
     METHOD      method;                   // 请求方法
     char*       url;                      // 请求的目标文件的文件名
     char*       version;                  // HTTP协议版本号，我们仅支持HTTP1.1
+    int         header_idx;               // 第一个头部字段在读缓冲区中的位置
     char*       host;                     // 主机名
     char        file_path[FILENAME_LEN];  // 请求的目标文件的完整路径，其内容等于 doc_root + url
     bool        is_keep_alive;            // 是否开启HTTP长连接
     int         content_len;              // HTTP请求的消息总长度
+    bool        accept_gzip;              // 客户端是否接受gzip编码
+    char*       if_none_match;            // 客户端缓存的ETag
+
+    const bundle_entry* bundle_hit;       // 在资源包中命中的条目
+    int                 bundle_encoding;  // 命中条目的编码形式
+    proxy_route*        proxy_hit;        // 匹配的反向代理规则
 
 private:
-    char         write_buf[WRITE_BUF_SIZE];  // 写缓冲区
+    char*        write_buf;                  // 写缓冲区，与读缓冲区一起分配
     int          write_idx;                  // 写缓冲区中待发送的字节数
     size_t       bytes_to_send;              // 将要发送的数据的字节数
     size_t       bytes_had_send;             // 已经发送的字节数
+    mapped_file* file_ref;                   // 共享的文件查找结果，见 filecache.h
     char*        file_address;               // 客户请求的目标文件被mmap到内存中的起始位置
     struct stat  file_stat;                  // 目标文件的状态。
+    const char*  body_address;               // 响应体的起始位置，指向mmap的文件、资源包或generated_body
+    std::string  generated_body;             // 在内存中生成的响应体，如 /__stats
+    size_t       body_size;                  // 响应体的字节数
+    size_t       resident_end;               // 响应体中已确认在页缓存中的部分的结束位置
     struct iovec iv[2];                      // 采用writev来执行写操作
     int          iv_count;                   // iv_count表示被写内存块的数量
 
+private:
+    int  status_code;      // 响应的状态码
+    bool keep_alive_used;  // 是否已计入长连接数
+
 public:
     connection();
     ~connection();
@@ -56,12 +117,25 @@ public:
     void update_timer();  // 更新定时器
     void close_sock();    // 断开连接
     void close_conn();    // 删除连接
+    bool handshaking() const { return tls_sess && tls_sess->handshaking(); }
+    bool tls_handshake();  // 推进TLS握手，失败返回false
     bool read();          // 非阻塞读数据，一次性读完
     bool write();         // 非阻塞写数据，一次性写完
     void process();       // 处理http请求，由线程池里面的线程调用
+    void serve();         // 领导者/跟随者模式下读完请求后在当前线程直接处理
+    void reject_request();  // 超过请求速率，在事件循环中直接回送429
+    void load_file();     // 把即将发送的文件内容读入页缓存，由磁盘I/O线程调用
+
+    static void run_commands();  // 执行投递过来的所有命令，在事件循环中eventfd可读时调用
+    static void tick_timers();   // 关闭超时的连接，在事件循环的定时器tick中调用；领导者/跟随者模式下只关闭socket的读写
+
+    static threadpool<connection, &connection::load_file>* disk_pool;  // 加载冷数据的磁盘I/O线程池
 
 private:
-    void      init_parse();  // 初始化http解析请求的状态
+    void      post(LOOP_CMD type);    // 把连接交还给事件循环
+    void      finish(LOOP_CMD type);  // 处理完请求后的下一步，领导者/跟随者模式下直接执行
+    void      run_command(int type);  // 执行一条命令
+    void      init_parse();         // 初始化http解析请求的状态
     HTTP_CODE parse_http();  // 解析http请求
 
     /* 下面这一组函数被parse_http_request调用来解析请求报文 */
@@ -72,6 +146,7 @@ private:
     HTTP_CODE   parse_http_header(char* text);   // 解析http请求头部
     HTTP_CODE   parse_http_content(char* text);  // 解析http请求体
     HTTP_CODE   fetch_file();                    // 具体处理请求
+    HTTP_CODE   fetch_bundle();                  // 从静态资源包中查找请求的资源
 
 private:
     bool reply_http(HTTP_CODE ret_code);  // 填充http响应
@@ -79,14 +154,24 @@ private:
     /* 下面这一组函数被reply_http调用以填充http响应 */
 
     void unmap();
-    bool add_response(const char* format, ...);
-    bool add_content(const char* content);
+    bool load_async();
+    bool add_response(const char* data, size_t len);
+    bool add_content(const char* content, size_t len);
     bool add_content_type();
-    bool add_status_line(int status, const char* title);
-    bool add_headers(int content_length);
-    bool add_content_length(int content_length);
+    bool add_status_line(const const_str<64>& line);
+    bool add_headers(size_t content_length);
+    bool add_bundle_headers();
+    bool add_error(const error_response& resp);
+    bool add_content_length(size_t content_length);
+    bool add_date();
     bool add_linger();
     bool add_blank_line();
+    bool add_stats();
+
+    bool    end_response();                           // 响应发送完毕后的收尾，返回false表示应关闭连接
+    bool    plain_send() const;                       // 能否直接写套接字：明文或发送方向已交给kTLS
+    ssize_t send_bytes(const char* data, size_t len);  // 发送一段数据，需要时经过TLS加密
+    void log_access();  // 请求的响应发送完毕后写一条访问日志
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,42 @@
+#include "diskio.h"
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+disk_stats disk_counters;
+
+static const size_t page_size = sysconf(_SC_PAGESIZE);
+
+bool page_resident(const char* addr, size_t len) {
+    uintptr_t     begin = (uintptr_t)addr & ~(page_size - 1);
+    uintptr_t     end   = (uintptr_t)addr + len;
+    size_t        pages = (end - begin + page_size - 1) / page_size;
+    unsigned char vec[DISK_PROBE_WINDOW / 4096 + 2];
+
+    ++disk_counters.probes;
+    if (pages > sizeof(vec) || mincore((void*)begin, end - begin, vec) != 0) {
+        // 探测失败时按热数据处理，保持原来直接发送的行为
+        return true;
+    }
+    for (size_t i = 0; i < pages; ++i) {
+        if (!(vec[i] & 1)) {
+            ++disk_counters.cold;
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t load_pages(const char* addr, size_t len) {
+    uintptr_t begin = (uintptr_t)addr & ~(page_size - 1);
+    uintptr_t end   = (uintptr_t)addr + len;
+    // 先发起预读，再逐页访问，使缺页在磁盘线程而不是事件循环中发生
+    madvise((void*)begin, end - begin, MADV_WILLNEED);
+    volatile char sink = 0;
+    for (uintptr_t p = begin; p < end; p += page_size) {
+        sink = sink + *(const volatile char*)p;
+    }
+    disk_counters.loaded_bytes += len;
+    return len;
+}
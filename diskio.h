@@ -0,0 +1,34 @@
+#ifndef DISKIO_H
+#define DISKIO_H
+
+#include <stddef.h>
+
+#include <atomic>
+
+/*
+    冷数据探测与加载:
+        写响应体之前用 mincore 检查即将发送的一段数据是否在页缓存中，
+        不在则交给磁盘I/O线程池预先读入，事件循环不会阻塞在缺页上。
+*/
+
+const size_t DISK_PROBE_WINDOW = 1024 * 1024;  // 每次探测与加载的字节数
+
+// 冷路径计数器，用于评估磁盘线程池的大小
+struct disk_stats {
+    std::atomic<unsigned long> probes;        // 探测次数
+    std::atomic<unsigned long> cold;          // 探测到不在页缓存中的次数
+    std::atomic<unsigned long> queued;        // 交给磁盘线程池的次数
+    std::atomic<unsigned long> rejected;      // 磁盘线程池队列已满，只能在事件循环中直接发送的次数
+    std::atomic<unsigned long> loaded_bytes;  // 磁盘线程读入的字节数
+    std::atomic<long>          inflight;      // 正在等待加载的连接数
+};
+
+extern disk_stats disk_counters;
+
+// 判断 [addr, addr+len) 对应的页是否都已在内存中
+bool page_resident(const char* addr, size_t len);
+
+// 在当前线程中把 [addr, addr+len) 读入页缓存，返回读入的字节数
+size_t load_pages(const char* addr, size_t len);
+
+#endif
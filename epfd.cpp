@@ -29,9 +29,9 @@ void add_fd_to_epoll(int epollfd, int fd, bool one_shot, bool is_ET) {
         // 防止同一个通信被不同线程处理
         event.events |= EPOLLONESHOT;
     }
-    epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
-    // 设置文件描述符非阻塞
+    // 先设置非阻塞再注册，注册之后别的线程可能马上读它
     set_fd_nonblock(fd);
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
 }
 
 // 从epoll对象中删除文件描述符
@@ -60,11 +60,77 @@ void reuse_addr(int sockfd) {
     setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 }
 
+/*
+    TCP_NOTSENT_LOWAT: 未发送的数据超过低水位时 send 返回EAGAIN，低于低水位时才报告EPOLLOUT，
+    慢速客户端在内核中最多积压约一个低水位的未发送数据，其余留在页缓存里等EPOLLOUT时再发；
+    SO_SNDBUF: 固定发送缓冲区(含已发送未确认的数据)的上限，同时关闭内核对它的自动调节
+*/
+void set_send_limits(int sockfd, int notsent_lowat, int send_buffer) {
+    if (notsent_lowat > 0 &&
+        setsockopt(sockfd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &notsent_lowat, sizeof(notsent_lowat)) != 0) {
+        LOG_WARN("set TCP_NOTSENT_LOWAT on sockfd %d failed, errno is: %d", sockfd, errno);
+    }
+    if (send_buffer > 0 && setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &send_buffer, sizeof(send_buffer)) != 0) {
+        LOG_WARN("set SO_SNDBUF on sockfd %d failed, errno is: %d", sockfd, errno);
+    }
+}
+
+/*
+    内核忙轮询:
+        epoll_wait 在没有就绪事件时不立即睡眠，而是直接轮询监听的套接字所在的网卡接收队列(NAPI)，
+        prefer_busy_poll 让软中断把收包留给忙轮询，减少中断与唤醒的延迟。
+        只对来自真实网卡的连接有效，回环和Unix域套接字没有NAPI队列，设置了也没有作用。
+    EPIOCSPARAMS 需要6.9以上的内核，旧版本的头文件中没有，按内核的定义补上。
+*/
+#ifndef EPIOCSPARAMS
+struct epoll_params {
+    uint32_t busy_poll_usecs;
+    uint16_t busy_poll_budget;
+    uint8_t  prefer_busy_poll;
+    uint8_t  __pad;
+};
+#define EPIOCSPARAMS _IOW(0x8A, 0x01, struct epoll_params)
+#endif
+
+bool set_epoll_busy_poll(int epollfd, int usecs) {
+    epoll_params params;
+    memset(&params, 0, sizeof(params));
+    params.busy_poll_usecs  = usecs;
+    params.busy_poll_budget = 8;  // 每次轮询处理的包数，超过64需要CAP_NET_ADMIN
+    params.prefer_busy_poll = 1;
+    if (ioctl(epollfd, EPIOCSPARAMS, &params) != 0) {
+        LOG_WARN("set epoll busy poll failed, errno is: %d", errno);
+        return false;
+    }
+    return true;
+}
+
+void set_socket_busy_poll(int sockfd, int usecs) {
+    if (setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) != 0) {
+        LOG_WARN("set busy poll on sockfd %d failed, errno is: %d", sockfd, errno);
+    }
+#ifdef SO_PREFER_BUSY_POLL
+    int prefer = 1;
+    setsockopt(sockfd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer));
+#endif
+}
+
 // 打印新连接的客户端信息
-void print_client_info(sockaddr_in client_address) {
-    char clientIp[16] = {0};
-    inet_ntop(AF_INET, &client_address.sin_addr.s_addr, clientIp, sizeof(clientIp));
-    unsigned short clientPort = ntohs(client_address.sin_port);
+void print_client_info(const sockaddr_storage& client_address) {
+    char           clientIp[INET6_ADDRSTRLEN] = {0};
+    unsigned short clientPort                 = 0;
+    if (client_address.ss_family == AF_INET) {
+        const sockaddr_in* in = (const sockaddr_in*)&client_address;
+        inet_ntop(AF_INET, &in->sin_addr, clientIp, sizeof(clientIp));
+        clientPort = ntohs(in->sin_port);
+    } else if (client_address.ss_family == AF_INET6) {
+        const sockaddr_in6* in6 = (const sockaddr_in6*)&client_address;
+        inet_ntop(AF_INET6, &in6->sin6_addr, clientIp, sizeof(clientIp));
+        clientPort = ntohs(in6->sin6_port);
+    } else {
+        // Unix域套接字的客户端通常没有绑定地址
+        strcpy(clientIp, "unix");
+    }
     LOG_INFO("new connection: client ip is %s, port is %d", clientIp, clientPort);
 }
 
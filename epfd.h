@@ -6,12 +6,14 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -32,8 +34,11 @@ void add_fd_to_epoll(int epollfd, int fd, bool one_shot, bool is_ET);  // 添加
 void remove_fd_from_epoll(int epollfd, int fd);                        // 从epoll对象中删除文件描述符
 void modify_fd_from_epoll(int epollfd, int fd, int ev);                // 从epoll对象中删除文件描述符
 
-void reuse_addr(int sockfd);                         // 设置端口复用
-void print_client_info(sockaddr_in client_address);  // 打印新连接的客户端信息
+void reuse_addr(int sockfd);                                       // 设置端口复用
+void set_send_limits(int sockfd, int notsent_lowat, int send_buffer);  // 限制内核中为连接缓存的待发送数据，0表示不设置
+bool set_epoll_busy_poll(int epollfd, int usecs);                      // epoll_wait没有事件时先在网卡队列上忙轮询usecs微秒
+void set_socket_busy_poll(int sockfd, int usecs);                      // 套接字上阻塞读写前先忙轮询usecs微秒，并优先忙轮询
+void print_client_info(const sockaddr_storage& client_address);   // 打印新连接的客户端信息
 
 void addsig(int sig, void(handler)(int), bool restart = true);  // 信号捕捉
 void alrm_handler(int sig);                                     // 定时信号处理函数
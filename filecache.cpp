@@ -0,0 +1,153 @@
+#include "filecache.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+int              file_cache::share_ms             = 1000;
+size_t           file_cache::sequential_threshold = 1024 * 1024;
+file_cache_stats file_cache::stats;
+
+static uint64_t monotonic_ms() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+mapped_file* file_cache::acquire(const char* path) {
+    ++stats.lookups;
+    m_lock.lock();
+    auto it = m_files.find(path);
+    if (it != m_files.end()) {
+        mapped_file* file = it->second;
+        if (file->loading) {
+            // 别的线程正在查找同一个文件，等它的结果
+            ++file->refs;
+            ++stats.waited;
+            while (file->loading) {
+                m_loaded.wait(m_lock.get());
+            }
+            m_lock.unlock();
+            return file;
+        }
+        if (monotonic_ms() - file->loaded_ms <= (uint64_t)share_ms) {
+            ++file->refs;
+            ++stats.shared;
+            m_lock.unlock();
+            return file;
+        }
+        // 结果已经太旧，换成新的条目重新查找，旧条目在最后一个持有者释放时删除
+        m_files.erase(it);
+    }
+
+    mapped_file* file = new mapped_file();
+    file->path        = path;
+    file->result      = NO_RESOURCE;
+    file->address     = nullptr;
+    file->loaded_ms   = 0;
+    file->loading     = true;
+    file->refs        = 1;
+    m_files[file->path] = file;
+    m_lock.unlock();
+
+    // 在锁外执行文件系统调用，其他路径的查找不受影响
+    load(file);
+    ++stats.loads;
+
+    m_lock.lock();
+    file->loaded_ms = monotonic_ms();
+    file->loading   = false;
+    m_loaded.broadcast();
+    m_lock.unlock();
+    return file;
+}
+
+void file_cache::release(mapped_file* file) {
+    m_lock.lock();
+    if (file->result == FILE_REQUEST) {
+        ++m_hits[file->path];
+    }
+    if (--file->refs > 0) {
+        m_lock.unlock();
+        return;
+    }
+    auto it = m_files.find(file->path);
+    if (it != m_files.end() && it->second == file) {
+        m_files.erase(it);
+    }
+    m_lock.unlock();
+
+    if (file->address) {
+        munmap(file->address, file->st.st_size);
+    }
+    delete file;
+}
+
+void file_cache::load(mapped_file* file) {
+    // 获取文件的相关的状态信息，-1失败，0成功
+    if (stat(file->path.c_str(), &file->st) < 0) {
+        file->result = NO_RESOURCE;
+        return;
+    }
+
+    // 判断访问权限
+    if (!(file->st.st_mode & S_IROTH)) {
+        file->result = FORBIDDEN_REQUEST;
+        return;
+    }
+
+    // 判断是否是目录
+    if (S_ISDIR(file->st.st_mode)) {
+        file->result = BAD_REQUEST;
+        return;
+    }
+
+    file->result = FILE_REQUEST;
+    if (file->st.st_size == 0) {
+        return;
+    }
+
+    // 以只读方式打开文件并创建内存映射
+    int fd = open(file->path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        file->result = NO_RESOURCE;
+        return;
+    }
+    void* address = mmap(0, file->st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (address == MAP_FAILED) {
+        file->result = INTERNAL_ERROR;
+        return;
+    }
+    file->address = (char*)address;
+
+    // 大文件按顺序发送，小文件一次读完
+    if ((size_t)file->st.st_size >= sequential_threshold) {
+        madvise(address, file->st.st_size, MADV_SEQUENTIAL);
+    } else {
+        madvise(address, file->st.st_size, MADV_WILLNEED);
+    }
+}
+
+std::vector<std::string> file_cache::hot_paths(size_t max_files) {
+    std::vector<std::pair<unsigned long, std::string>> hits;
+    m_lock.lock();
+    hits.reserve(m_hits.size());
+    for (const auto& h : m_hits) {
+        hits.emplace_back(h.second, h.first);
+    }
+    m_lock.unlock();
+
+    size_t n = std::min(max_files, hits.size());
+    std::partial_sort(hits.begin(), hits.begin() + n, hits.end(),
+                      [](const std::pair<unsigned long, std::string>& a,
+                         const std::pair<unsigned long, std::string>& b) { return a.first > b.first; });
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < n; ++i) {
+        paths.push_back(hits[i].second);
+    }
+    return paths;
+}
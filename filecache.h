@@ -0,0 +1,70 @@
+#ifndef FILECACHE_H
+#define FILECACHE_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cond.h"
+#include "locker.h"
+#include "state.h"
+
+/*
+    文件查找的合并(single-flight):
+        按文件路径登记正在进行的查找。同一路径上第一个到达的工作线程负责 stat/open/mmap，
+        同时到达的请求在条件变量上等它完成后直接共享结果，包括"不存在"、"无权限"这类失败结果；
+        成功的映射按引用计数共享，最后一个发送完的连接负责munmap。
+        映射完成后 share_ms 毫秒内到达、且仍有连接持有该映射的请求也直接共享，不再重新查找；
+        超过这个时间的请求重新查找，部署替换文件后最多在这段时间内仍返回旧内容。
+        不缓存没有持有者的映射，冷启动或部署后的瞬时洪峰只会产生一次文件系统调用，平时的行为与原来相同。
+        映射建立后按大小给内核建议：不小于 sequential_threshold 的文件按顺序读(MADV_SEQUENTIAL，加大预读、读过的页优先回收)，
+        小文件整体预读(MADV_WILLNEED)，发送时不再逐页缺页。
+        另外按路径累计成功的命中次数，供 warmup.h 写出热点列表。
+*/
+
+// 一次文件查找的结果，由所有同时请求该路径的连接共享
+struct mapped_file {
+    std::string path;
+    HTTP_CODE   result;     // FILE_REQUEST 表示成功，否则是要回送的错误
+    char*       address;    // 映射的起始位置，空文件为nullptr
+    struct stat st;         // 文件的状态
+    uint64_t    loaded_ms;  // 查找完成的时刻，单调时钟毫秒
+    bool        loading;    // 第一个请求者还在查找
+    int         refs;       // 持有者数，包括正在等待的请求
+};
+
+// 合并计数器，在定时器tick中输出到日志
+struct file_cache_stats {
+    std::atomic<unsigned long> lookups;  // 查找次数
+    std::atomic<unsigned long> loads;    // 实际执行 stat/open/mmap 的次数
+    std::atomic<unsigned long> waited;   // 等待其他线程查找完成的次数
+    std::atomic<unsigned long> shared;   // 直接共享已完成结果的次数
+};
+
+class file_cache {
+public:
+    static int    share_ms;              // 映射完成后仍可共享的时间，毫秒，0表示只合并同时进行的查找
+    static size_t sequential_threshold;  // 不小于该大小的映射按顺序读建议内核，更小的整体预读
+
+    // 查找path，总是返回一个引用，调用者用完后必须release；result不是FILE_REQUEST时address无效
+    mapped_file* acquire(const char* path);
+    void         release(mapped_file* file);
+
+    std::vector<std::string> hot_paths(size_t max_files);  // 命中次数最多的文件，从高到低
+
+    static file_cache_stats stats;
+
+private:
+    void load(mapped_file* file);
+
+    std::unordered_map<std::string, mapped_file*>  m_files;   // 正在查找或仍被持有的文件
+    std::unordered_map<std::string, unsigned long> m_hits;    // 每个文件成功命中的次数
+    locker                                         m_lock;    // 保护m_files、m_hits与每个条目的状态
+    cond                                           m_loaded;  // 有查找完成时广播
+};
+
+#endif
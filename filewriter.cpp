@@ -0,0 +1,117 @@
+#include "filewriter.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+
+file_writer::file_writer(size_t flush_size, uint64_t max_size)
+    : m_flush_size(flush_size), m_max_size(max_size), m_fd(-1), m_background(false), m_written(0), m_full(false) {}
+
+file_writer::~file_writer() {
+    if (m_fd != -1) {
+        // 先解除注册，等后台线程写完正在写的一批
+        if (m_background) {
+            Log::get_instance()->remove_task(this);
+        }
+        sync();
+        close(m_fd);
+    }
+}
+
+bool file_writer::open(const char* path, int flags, mode_t mode) {
+    m_fd = ::open(path, flags, mode);
+    if (m_fd == -1) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(m_fd, &st) == 0) {
+        m_written = st.st_size;
+    }
+    m_buf.reserve(m_flush_size * 2);
+    m_background = Log::get_instance()->add_task(background_write, this);
+    return true;
+}
+
+bool file_writer::append(const void* head, size_t head_len, const void* data, size_t data_len) {
+    m_mutex.lock();
+    if (m_full || (m_max_size && m_written + head_len + data_len > m_max_size)) {
+        m_full = true;
+        m_mutex.unlock();
+        return false;
+    }
+    m_buf.append((const char*)head, head_len);
+    if (data_len > 0) {
+        m_buf.append((const char*)data, data_len);
+    }
+    m_written += head_len + data_len;
+    bool full = m_buf.size() >= m_flush_size;
+    m_mutex.unlock();
+
+    if (full) {
+        flush();
+    }
+    return true;
+}
+
+void file_writer::flush() {
+    if (!m_background) {
+        sync();
+        return;
+    }
+    // 上一批还没写完时不交接，记录继续攒在m_buf中，等下一次flush
+    m_mutex.lock();
+    bool wake = m_pending.empty() && !m_buf.empty();
+    if (wake) {
+        m_pending.swap(m_buf);
+    }
+    m_mutex.unlock();
+    if (wake) {
+        Log::get_instance()->wakeup();
+    }
+}
+
+void file_writer::sync() {
+    m_io.lock();
+    m_mutex.lock();
+    m_out.swap(m_pending);
+    m_out.append(m_buf);
+    m_buf.clear();
+    m_mutex.unlock();
+    write_out(m_out);
+    m_io.unlock();
+}
+
+uint64_t file_writer::written() {
+    m_mutex.lock();
+    uint64_t n = m_written;
+    m_mutex.unlock();
+    return n;
+}
+
+void file_writer::background_write(void* arg) {
+    file_writer* w = (file_writer*)arg;
+    w->m_io.lock();
+    w->m_mutex.lock();
+    w->m_out.swap(w->m_pending);
+    w->m_mutex.unlock();
+    w->write_out(w->m_out);
+    w->m_io.unlock();
+}
+
+void file_writer::write_out(std::string& buf) {
+    size_t off = 0;
+    while (off < buf.size()) {
+        ssize_t n = ::write(m_fd, buf.data() + off, buf.size() - off);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        off += n;
+    }
+    buf.clear();
+}
@@ -0,0 +1,51 @@
+#ifndef FILEWRITER_H
+#define FILEWRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+
+#include "locker.h"
+
+/*
+    访问日志、流量抓取共用的批量写文件:
+        记录先追加到内存缓冲区，攒到 flush_size 或调用 flush 时整批交给日志后台线程写入文件，
+        事件循环与工作线程都不会阻塞在 write 上；日志为同步模式(没有后台线程)时在调用线程中直接写出。
+        后台线程还没写完上一批时新的记录继续攒在缓冲区中，不丢弃。
+        max_size 大于0时文件达到该大小后拒绝后续记录
+*/
+class file_writer {
+public:
+    explicit file_writer(size_t flush_size, uint64_t max_size = 0);
+    ~file_writer();  // 写出全部记录后关闭文件
+
+    bool open(const char* path, int flags, mode_t mode);
+
+    // 追加一条记录，head 之后紧跟 data，两部分在文件中连续；超过大小上限时返回false
+    bool append(const void* head, size_t head_len, const void* data = nullptr, size_t data_len = 0);
+
+    void     flush();    // 把缓冲区中的记录交给后台线程写出
+    void     sync();     // 在调用线程中写出全部记录
+    uint64_t written();  // 文件原有的与已追加的字节数
+
+private:
+    static void background_write(void* arg);  // 由日志后台线程调用
+    void        write_out(std::string& buf);   // 需持有m_io
+
+    size_t   m_flush_size;
+    uint64_t m_max_size;
+    int      m_fd;
+    bool     m_background;  // 是否由日志后台线程写出
+    uint64_t m_written;
+    bool     m_full;  // 达到大小上限后不再接受记录
+
+    std::string m_buf;      // 正在追加的记录
+    std::string m_pending;  // 等待后台线程写出的一批
+    std::string m_out;      // 正在写入文件的一批，需持有m_io
+    locker      m_mutex;    // 保护m_buf、m_pending与计数
+    locker      m_io;       // 保证各批记录按追加的顺序写入文件
+};
+
+#endif
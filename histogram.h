@@ -0,0 +1,63 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    HDR风格的对数-线性直方图:
+        小于64的值每个值一个桶；之后每个2的幂区间再等分成32个桶，相对误差不超过约3%。
+        下标只需一次clz与移位即可算出，记录一个值是一次数组自增。
+        可表示的最大值为 2^35-1 纳秒(约34秒)，更大的值计入最后一个桶。
+*/
+
+const int      HIST_SUB_BITS = 6;  // 每个2的幂区间的线性桶数为 2^(HIST_SUB_BITS-1)
+const int      HIST_BUCKETS  = 1024;
+const uint64_t HIST_MAX      = (1ULL << 35) - 1;
+
+inline int hist_index(uint64_t v) {
+    if (v > HIST_MAX) {
+        v = HIST_MAX;
+    }
+    if (v < (1ULL << HIST_SUB_BITS)) {
+        return (int)v;
+    }
+    int e = 63 - __builtin_clzll(v);  // v 所在区间 [2^e, 2^(e+1))
+    int s = (int)(v >> (e - HIST_SUB_BITS + 1));
+    return ((e - HIST_SUB_BITS + 1) << (HIST_SUB_BITS - 1)) + s;
+}
+
+// 桶的下界
+inline uint64_t hist_value(int idx) {
+    if (idx < (1 << HIST_SUB_BITS)) {
+        return idx;
+    }
+    int half  = 1 << (HIST_SUB_BITS - 1);
+    int shift = idx / half - 1;
+    return (uint64_t)(idx - shift * half) << shift;
+}
+
+// 取分位数，q 取值 0~1，返回桶的下界
+inline uint64_t hist_percentile(const uint64_t counts[HIST_BUCKETS], double q) {
+    uint64_t total = 0;
+    for (int i = 0; i < HIST_BUCKETS; ++i) {
+        total += counts[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(q * total);
+    if (rank >= total) {
+        rank = total - 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; ++i) {
+        seen += counts[i];
+        if (seen > rank) {
+            return hist_value(i);
+        }
+    }
+    return hist_value(HIST_BUCKETS - 1);
+}
+
+#endif
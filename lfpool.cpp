@@ -0,0 +1,135 @@
+#include "lfpool.h"
+
+#include <errno.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <exception>
+
+#include "connection.h"
+#include "log.h"
+
+lf_stats lf_pool::stats;
+
+lf_pool::lf_pool(int num, int epollfd, connection* connections)
+    : m_num(num), m_threads(nullptr), m_epollfd(epollfd), m_wakefd(-1), m_connections(connections), m_stop(false) {
+    if (num <= 0) {
+        throw std::exception();
+    }
+
+    // 水平触发且不是ONESHOT，写入之后每个线程轮到领导者时都能取到它
+    m_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wakefd == -1) {
+        throw std::exception();
+    }
+    epoll_event event;
+    event.data.fd = m_wakefd;
+    event.events  = EPOLLIN;
+    if (epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_wakefd, &event) == -1) {
+        close(m_wakefd);
+        throw std::exception();
+    }
+
+    m_threads = new pthread_t[m_num];
+    for (int i = 0; i < m_num; ++i) {
+        int ret = pthread_create(m_threads + i, nullptr, worker, this);
+        LOG_INFO("正在创建第 %d 个领导者/跟随者线程, 线程号: %ld", i, m_threads[i]);
+        if (ret != 0) {
+            // 已经创建的线程先停下来再释放
+            m_num = i;
+            stop();
+            throw std::exception();
+        }
+    }
+}
+
+lf_pool::~lf_pool() { stop(); }
+
+// 设置停止标志并唤醒所有线程，等它们退出之后才释放，线程不会在对象销毁后继续使用它
+void lf_pool::stop() {
+    m_stop = true;
+    uint64_t one = 1;
+    ssize_t  ret = write(m_wakefd, &one, sizeof(one));
+    (void)ret;
+    for (int i = 0; i < m_num; ++i) {
+        pthread_join(m_threads[i], nullptr);
+    }
+    epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_wakefd, 0);
+    close(m_wakefd);
+    delete[] m_threads;
+    m_threads = nullptr;
+    m_num     = 0;
+}
+
+void* lf_pool::worker(void* arg) {
+    lf_pool* pool = (lf_pool*)arg;
+    pool->run();
+    return pool;
+}
+
+void lf_pool::run() {
+    epoll_event event;
+    while (!m_stop) {
+        // 只有领导者在epoll_wait，跟随者阻塞在令牌上
+        m_leader.lock();
+        int num = epoll_wait(m_epollfd, &event, 1, -1);
+        // 取到事件后马上交出令牌，一个跟随者接任领导者，当前线程去处理这个事件
+        m_leader.unlock();
+
+        if (num == -1 && errno != EINTR) {
+            LOG_ERROR("leader epoll failed, errno is: %d", errno);
+            continue;
+        }
+        if (num <= 0) {
+            continue;
+        }
+        if (event.data.fd == m_wakefd) {
+            // 停止通知，不读出计数，其余线程也能取到它
+            break;
+        }
+        ++stats.events;
+        handle(event);
+    }
+}
+
+void lf_pool::handle(const epoll_event& event) {
+    int         sockfd = event.data.fd;
+    connection& conn   = m_connections[sockfd];
+
+    if (event.events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        // 对方异常断开或挂起、错误等事件
+        LOG_INFO("opposite close or hup or wrong, which sockfd is %d", sockfd);
+        conn.close_conn();
+
+    } else if (conn.handshaking()) {
+        // TLS握手未完成，可读可写都用来推进握手
+        if (conn.tls_handshake()) {
+            conn.update_timer();
+        } else {
+            conn.close_conn();
+        }
+
+    } else if (event.events & EPOLLIN) {
+        if (!conn.read()) {
+            LOG_ERROR("read wrong, which sockfd is %d", sockfd);
+            conn.close_conn();
+            return;
+        }
+        conn.update_timer();
+        // 超过该IP的请求速率时回送429
+        if (connection::limiter && !connection::limiter->on_request(conn.client_address)) {
+            conn.reject_request();
+            return;
+        }
+        ++stats.requests;
+        conn.serve();
+
+    } else if (event.events & EPOLLOUT) {
+        if (!conn.write()) {
+            LOG_ERROR("write wrong, which sockfd is %d", sockfd);
+            conn.close_conn();
+        } else {
+            conn.update_timer();
+        }
+    }
+}
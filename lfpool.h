@@ -0,0 +1,54 @@
+#ifndef LFPOOL_H
+#define LFPOOL_H
+
+#include <pthread.h>
+#include <sys/epoll.h>
+
+#include <atomic>
+
+#include "locker.h"
+
+/*
+    领导者/跟随者线程池:
+        默认的半同步/半反应堆模式中，事件循环读请求、放进工作队列，工作线程解析并生成响应后再交回事件循环发送，
+        每个请求至少跨两次线程。领导者/跟随者模式下客户端socket注册在一个单独的epoll对象中，
+        池中的线程轮流持有领导者令牌(互斥锁)：持有令牌的线程独占 epoll_wait，取到一个事件后立即交出令牌，
+        由一个跟随者接任领导者，自己在当前线程中完成读、解析、生成响应与发送，没有任何队列与线程间交接。
+        客户端socket都是ONESHOT，一个连接在被处理期间不会报告给其他线程。
+        accept、定时器tick、磁盘I/O线程的完成通知仍在事件循环中处理。
+        定时器tick不释放连接，只对超时的socket调用shutdown，由取到事件或读写出错的线程自己关闭连接，
+        连接的映射、TLS会话与fd不会在另一个线程处理它时被回收。
+*/
+
+class connection;
+
+// 领导者/跟随者计数器，在定时器tick中输出到日志
+struct lf_stats {
+    std::atomic<unsigned long> events;    // 取到的事件数
+    std::atomic<unsigned long> requests;  // 直接处理的请求数
+};
+
+class lf_pool {
+public:
+    // epollfd是只注册客户端socket的epoll对象，connections是按fd索引的连接表
+    lf_pool(int num, int epollfd, connection* connections);
+    ~lf_pool();
+
+    static lf_stats stats;
+
+private:
+    static void* worker(void* arg);
+    void         run();
+    void         handle(const epoll_event& event);  // 处理一个客户端事件，与事件循环中的分支相同
+    void         stop();  // 唤醒并等待所有线程退出
+
+    int               m_num;
+    pthread_t*        m_threads;
+    int               m_epollfd;
+    int               m_wakefd;  // 注册在m_epollfd中的eventfd，析构时写入，唤醒阻塞在epoll_wait上的领导者
+    connection*       m_connections;
+    locker            m_leader;  // 领导者令牌
+    std::atomic<bool> m_stop;
+};
+
+#endif
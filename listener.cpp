@@ -0,0 +1,142 @@
+#include "listener.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "epfd.h"
+#include "log.h"
+
+static bool all_digits(const char* s) {
+    if (*s == '\0') {
+        return false;
+    }
+    for (; *s; ++s) {
+        if (!isdigit((unsigned char)*s)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool strip_tls_prefix(const char*& spec) {
+    if (strncmp(spec, "tls:", 4) != 0) {
+        return false;
+    }
+    spec += 4;
+    return true;
+}
+
+bool parse_listen_address(const char* spec, sockaddr_storage& addr, socklen_t& len) {
+    memset(&addr, 0, sizeof(addr));
+
+    if (strncmp(spec, "unix:", 5) == 0) {
+        sockaddr_un* un   = (sockaddr_un*)&addr;
+        const char*  path = spec + 5;
+        size_t       n    = strlen(path);
+        if (n == 0 || n >= sizeof(un->sun_path)) {
+            return false;
+        }
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, path, n);
+        if (path[0] == '@') {
+            // 抽象命名空间以'\0'开头，地址长度不含结尾的'\0'
+            un->sun_path[0] = '\0';
+            len             = offsetof(sockaddr_un, sun_path) + n;
+        } else {
+            len = sizeof(sockaddr_un);
+        }
+        return true;
+    }
+
+    if (all_digits(spec)) {
+        sockaddr_in* in    = (sockaddr_in*)&addr;
+        in->sin_family      = AF_INET;
+        in->sin_addr.s_addr = INADDR_ANY;
+        in->sin_port        = htons(atoi(spec));
+        len                 = sizeof(sockaddr_in);
+        return true;
+    }
+
+    const char* colon = strrchr(spec, ':');
+    if (!colon || !all_digits(colon + 1)) {
+        return false;
+    }
+    std::string host(spec, colon - spec);
+    if (host.size() > 2 && host[0] == '[' && host[host.size() - 1] == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+    addrinfo hints, *res = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags    = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), colon + 1, &hints, &res) != 0 || !res) {
+        return false;
+    }
+    memcpy(&addr, res->ai_addr, res->ai_addrlen);
+    len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return true;
+}
+
+int open_listener(const char* spec, int backlog) {
+    sockaddr_storage addr;
+    socklen_t        len;
+    if (!parse_listen_address(spec, addr, len)) {
+        LOG_ERROR("invalid listen address %s", spec);
+        return -1;
+    }
+
+    int fd = socket(addr.ss_family, SOCK_STREAM, 0);
+    if (fd == -1) {
+        LOG_ERROR("create listen socket %s failed, errno is: %d", spec, errno);
+        return -1;
+    }
+
+    if (addr.ss_family == AF_UNIX) {
+        // 上次运行残留的套接字文件会让bind失败，只删除套接字类型的文件
+        const char* path = ((sockaddr_un*)&addr)->sun_path;
+        struct stat st;
+        if (path[0] != '\0' && lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+            unlink(path);
+        }
+    } else {
+        // 设置端口复用, 绑定前设置
+        reuse_addr(fd);
+        if (addr.ss_family == AF_INET6 && IN6_IS_ADDR_UNSPECIFIED(&((sockaddr_in6*)&addr)->sin6_addr)) {
+            // [::] 同时接受IPv4连接，客户端地址以 ::ffff:a.b.c.d 的形式出现
+            int v6only = 0;
+            setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+        }
+    }
+
+    if (bind(fd, (sockaddr*)&addr, len) == -1 || listen(fd, backlog) == -1) {
+        LOG_ERROR("listen on %s failed, errno is: %d", spec, errno);
+        close(fd);
+        return -1;
+    }
+    LOG_INFO("listening on %s, fd is %d", spec, fd);
+    return fd;
+}
+
+std::string listener_key(const char* spec) {
+    strip_tls_prefix(spec);
+    if (all_digits(spec)) {
+        return spec;
+    }
+    if (strncmp(spec, "unix:", 5) != 0) {
+        const char* colon = strrchr(spec, ':');
+        return colon ? colon + 1 : spec;
+    }
+    std::string key;
+    for (const char* p = spec + 5; *p; ++p) {
+        key += isalnum((unsigned char)*p) ? *p : '_';
+    }
+    return "unix" + key;
+}
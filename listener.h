@@ -0,0 +1,31 @@
+#ifndef LISTENER_H
+#define LISTENER_H
+
+#include <sys/socket.h>
+
+#include <string>
+
+/*
+    监听地址的写法:
+        8080            0.0.0.0:8080，与原来只给端口号的用法一致
+        host:port       IPv4或IPv6地址，如 127.0.0.1:8080、[::1]:8080
+        [::]:8080       IPv6任意地址，同时接受IPv4连接(双栈)
+        unix:/路径      Unix域流式套接字，启动时删除残留的同名套接字文件
+        unix:@名称      Linux抽象命名空间中的Unix域套接字，不占用文件系统
+        tls:地址        以上任一写法加上tls:前缀，该地址上的连接先做TLS握手，证书由 -K 指定(见 tls.h)
+    所有监听套接字上接受的连接都交给同一套连接处理逻辑。
+*/
+
+// 去掉tls:前缀，有前缀时返回true
+bool strip_tls_prefix(const char*& spec);
+
+// 解析监听地址，失败返回false
+bool parse_listen_address(const char* spec, sockaddr_storage& addr, socklen_t& len);
+
+// 创建、绑定并监听，失败返回-1
+int open_listener(const char* spec, int backlog);
+
+// 由监听地址得到统计共享内存段的名称后缀：TCP为端口号，Unix域套接字为路径中的字母数字，其余字符换成'_'
+std::string listener_key(const char* spec);
+
+#endif
@@ -1,152 +1,547 @@
-#include "log.h"
-
-Log::Log() {
-    m_count    = 0;
-    m_is_async = false;
-}
-
-Log::~Log() {
-    if (m_fp != nullptr) {
-        fclose(m_fp);
-    }
-}
-
-//异步需要设置阻塞队列的长度，同步不需要设置
-bool Log::init(const char *file_name, int log_buf_size, int split_lines, int max_queue_size) {
-    //如果设置了max_queue_size,则设置为异步
-    if (max_queue_size >= 1) {
-        m_is_async  = true;
-        m_log_queue = new blockqueue<std::string>(max_queue_size);
-        pthread_t tid;
-        //flush_log_thread为回调函数,这里表示创建线程异步写日志
-        pthread_create(&tid, nullptr, flush_log_thread, nullptr);
-    }
-
-    m_log_buf_size = log_buf_size;
-    m_buf          = new char[m_log_buf_size];
-    memset(m_buf, '\0', m_log_buf_size);
-    m_split_lines = split_lines;
-
-    time_t     t      = time(nullptr);
-    struct tm *sys_tm = localtime(&t);
-    struct tm  my_tm  = *sys_tm;
-
-    //strrchr在参数 str 所指向的字符串中搜索最后一次出现字符 c 的位置
-    const char *p = strrchr(file_name, '/');
-
-    char log_full_name[512] = {0};
-
-    if (p == nullptr) {
-        snprintf(log_full_name, 512, "%d_%02d_%02d_%s", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
-                 file_name);
-    } else {
-        strcpy(log_name, p + 1);
-        strncpy(dir_name, file_name, p - file_name + 1);
-        snprintf(log_full_name, 512, "%s%d_%02d_%02d_%s", dir_name, my_tm.tm_year + 1900, my_tm.tm_mon + 1,
-                 my_tm.tm_mday, log_name);
-    }
-
-    m_today = my_tm.tm_mday;
-
-    m_fp = fopen(log_full_name, "a");
-    if (m_fp == nullptr) {
-        return false;
-    }
-
-    return true;
-}
-
-void Log::async_write_log() {
-    std::string single_log;
-    //从阻塞队列中取出一个日志string，写入文件
-    while (m_log_queue->pop(single_log)) {
-        m_mutex.lock();
-        fputs(single_log.c_str(), m_fp);
-        m_mutex.unlock();
-    }
-}
-
-void Log::write_log(int level, const char *format, ...) {
-    struct timeval now = {0, 0};
-    gettimeofday(&now, nullptr);
-    time_t     t      = now.tv_sec;
-    struct tm *sys_tm = localtime(&t);
-    struct tm  my_tm  = *sys_tm;
-    char       s[16]  = {0};
-    switch (level) {
-        case 0:
-            strcpy(s, "[debug]:");
-            break;
-        case 1:
-            strcpy(s, "[info]:");
-            break;
-        case 2:
-            strcpy(s, "[warn]:");
-            break;
-        case 3:
-            strcpy(s, "[erro]:");
-            break;
-        default:
-            strcpy(s, "[info]:");
-            break;
-    }
-    //写入一个log，对m_count++, m_split_lines最大行数
-    m_mutex.lock();
-    m_count++;
-
-    if (m_today != my_tm.tm_mday || m_count % m_split_lines == 0)  //everyday log
-    {
-        char new_log[512] = {0};
-        fflush(m_fp);
-        fclose(m_fp);
-        char tail[16] = {0};
-
-        snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
-
-        if (m_today != my_tm.tm_mday) {
-            snprintf(new_log, 512, "%s%s%s", dir_name, tail, log_name);
-            m_today = my_tm.tm_mday;
-            m_count = 0;
-        } else {
-            snprintf(new_log, 512, "%s%s%s.%lld", dir_name, tail, log_name, m_count / m_split_lines);
-        }
-        m_fp = fopen(new_log, "a");
-    }
-
-    m_mutex.unlock();
-
-    va_list valst;
-    va_start(valst, format);
-
-    std::string log_str;
-    m_mutex.lock();
-
-    //写入的具体时间内容格式
-    int n = snprintf(m_buf, 48, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s ", my_tm.tm_year + 1900, my_tm.tm_mon + 1,
-                     my_tm.tm_mday, my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_usec, s);
-
-    int m = vsnprintf(m_buf + n, m_log_buf_size - 1, format, valst);
-
-    m_buf[n + m]     = '\n';
-    m_buf[n + m + 1] = '\0';
-    log_str          = m_buf;
-
-    m_mutex.unlock();
-
-    if (m_is_async && !m_log_queue->full()) {
-        m_log_queue->push(log_str);
-    } else {
-        m_mutex.lock();
-        fputs(log_str.c_str(), m_fp);
-        m_mutex.unlock();
-    }
-
-    va_end(valst);
-}
-
-void Log::flush(void) {
-    m_mutex.lock();
-    //强制刷新写入流缓冲区
-    fflush(m_fp);
-    m_mutex.unlock();
-}
+#include "log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+Log::Log() {
+    dir_name[0]            = '\0';
+    log_name[0]            = '\0';
+    m_fd                   = -1;
+    m_count                = 0;
+    m_is_async             = false;
+    m_split_lines          = 5000000;
+    m_log_buf_size         = 8192;
+    m_thread_buf_size      = 0;
+    m_flush_interval_ms    = 100;
+    m_today                = 0;
+    m_file_index           = 0;
+    m_buffer_count         = 0;
+    m_unregistered_dropped = 0;
+    m_reported_dropped     = 0;
+    m_wakeup_pending       = false;
+    m_format_count         = 0;
+    m_stamp_sec            = -1;
+    m_stamp[0]             = '\0';
+}
+
+std::atomic<int> Log::m_level(LOG_LEVEL_DEBUG);
+
+Log::~Log() {
+    if (m_fd != -1) {
+        flush();
+        close(m_fd);
+    }
+}
+
+//thread_buf_size大于0时为异步模式，每个线程一个缓冲区，同步不需要设置
+bool Log::init(const char *file_name, int log_buf_size, int split_lines, int thread_buf_size, int flush_interval_ms) {
+    m_log_buf_size      = log_buf_size;
+    m_split_lines       = split_lines;
+    m_flush_interval_ms = flush_interval_ms > 0 ? flush_interval_ms : 100;
+
+    time_t    t = time(nullptr);
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
+
+    //strrchr在参数 str 所指向的字符串中搜索最后一次出现字符 c 的位置
+    const char *p = strrchr(file_name, '/');
+
+    if (p == nullptr) {
+        snprintf(log_name, sizeof(log_name), "%s", file_name);
+    } else {
+        snprintf(log_name, sizeof(log_name), "%s", p + 1);
+        snprintf(dir_name, sizeof(dir_name), "%.*s", (int)(p - file_name + 1), file_name);
+    }
+
+    m_mutex.lock();
+    open_file(my_tm, 0);
+    m_mutex.unlock();
+    if (m_fd == -1) {
+        return false;
+    }
+
+    //如果设置了thread_buf_size,则设置为异步
+    if (thread_buf_size > 0) {
+        size_t capacity = 1;
+        while (capacity < (size_t)thread_buf_size) {
+            capacity <<= 1;
+        }
+        m_thread_buf_size = capacity;
+        m_is_async        = true;
+        pthread_t tid;
+        //flush_log_thread为回调函数,这里表示创建线程异步写日志
+        pthread_create(&tid, nullptr, flush_log_thread, nullptr);
+        pthread_detach(tid);
+    }
+    return true;
+}
+
+// 打开当天的日志文件，index大于0时为按行数切分出的第index个文件，需持有m_mutex
+void Log::open_file(const struct tm &my_tm, long long index) {
+    char new_log[512] = {0};
+    if (index == 0) {
+        snprintf(new_log, sizeof(new_log), "%s%d_%02d_%02d_%s", dir_name, my_tm.tm_year + 1900, my_tm.tm_mon + 1,
+                 my_tm.tm_mday, log_name);
+    } else {
+        snprintf(new_log, sizeof(new_log), "%s%d_%02d_%02d_%s.%lld", dir_name, my_tm.tm_year + 1900,
+                 my_tm.tm_mon + 1, my_tm.tm_mday, log_name, index);
+    }
+    if (m_fd != -1) {
+        close(m_fd);
+    }
+    m_fd         = open(new_log, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    m_today      = my_tm.tm_mday;
+    m_file_index = index;
+}
+
+Log::thread_buffer *Log::local_buffer() {
+    static thread_local thread_buffer *buf        = nullptr;
+    static thread_local bool           registered = false;
+    if (registered) {
+        return buf;
+    }
+    // 每个线程只在第一次写日志时加锁注册一次
+    registered = true;
+    m_mutex.lock();
+    int n = m_buffer_count.load(std::memory_order_relaxed);
+    if (n < MAX_LOG_THREADS) {
+        buf              = new thread_buffer;
+        buf->data        = new char[m_thread_buf_size];
+        buf->capacity    = m_thread_buf_size;
+        buf->head        = 0;
+        buf->tail        = 0;
+        buf->dropped     = 0;
+        buf->cached_tail = 0;
+        m_buffers[n]     = buf;
+        m_buffer_count.store(n + 1, std::memory_order_release);
+    }
+    m_mutex.unlock();
+    return buf;
+}
+
+char *Log::local_scratch() {
+    static thread_local char *scratch      = nullptr;
+    static thread_local int   scratch_size = 0;
+    if (scratch_size < m_log_buf_size) {
+        delete[] scratch;
+        scratch      = new char[m_log_buf_size];
+        scratch_size = m_log_buf_size;
+    }
+    return scratch;
+}
+
+void Log::commit(const char *record, size_t len) {
+    if (!m_is_async) {
+        // 同步模式下在调用线程中格式化并写入
+        m_mutex.lock();
+        m_out.clear();
+        format_record(record, m_out);
+        struct iovec iov = {&m_out[0], m_out.size()};
+        write_file(&iov, 1);
+        m_mutex.unlock();
+        return;
+    }
+
+    thread_buffer *buf = local_buffer();
+    if (!buf) {
+        m_unregistered_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    size_t head = buf->head.load(std::memory_order_relaxed);
+    size_t tail = buf->cached_tail;
+    if (len > buf->capacity - (head - tail)) {
+        tail = buf->cached_tail = buf->tail.load(std::memory_order_acquire);
+        if (len > buf->capacity - (head - tail)) {
+            // 后台线程来不及写出时直接丢弃并计数，不退化为同步写
+            buf->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    size_t pos   = head & (buf->capacity - 1);
+    size_t first = len < buf->capacity - pos ? len : buf->capacity - pos;
+    memcpy(buf->data + pos, record, first);
+    memcpy(buf->data, record + first, len - first);
+    buf->head.store(head + len, std::memory_order_release);
+
+    // 缓冲区超过一半时提前唤醒后台线程，否则等待刷新间隔
+    if (head + len - tail > buf->capacity / 2) {
+        wakeup();
+    }
+}
+
+void Log::wakeup() {
+    if (!m_wakeup_pending.load(std::memory_order_relaxed) && !m_wakeup_pending.exchange(true)) {
+        m_wakeup.post();
+    }
+}
+
+bool Log::add_task(void (*fn)(void *), void *arg) {
+    if (!m_is_async) {
+        return false;
+    }
+    log_task task = {fn, arg};
+    m_task_mutex.lock();
+    m_tasks.push_back(task);
+    m_task_mutex.unlock();
+    return true;
+}
+
+void Log::remove_task(void *arg) {
+    m_task_mutex.lock();
+    for (size_t i = 0; i < m_tasks.size(); ++i) {
+        if (m_tasks[i].arg == arg) {
+            m_tasks.erase(m_tasks.begin() + i);
+            break;
+        }
+    }
+    m_task_mutex.unlock();
+}
+
+unsigned long Log::dropped() {
+    unsigned long total = m_unregistered_dropped.load(std::memory_order_relaxed);
+    int           n     = m_buffer_count.load(std::memory_order_acquire);
+    for (int i = 0; i < n; ++i) {
+        total += m_buffers[i]->dropped.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+// 逐条取出所有线程缓冲区中的记录，格式化后批量写入文件
+void Log::drain() {
+    const size_t batch = 256 * 1024;
+    char        *record = local_scratch();
+    int          n      = m_buffer_count.load(std::memory_order_acquire);
+
+    m_out.clear();
+    for (int i = 0; i < n; ++i) {
+        thread_buffer *buf  = m_buffers[i];
+        size_t         head = buf->head.load(std::memory_order_acquire);
+        size_t         tail = buf->tail.load(std::memory_order_relaxed);
+        size_t         mask = buf->capacity - 1;
+        while (tail < head) {
+            // 记录可能跨越环形缓冲区的末尾，先拷贝成连续的一段
+            log_detail::record_header hdr;
+            for (size_t k = 0; k < sizeof(hdr); ++k) {
+                ((char *)&hdr)[k] = buf->data[(tail + k) & mask];
+            }
+            for (size_t k = 0; k < hdr.size; ++k) {
+                record[k] = buf->data[(tail + k) & mask];
+            }
+            tail += hdr.size;
+            format_record(record, m_out);
+            if (m_out.size() >= batch) {
+                struct iovec iov = {&m_out[0], m_out.size()};
+                write_file(&iov, 1);
+                m_out.clear();
+            }
+        }
+        buf->tail.store(tail, std::memory_order_release);
+    }
+
+    unsigned long total = dropped();
+    if (total > m_reported_dropped) {
+        char notice[128];
+        snprintf(notice, sizeof(notice), "[warn]: %lu log lines dropped because the buffer is full\n",
+                 total - m_reported_dropped);
+        m_out += notice;
+        m_reported_dropped = total;
+    }
+
+    if (!m_out.empty()) {
+        struct iovec iov = {&m_out[0], m_out.size()};
+        write_file(&iov, 1);
+    }
+}
+
+void Log::write_file(struct iovec *iov, int cnt) {
+    time_t    t = time(nullptr);
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
+
+    long long lines = 0;
+    for (int i = 0; i < cnt; ++i) {
+        const char *p   = (const char *)iov[i].iov_base;
+        const char *end = p + iov[i].iov_len;
+        while ((p = (const char *)memchr(p, '\n', end - p)) != nullptr) {
+            ++lines;
+            ++p;
+        }
+    }
+
+    //按天切分，以及按行数切分；批量写入时以批为单位切分，单个文件可能略多于m_split_lines行
+    if (m_today != my_tm.tm_mday) {
+        m_count = 0;
+        open_file(my_tm, 0);
+    } else if (m_split_lines > 0 && m_count / m_split_lines != m_file_index) {
+        open_file(my_tm, m_count / m_split_lines);
+    }
+    m_count += lines;
+
+    while (cnt > 0 && m_fd != -1) {
+        ssize_t n = writev(m_fd, iov, cnt);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        while (cnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --cnt;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+void Log::async_write_log() {
+    //缓冲区超过一半或者到达刷新间隔时，把所有线程的日志写入文件，再执行注册的任务
+    while (true) {
+        m_wakeup.timewait(m_flush_interval_ms);
+        m_wakeup_pending.store(false);
+        m_mutex.lock();
+        drain();
+        m_mutex.unlock();
+
+        m_task_mutex.lock();
+        for (size_t i = 0; i < m_tasks.size(); ++i) {
+            m_tasks[i].fn(m_tasks[i].arg);
+        }
+        m_task_mutex.unlock();
+    }
+}
+
+// 把格式串拆分成片段，转换说明中的长度修饰统一改为与参数编码一致的形式
+int Log::register_format(int level, const char *format, const char *arg_codes) {
+    format_info *info = new format_info;
+    info->level       = level;
+    info->arg_codes   = arg_codes;
+
+    format_piece piece;
+    piece.conv    = 0;
+    const char *p = format;
+    while (*p) {
+        if (*p != '%') {
+            piece.text += *p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            piece.text += '%';
+            p += 2;
+            continue;
+        }
+        // 标志、宽度与精度原样保留，长度修饰被丢弃
+        const char *start = p++;
+        p += strspn(p, "-+ #0123456789.");
+        std::string spec(start, p);
+        p += strspn(p, "hljztL");
+        if (!*p) {
+            piece.text += spec;
+            break;
+        }
+        piece.conv = *p++;
+        switch (piece.conv) {
+            case 'd':
+            case 'i':
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+                spec += "ll";
+                break;
+            default:
+                break;
+        }
+        piece.spec = spec + piece.conv;
+        info->pieces.push_back(piece);
+        piece.text.clear();
+        piece.spec.clear();
+        piece.conv = 0;
+    }
+    if (!piece.text.empty()) {
+        info->pieces.push_back(piece);
+    }
+
+    m_mutex.lock();
+    int id = m_format_count.load(std::memory_order_relaxed);
+    if (id < MAX_FORMATS) {
+        m_formats[id] = info;
+        m_format_count.store(id + 1, std::memory_order_release);
+    } else {
+        delete info;
+        id = MAX_FORMATS;
+    }
+    m_mutex.unlock();
+    return id;
+}
+
+// 按格式串编号找到预先拆分好的片段，逐个参数调用snprintf
+void Log::format_record(const char *record, std::string &out) {
+    log_detail::record_header hdr;
+    memcpy(&hdr, record, sizeof(hdr));
+    if (hdr.id >= (uint32_t)m_format_count.load(std::memory_order_acquire)) {
+        return;
+    }
+    const format_info &info = *m_formats[hdr.id];
+
+    //同一秒内复用已格式化的日期时间
+    time_t sec = hdr.ns / 1000000000ULL;
+    if (sec != m_stamp_sec) {
+        struct tm my_tm;
+        localtime_r(&sec, &my_tm);
+        snprintf(m_stamp, sizeof(m_stamp), "%d-%02d-%02d %02d:%02d:%02d", my_tm.tm_year + 1900, my_tm.tm_mon + 1,
+                 my_tm.tm_mday, my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec);
+        m_stamp_sec = sec;
+    }
+
+    const char *s;
+    switch (info.level) {
+        case LOG_LEVEL_DEBUG:
+            s = "[debug]:";
+            break;
+        case LOG_LEVEL_WARN:
+            s = "[warn]:";
+            break;
+        case LOG_LEVEL_ERROR:
+            s = "[erro]:";
+            break;
+        default:
+            s = "[info]:";
+            break;
+    }
+
+    //写入的具体时间内容格式
+    char tmp[512];
+    int  n = snprintf(tmp, sizeof(tmp), "%s.%06ld %s ", m_stamp, (long)(hdr.ns % 1000000000ULL / 1000), s);
+    out.append(tmp, n);
+
+    const char *p   = record + sizeof(hdr);
+    const char *end = record + hdr.size;
+    size_t      arg = 0;
+    for (size_t i = 0; i < info.pieces.size(); ++i) {
+        const format_piece &piece = info.pieces[i];
+        out += piece.text;
+        if (piece.spec.empty()) {
+            continue;
+        }
+
+        // 取出下一个参数，参数个数或类型与格式串不符时输出"?"
+        char     code = arg < info.arg_codes.size() ? info.arg_codes[arg++] : 0;
+        uint64_t bits = 0;
+        uint32_t len  = 0;
+        if (code == 's') {
+            if (end - p < 4) {
+                code = 0;
+            } else {
+                memcpy(&len, p, 4);
+                p += 4;
+                if ((size_t)(end - p) < len) {
+                    len = end - p;
+                }
+            }
+        } else if (code != 0) {
+            if (end - p < 8) {
+                code = 0;
+            } else {
+                memcpy(&bits, p, 8);
+                p += 8;
+            }
+        }
+
+        const char *spec     = piece.spec.c_str();
+        int         m        = -1;
+        bool        appended = false;  // 已经直接写入out
+        double      real;
+        memcpy(&real, &bits, 8);
+        switch (piece.conv) {
+            case 'd':
+            case 'i':
+                if (code == 'i' || code == 'u') {
+                    m = snprintf(tmp, sizeof(tmp), spec, (long long)bits);
+                } else if (code == 'f') {
+                    m = snprintf(tmp, sizeof(tmp), spec, (long long)real);
+                }
+                break;
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+                if (code == 'i' || code == 'u' || code == 'p') {
+                    m = snprintf(tmp, sizeof(tmp), spec, (unsigned long long)bits);
+                }
+                break;
+            case 'c':
+                if (code == 'i' || code == 'u') {
+                    m = snprintf(tmp, sizeof(tmp), spec, (int)bits);
+                }
+                break;
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                if (code == 'f') {
+                    m = snprintf(tmp, sizeof(tmp), spec, real);
+                } else if (code == 'i') {
+                    m = snprintf(tmp, sizeof(tmp), spec, (double)(long long)bits);
+                } else if (code == 'u') {
+                    m = snprintf(tmp, sizeof(tmp), spec, (double)bits);
+                }
+                break;
+            case 'p':
+                if (code == 'p' || code == 'u' || code == 'i') {
+                    m = snprintf(tmp, sizeof(tmp), spec, (void *)(uintptr_t)bits);
+                }
+                break;
+            case 's':
+                if (code == 's') {
+                    if (piece.spec.size() == 2) {
+                        // 没有宽度与精度的%s直接追加，不截断也不拷贝
+                        out.append(p, len);
+                        m = len;
+                    } else {
+                        // 按参数计算输出长度，直接格式化到out的末尾
+                        std::string str(p, len);
+                        int         need = snprintf(nullptr, 0, spec, str.c_str());
+                        if (need >= 0) {
+                            size_t at = out.size();
+                            out.resize(at + need + 1);
+                            snprintf(&out[at], need + 1, spec, str.c_str());
+                            out.resize(at + need);
+                        }
+                        m = need;
+                    }
+                    p += len;
+                    appended = true;
+                }
+                break;
+            default:
+                break;
+        }
+        if (appended && m >= 0) {
+            continue;
+        }
+        if (m < 0) {
+            out += '?';
+        } else {
+            out.append(tmp, (size_t)m < sizeof(tmp) ? m : sizeof(tmp) - 1);
+        }
+    }
+    out += '\n';
+}
+
+void Log::flush(void) {
+    //把所有线程缓冲区中尚未写出的日志立即写入文件
+    m_mutex.lock();
+    if (m_is_async) {
+        drain();
+    }
+    m_mutex.unlock();
+}
@@ -1,63 +1,309 @@
-#ifndef LOG_H
-#define LOG_H
-
-#include <pthread.h>
-#include <stdarg.h>
-#include <stdio.h>
-#include <string.h>
-#include <sys/time.h>
-#include <time.h>
-
-#include <string>
-
-#include "blockqueue.h"
-
-class Log {
-public:
-    //C++11以后,使用局部变量懒汉不用加锁
-    static Log *get_instance() {
-        static Log instance;
-        return &instance;
-    }
-
-    static void *flush_log_thread(void *args) {
-        Log::get_instance()->async_write_log();
-        return nullptr;
-    }
-
-    //可选择的参数有日志文件、日志缓冲区大小、最大行数以及最长日志条队列
-    bool init(const char *file_name, int log_buf_size = 8192, int split_lines = 5000000, int max_queue_size = 0);
-
-    void write_log(int level, const char *format, ...);
-
-    void flush(void);
-
-private:
-    Log();
-    virtual ~Log();
-    void async_write_log();
-
-private:
-    char dir_name[128];  //路径名
-    char log_name[128];  //log文件名
-
-    FILE *m_fp;  //打开log的文件指针
-
-    bool      m_is_async;      //是否同步标志位
-    int       m_split_lines;   //日志最大行数
-    char     *m_buf;           //日志缓冲区
-    int       m_log_buf_size;  //日志缓冲区大小
-    long long m_count;         //日志行数记录
-    int       m_today;         //因为按天分类,记录当前时间是那一天
-
-    locker m_mutex;  //互斥锁
-
-    blockqueue<std::string> *m_log_queue;  //阻塞队列
-};
-
-#define LOG_DEBUG(format, ...) Log::get_instance()->write_log(0, format, ##__VA_ARGS__)
-#define LOG_INFO(format, ...) Log::get_instance()->write_log(1, format, ##__VA_ARGS__)
-#define LOG_WARN(format, ...) Log::get_instance()->write_log(2, format, ##__VA_ARGS__)
-#define LOG_ERROR(format, ...) Log::get_instance()->write_log(3, format, ##__VA_ARGS__)
-
-#endif
+#ifndef LOG_H
+#define LOG_H
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#include <atomic>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "locker.h"
+#include "sem.h"
+
+// 日志级别
+const int LOG_LEVEL_DEBUG = 0;
+const int LOG_LEVEL_INFO  = 1;
+const int LOG_LEVEL_WARN  = 2;
+const int LOG_LEVEL_ERROR = 3;
+
+// 编译期的日志级别阈值，低于该级别的日志调用在编译时被整体去掉，如 -DLOG_COMPILE_LEVEL=2
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 0
+#endif
+
+/*
+    延迟格式化:
+        调用线程只记录格式串的编号、时间戳和参数的原始字节，
+        格式化全部由后台线程完成。每个调用点的格式串在第一次执行时注册一次。
+    参数编码:
+        有符号整数'i'、无符号整数'u'按8字节保存，浮点数'f'按double保存，
+        字符串's'保存4字节长度加内容，其他指针'p'按地址保存
+*/
+namespace log_detail {
+
+template <typename T>
+struct arg_code {
+    static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value || std::is_pointer<T>::value,
+                  "log arguments must be numbers, pointers or C strings");
+    static constexpr char value = std::is_floating_point<T>::value ? 'f'
+                                  : std::is_pointer<T>::value       ? 'p'
+                                  : std::is_signed<T>::value        ? 'i'
+                                                                    : 'u';
+};
+
+template <>
+struct arg_code<char *> {
+    static constexpr char value = 's';
+};
+
+template <>
+struct arg_code<const char *> {
+    static constexpr char value = 's';
+};
+
+template <typename... Args>
+struct arg_codes {
+    static constexpr char value[] = {arg_code<Args>::value..., '\0'};
+};
+
+// 只用于在 decltype 中推导参数类型，参数按值传递使数组退化为指针
+template <typename... Args>
+arg_codes<Args...> signature(Args...);
+
+// 只用于让编译器检查格式串与参数是否匹配，永远不会被调用
+inline void __attribute__((format(printf, 1, 2))) check_format(const char *, ...) {}
+
+// 每条日志记录的头部
+struct record_header {
+    uint32_t size;  // 含头部在内的记录总长度
+    uint32_t id;    // 格式串编号
+    uint64_t ns;    // CLOCK_REALTIME 时间戳，纳秒
+};
+
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, char *>::type encode(char *p,
+                                                                                                        char *end,
+                                                                                                        T     v) {
+    if (end - p < 8) {
+        return p;
+    }
+    if (std::is_signed<T>::value) {
+        int64_t x = (int64_t)v;
+        memcpy(p, &x, 8);
+    } else {
+        uint64_t x = (uint64_t)v;
+        memcpy(p, &x, 8);
+    }
+    return p + 8;
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_floating_point<T>::value, char *>::type encode(char *p, char *end, T v) {
+    if (end - p < 8) {
+        return p;
+    }
+    double x = v;
+    memcpy(p, &x, 8);
+    return p + 8;
+}
+
+inline char *encode(char *p, char *end, const char *s) {
+    if (end - p < 4) {
+        return p;
+    }
+    if (!s) {
+        s = "(null)";
+    }
+    // 缓冲区不够时截断字符串
+    size_t   avail = end - p - 4;
+    size_t   len   = strnlen(s, avail);
+    uint32_t n     = len;
+    memcpy(p, &n, 4);
+    memcpy(p + 4, s, len);
+    return p + 4 + len;
+}
+
+inline char *encode(char *p, char *end, char *s) { return encode(p, end, (const char *)s); }
+
+template <typename T>
+inline char *encode(char *p, char *end, T *v) {
+    if (end - p < 8) {
+        return p;
+    }
+    uint64_t x = (uintptr_t)v;
+    memcpy(p, &x, 8);
+    return p + 8;
+}
+
+}  // namespace log_detail
+
+class Log {
+public:
+    //C++11以后,使用局部变量懒汉不用加锁
+    static Log *get_instance() {
+        static Log instance;
+        return &instance;
+    }
+
+    static void *flush_log_thread(void *args) {
+        Log::get_instance()->async_write_log();
+        return nullptr;
+    }
+
+    /*
+        可选择的参数有日志文件、单条日志的最大长度、最大行数、每个线程的日志缓冲区大小以及后台线程的刷新间隔；
+        thread_buf_size 大于0时为异步模式：每个线程把日志记录追加到自己的缓冲区，由后台线程格式化后批量写入文件
+    */
+    bool init(const char *file_name, int log_buf_size = 8192, int split_lines = 5000000, int thread_buf_size = 0,
+              int flush_interval_ms = 100);
+
+    // 注册一个调用点的格式串，返回其编号；每个调用点只在第一次执行时调用一次
+    int register_format(int level, const char *format, const char *arg_codes);
+
+    // 记录一条日志，只保存参数的原始字节
+    template <typename... Args>
+    void write_record(int id, Args... args);
+
+    void flush(void);
+
+    unsigned long dropped();  // 因线程缓冲区已满而丢弃的日志条数
+
+    /*
+        注册一个由后台线程在每次写出日志后调用的任务，用于把访问日志等其他文件的写入也移出事件循环；
+        同步模式下没有后台线程，返回false。remove_task 返回时任务已不在执行
+    */
+    bool add_task(void (*fn)(void *), void *arg);
+    void remove_task(void *arg);
+    void wakeup();  // 立即唤醒后台线程
+
+    // 运行期的日志级别阈值
+    static int  level() { return m_level.load(std::memory_order_relaxed); }
+    static void set_level(int level) { m_level.store(level, std::memory_order_relaxed); }
+
+private:
+    /*
+        每个线程私有的环形缓冲区，只有所属线程写入、后台线程读出，
+        写日志的快路径上不需要加锁
+    */
+    struct thread_buffer {
+        char  *data;
+        size_t capacity;     // 2的幂
+        size_t cached_tail;  // 所属线程上次读到的写出位置，空间足够时不必读取tail
+
+        // 写入位置与写出位置分别由两个线程修改，放在不同的缓存行上避免伪共享
+        alignas(64) std::atomic<size_t> head;     // 所属线程的写入位置
+        std::atomic<unsigned long>      dropped;  // 缓冲区已满时丢弃的条数
+        alignas(64) std::atomic<size_t> tail;     // 后台线程的写出位置
+    };
+
+    // 格式串预先拆分成若干片段，每个片段是一段原样输出的文字加上最多一个转换说明
+    struct format_piece {
+        std::string text;  // 原样输出的文字
+        std::string spec;  // 规整后的转换说明，如 "%5lld"，为空表示没有
+        char        conv;  // 转换字符
+    };
+
+    struct format_info {
+        int                       level;
+        std::string               arg_codes;
+        std::vector<format_piece> pieces;
+    };
+
+    struct log_task {
+        void (*fn)(void *);
+        void *arg;
+    };
+
+    static const int MAX_LOG_THREADS = 256;
+    static const int MAX_FORMATS     = 4096;
+
+    Log();
+    virtual ~Log();
+    void async_write_log();
+
+    thread_buffer *local_buffer();   // 获取当前线程的缓冲区，首次调用时创建
+    char          *local_scratch();  // 当前线程编码记录用的临时缓冲区
+    void           commit(const char *record, size_t len);               // 把编码好的记录交给后台线程或直接写出
+    void           drain();                                              // 格式化所有线程缓冲区中的记录并写入文件
+    void           format_record(const char *record, std::string &out);  // 把一条记录格式化成一行文字
+    void           write_file(struct iovec *iov, int cnt);               // 写入文件并按天、按行数切分
+    void           open_file(const struct tm &my_tm, long long index);
+
+private:
+    char dir_name[128];  //路径名
+    char log_name[128];  //log文件名
+
+    int m_fd;  //打开log的文件描述符
+
+    bool      m_is_async;           //是否同步标志位
+    int       m_split_lines;        //日志最大行数
+    int       m_log_buf_size;       //单条日志的最大长度
+    size_t    m_thread_buf_size;    //每个线程缓冲区的大小
+    int       m_flush_interval_ms;  //后台线程最长的刷新间隔
+    long long m_count;              //日志行数记录
+    int       m_today;              //因为按天分类,记录当前时间是那一天
+    long long m_file_index;         //当天按行数切分出的文件序号
+
+    locker m_mutex;  //互斥锁，保护文件、格式串与线程缓冲区的注册，不在写日志的快路径上
+
+    thread_buffer             *m_buffers[MAX_LOG_THREADS];  //所有线程的缓冲区
+    std::atomic<int>           m_buffer_count;
+    std::atomic<unsigned long> m_unregistered_dropped;  //线程数超过上限时丢弃的条数
+    unsigned long              m_reported_dropped;      //已经写入日志文件的丢弃条数
+
+    format_info     *m_formats[MAX_FORMATS];  //已注册的格式串，下标即编号
+    std::atomic<int> m_format_count;
+
+    std::string m_out;        //格式化输出的缓冲区，需持有m_mutex
+    time_t      m_stamp_sec;  //m_stamp 对应的秒
+    char        m_stamp[64];  //缓存的日期时间文字
+
+    std::vector<log_task> m_tasks;       //后台线程在写出日志后执行的任务
+    locker                m_task_mutex;  //保护m_tasks，后台线程执行任务期间一直持有
+
+    sem               m_wakeup;          //缓冲区超过一半时唤醒后台线程
+    std::atomic<bool> m_wakeup_pending;  //避免重复唤醒
+
+    static std::atomic<int> m_level;  //运行期的日志级别阈值
+};
+
+template <typename... Args>
+void Log::write_record(int id, Args... args) {
+    char *buf = local_scratch();
+    char *end = buf + m_log_buf_size;
+    char *p   = buf + sizeof(log_detail::record_header);
+
+    int expand[] = {0, (p = log_detail::encode(p, end, args), 0)...};
+    (void)expand;
+    (void)end;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    log_detail::record_header hdr;
+    hdr.size = p - buf;
+    hdr.id   = id;
+    hdr.ns   = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    memcpy(buf, &hdr, sizeof(hdr));
+    commit(buf, hdr.size);
+}
+
+/*
+    level 低于编译期阈值时整条语句在编译时被去掉，低于运行期阈值时只有一次比较；
+    if (0) 分支只用于检查格式串，不产生任何代码
+*/
+#define LOG_BASE(log_level, format, ...)                                                                              \
+    do {                                                                                                              \
+        if (log_level >= LOG_COMPILE_LEVEL && log_level >= Log::level()) {                                            \
+            static const int log_format_id = Log::get_instance()->register_format(                                    \
+                log_level, format, decltype(log_detail::signature(__VA_ARGS__))::value);                              \
+            Log::get_instance()->write_record(log_format_id, ##__VA_ARGS__);                                          \
+        }                                                                                                             \
+        if (0) {                                                                                                      \
+            log_detail::check_format(format, ##__VA_ARGS__);                                                          \
+        }                                                                                                             \
+    } while (0)
+
+#define LOG_DEBUG(format, ...) LOG_BASE(LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...) LOG_BASE(LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...) LOG_BASE(LOG_LEVEL_WARN, format, ##__VA_ARGS__)
+#define LOG_ERROR(format, ...) LOG_BASE(LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+
+#endif
@@ -0,0 +1,72 @@
+#include "loopcmd.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <exception>
+
+loop_cmd_stats loop_channel::stats;
+
+loop_channel::loop_channel() : m_head(&m_stub), m_tail(&m_stub), m_signaled(false) {
+    m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_eventfd == -1) {
+        throw std::exception();
+    }
+}
+
+loop_channel::~loop_channel() { close(m_eventfd); }
+
+void loop_channel::push(loop_cmd* cmd) {
+    cmd->next.store(nullptr, std::memory_order_relaxed);
+    loop_cmd* prev = m_head.exchange(cmd, std::memory_order_acq_rel);
+    // 交换与链接之间消费者看到的是断开的链表，pop会暂时返回空
+    prev->next.store(cmd, std::memory_order_release);
+}
+
+void loop_channel::post(loop_cmd* cmd) {
+    push(cmd);
+    ++stats.posted;
+    // 链接完成之后才检查标志，事件循环清除标志之后入队的命令一定会再唤醒一次
+    if (!m_signaled.exchange(true)) {
+        uint64_t one = 1;
+        ssize_t  ret = write(m_eventfd, &one, sizeof(one));
+        (void)ret;
+        ++stats.wakeups;
+    }
+}
+
+void loop_channel::begin_drain() {
+    uint64_t count;
+    ssize_t  ret = read(m_eventfd, &count, sizeof(count));
+    (void)ret;
+    m_signaled.store(false);
+}
+
+loop_cmd* loop_channel::pop() {
+    loop_cmd* tail = m_tail;
+    loop_cmd* next = tail->next.load(std::memory_order_acquire);
+    if (tail == &m_stub) {
+        if (!next) {
+            return nullptr;
+        }
+        m_tail = next;
+        tail   = next;
+        next   = next->next.load(std::memory_order_acquire);
+    }
+    if (next) {
+        m_tail = next;
+        return tail;
+    }
+    if (tail != m_head.load(std::memory_order_acquire)) {
+        // 有生产者正在入队，它链接完成后会看到标志已清除并再唤醒一次
+        return nullptr;
+    }
+    // tail是最后一个节点，放回哨兵后才能把它取走
+    push(&m_stub);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next) {
+        m_tail = next;
+        return tail;
+    }
+    return nullptr;
+}
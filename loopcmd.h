@@ -0,0 +1,65 @@
+#ifndef LOOPCMD_H
+#define LOOPCMD_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+/*
+    事件循环的命令通道:
+        工作线程与磁盘线程处理完一个连接后不再自己调用 epoll_ctl、close_conn，而是投递一条命令，
+        由事件循环批量执行，定时器链表与连接表只在事件循环中修改，不需要加锁。
+        队列是侵入式的无锁多生产者单消费者链表(Vyukov)：投递只有一次原子交换，命令节点就在connection里，不分配内存；
+        ONESHOT保证一个连接同一时刻最多有一条命令在途。
+        队列由空变为非空时才写一次eventfd唤醒epoll_wait，之后的投递只入队，事件循环醒来后一次取完。
+*/
+
+class connection;
+
+enum LOOP_CMD {
+    LOOP_CMD_READ = 0,  // 请求还不完整，重新注册EPOLLIN
+    LOOP_CMD_WRITE,     // 响应已就绪或冷数据已加载，立即发送，发不完再注册EPOLLOUT
+    LOOP_CMD_CLOSE,     // 关闭连接并删除定时器
+    LOOP_CMD_PROXY      // 转发给上游，上游连接池只在事件循环中访问
+};
+
+struct loop_cmd {
+    std::atomic<loop_cmd*> next;
+    connection*            conn;
+    uint32_t               conn_id;  // 投递时的连接编号，执行时不一致说明连接已被关闭、fd已被复用
+    int                    type;
+
+    loop_cmd() : next(nullptr), conn(nullptr), conn_id(0), type(LOOP_CMD_READ) {}
+};
+
+// 命令计数器，在定时器tick中输出到日志
+struct loop_cmd_stats {
+    std::atomic<unsigned long> posted;   // 投递的命令数
+    std::atomic<unsigned long> wakeups;  // 写eventfd的次数
+    std::atomic<unsigned long> stale;    // 连接已关闭而丢弃的命令数
+};
+
+class loop_channel {
+public:
+    loop_channel();
+    ~loop_channel();
+
+    int fd() const { return m_eventfd; }  // 注册到epoll中，可读表示有命令
+
+    void      post(loop_cmd* cmd);  // 任意线程调用
+    void      begin_drain();        // 事件循环醒来后先调用，读掉eventfd并允许下一次唤醒
+    loop_cmd* pop();                // 只在事件循环中调用，没有命令时返回nullptr
+
+    static loop_cmd_stats stats;
+
+private:
+    void push(loop_cmd* cmd);
+
+    int                    m_eventfd;
+    std::atomic<loop_cmd*> m_head;      // 最后入队的节点，生产者在这一端交换
+    loop_cmd*              m_tail;      // 下一个出队的节点，只有事件循环访问
+    loop_cmd               m_stub;      // 哨兵节点，队列为空时head与tail都指向它
+    std::atomic<bool>      m_signaled;  // eventfd已写、事件循环还没开始取
+};
+
+#endif
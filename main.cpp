@@ -1,28 +1,366 @@
+#include <getopt.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "accesslog.h"
+#include "bundle.h"
+#include "capture.h"
 #include "clientlist.h"
+#include "config.h"
 #include "connection.h"
+#include "diskio.h"
+#include "lfpool.h"
+#include "listener.h"
 #include "log.h"
+#include "perfctr.h"
+#include "proxy.h"
+#include "stats.h"
 #include "timer.h"
+#include "tls.h"
+#include "trace.h"
+#include "warmup.h"
 
 // 开启epoll事件细分
 #ifndef _GNU_SOURCE
 #define _GNU_SOURCE
 #endif
 
-const int MAX_FD           = 65535;  // 最大的文件描述符个数
-const int MAX_EVENT_NUMBER = 10000;  // epoll实例最大监听数量
-
 int TIMESLOT  = 5;    // 定时触发时间，单位秒
 int pipefd[2] = {0};  // 传输信号的管道，[0]读，[1]写
 
 int main(int argc, char* argv[]) {
+    // 可调参数，写0的几项在解析完所有参数后按机器资源推算，见 config.h
+    int                      max_fd          = 0;          // 最大的文件描述符个数，即连接表的大小
+    int                      max_events      = 0;          // 每次epoll_wait最多返回的事件数
+    int                      worker_threads  = 0;          // 工作线程数
+    std::string              concurrency     = "hsha";     // -M 并发模式，hsha 或 lf
+    int                      max_requests    = 0;          // 工作队列的容量
+    int                      listen_backlog  = 0;          // 监听队列的长度
+    std::vector<std::string> listen_specs;                 // 监听地址，命令行上的位置参数追加在后面
+    std::string              bundle_path;                  // -b 静态资源包路径
+    bool                     bundle_populate = false;      // -P 启动时预先建立资源包的页表
+    bool                     bundle_hugepage = false;      // -H 建议内核用透明大页映射资源包
+    int                      disk_threads    = 4;          // -D 磁盘I/O线程数，0表示冷数据也在事件循环中直接发送
+    int                      disk_queue      = 1024;       // 磁盘I/O线程池的队列容量
+    std::string              access_path;                  // -a 访问日志路径
+    std::string              capture_path;                 // -c 流量抓取文件路径
+    std::string              trace_path;                   // -T 请求时间线的输出文件
+    int                      trace_every     = 1000;       // -t 时间线的采样间隔
+    bool                     perf_enable     = false;      // -C 按阶段统计硬件性能计数器
+    std::vector<std::string> proxy_routes;                 // -R 反向代理规则
+    std::string              tls_cert;                     // -K TLS证书链文件
+    std::string              tls_key;                      // -K 私钥文件，省略时与证书在同一个文件中
+    int                      loop_spin       = 0;          // -Y 事件循环空转多少微秒没有事件后才阻塞
+    int                      worker_spin     = 0;          // -W 工作线程空转多少微秒取不到任务后才睡眠
+    int                      client_conns    = 0;          // -I 每个客户端IP的连接数上限
+    int                      client_rate     = 0;          // -I 每个客户端IP每秒的请求数
+    int                      client_burst    = 0;          // -I 令牌桶容量，0表示与速率相同
+    int                      log_level       = Log::level();  // -l 运行期日志级别
+    std::string              log_file        = "ServerLog";
+    int                      log_line_size   = 2048;       // 单条日志的最大长度
+    int                      log_split_lines = 10000;      // 每个日志文件的最大行数
+    int                      log_thread_buf  = 1 << 20;    // 每个线程的日志缓冲区
+    bool                     warmup          = false;      // 启动时在后台预读文件
+    std::string              hot_list;                     // 热点列表文件，为空时不记录
+    int                      hot_list_size   = 1000;       // 热点列表最多记录的文件数
+    size_t                   warmup_bytes    = 0;          // 预热最多读入的字节数，0表示可用内存的四分之一
+
+    config_table config;
+    config.add("max_fd", &max_fd, "连接表的大小，0表示按RLIMIT_NOFILE与可用内存推算");
+    config.add("max_events", &max_events, "每次epoll_wait最多返回的事件数，0表示min(max_fd, 10000)");
+    config.add("worker_threads", &worker_threads, "工作线程数，0表示CPU数的2倍且不少于4");
+    config.add("concurrency", &concurrency, "-M 并发模式，hsha为半同步/半反应堆，lf为领导者/跟随者");
+    config.add("max_requests", &max_requests, "工作队列的容量，0表示与max_fd相同");
+    config.add("worker_spin", &worker_spin, "-W 工作线程取不到任务时自旋的微秒数");
+    config.add("loop_spin", &loop_spin, "-Y 事件循环没有事件时空转的微秒数");
+    config.add("busy_poll", &connection::busy_poll, "-N 内核忙轮询的微秒数");
+    config.add("timeslot", &TIMESLOT, "定时器tick的间隔，秒，连接空闲3个间隔后关闭");
+    config.add("listen", &listen_specs, "监听地址，可以有多个");
+    config.add("listen_backlog", &listen_backlog, "监听队列的长度，0表示net.core.somaxconn");
+    config.add("doc_root", &doc_root, "网站的根目录");
+    config.add("read_buffer", &connection::read_buf_size, "每个连接的读缓冲区，字节");
+    config.add("write_buffer", &connection::write_buf_size, "每个连接的响应头缓冲区，字节");
+    config.add("write_budget", &connection::write_budget, "-w 每次EPOLLOUT唤醒的发送额度，0表示不限制");
+    config.add("notsent_lowat", &connection::notsent_lowat, "-L TCP_NOTSENT_LOWAT，0表示不设置");
+    config.add("send_buffer", &connection::send_buffer, "-B SO_SNDBUF，0表示由内核自动调节");
+    config.add("disk_threads", &disk_threads, "-D 磁盘I/O线程数");
+    config.add("disk_queue", &disk_queue, "磁盘I/O线程池的队列容量");
+    config.add("file_share_ms", &file_cache::share_ms, "文件映射完成后可共享的毫秒数");
+    config.add("sequential_threshold", &file_cache::sequential_threshold,
+               "不小于该大小的文件映射后按顺序读建议内核，更小的整体预读");
+    config.add("warmup", &warmup, "启动时在后台按热点列表或遍历doc_root预读文件");
+    config.add("hot_list", &hot_list, "热点列表文件，定期写出、预热时读入");
+    config.add("hot_list_size", &hot_list_size, "热点列表最多记录的文件数");
+    config.add("warmup_max_bytes", &warmup_bytes, "预热最多读入的字节数，0表示可用内存的四分之一");
+    config.add("bundle", &bundle_path, "-b 静态资源包");
+    config.add("bundle_populate", &bundle_populate, "-P 预先建立资源包的页表");
+    config.add("bundle_hugepage", &bundle_hugepage, "-H 用透明大页映射资源包");
+    config.add("access_log", &access_path, "-a 访问日志");
+    config.add("capture", &capture_path, "-c 流量抓取文件");
+    config.add("trace", &trace_path, "-T 请求时间线文件");
+    config.add("trace_every", &trace_every, "-t 时间线的采样间隔");
+    config.add("perf_counters", &perf_enable, "-C 按阶段统计性能计数器");
+    config.add("stats_page", &connection::stats_page, "-S 开启 /__stats");
+    config.add("log_file", &log_file, "日志文件名");
+    config.add("log_level", &log_level, "-l 日志级别，0~3 分别为 debug/info/warn/error");
+    config.add("log_line_size", &log_line_size, "单条日志的最大长度");
+    config.add("log_split_lines", &log_split_lines, "每个日志文件的最大行数");
+    config.add("log_thread_buffer", &log_thread_buf, "每个线程的日志缓冲区，字节");
+    config.add("proxy_route", &proxy_routes, "-R 反向代理规则\"前缀=上游地址\"，可以有多条");
+    config.add("proxy_connect_timeout", &reverse_proxy::connect_timeout, "-U 连接上游的超时，秒");
+    config.add("proxy_read_timeout", &reverse_proxy::read_timeout, "-U 读上游的超时，秒");
+    config.add("proxy_idle_timeout", &reverse_proxy::idle_timeout, "上游空闲连接的保留时间，秒");
+    config.add("proxy_max_idle", &reverse_proxy::max_idle, "每个上游最多保留的空闲连接数");
+    config.add("tls_cert", &tls_cert, "-K TLS证书链文件");
+    config.add("tls_key", &tls_key, "-K 私钥文件，省略时与证书在同一个文件中");
+    config.add("client_max_conns", &client_conns, "-I 每个客户端IP的连接数上限，0表示不限制");
+    config.add("client_rate", &client_rate, "-I 每个客户端IP每秒的请求数，0表示不限制");
+    config.add("client_burst", &client_burst, "-I 令牌桶容量，0表示与速率相同");
+
+    // 先取出配置文件与 --键=值，它们先于短选项生效，其余参数留给getopt
+    std::vector<char*>       args(1, argv[0]);
+    std::vector<const char*> overrides;
+    const char*              config_path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            config_path = argv[++i];
+        } else if (strncmp(argv[i], "--", 2) == 0 && argv[i][2] != '\0') {
+            overrides.push_back(argv[i] + 2);
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    if (config_path && !config.load_file(config_path)) {
+        exit(-1);
+    }
+    for (const char* arg : overrides) {
+        if (strcmp(arg, "help") == 0) {
+            config.usage();
+            exit(0);
+        }
+        if (!config.set_arg(arg)) {
+            printf("无效的配置 --%s\n", arg);
+            exit(-1);
+        }
+    }
+    argc = args.size();
+    args.push_back(nullptr);
+    argv = args.data();
+
+    // 解析可选参数
+    int opt;
+    while ((opt = getopt(argc, argv, "b:PHD:w:L:B:l:a:c:ST:t:CR:U:K:Y:W:N:I:M:")) != -1) {
+        switch (opt) {
+            case 'b':
+                bundle_path = optarg;
+                break;
+            case 'P':
+                bundle_populate = true;
+                break;
+            case 'H':
+                bundle_hugepage = true;
+                break;
+            case 'D':
+                disk_threads = atoi(optarg);
+                break;
+            case 'w':
+                // 每个连接每次唤醒的发送额度
+                connection::write_budget = strtoul(optarg, nullptr, 10);
+                break;
+            case 'L':
+                // 每个连接在内核中积压的未发送数据的上限，0表示不限制
+                connection::notsent_lowat = atoi(optarg);
+                break;
+            case 'B':
+                // 固定每个连接的发送缓冲区大小，0表示由内核自动调节
+                connection::send_buffer = atoi(optarg);
+                break;
+            case 'l':
+                // 运行期日志级别，0~3 分别为 debug/info/warn/error
+                log_level = atoi(optarg);
+                break;
+            case 'a':
+                access_path = optarg;
+                break;
+            case 'c':
+                capture_path = optarg;
+                break;
+            case 'S':
+                // 通过 /__stats 提供运行时统计
+                connection::stats_page = true;
+                break;
+            case 'T':
+                trace_path = optarg;
+                break;
+            case 't':
+                trace_every = atoi(optarg);
+                break;
+            case 'C':
+                perf_enable = true;
+                break;
+            case 'R':
+                // 反向代理规则"前缀=上游地址"，可以给多条
+                proxy_routes.push_back(optarg);
+                break;
+            case 'U':
+                // 上游的连接超时与读超时，"秒:秒"
+                if (sscanf(optarg, "%d:%d", &reverse_proxy::connect_timeout, &reverse_proxy::read_timeout) != 2) {
+                    printf("无效的上游超时 %s\n", optarg);
+                    exit(-1);
+                }
+                break;
+            case 'K': {
+                // "证书:私钥"，tls:前缀的监听地址使用
+                char* colon = strchr(optarg, ':');
+                if (colon) {
+                    *colon  = '\0';
+                    tls_key = colon + 1;
+                }
+                tls_cert = optarg;
+                break;
+            }
+            case 'Y':
+                loop_spin = atoi(optarg);
+                break;
+            case 'W':
+                worker_spin = atoi(optarg);
+                break;
+            case 'N':
+                // 内核在epoll_wait与读套接字时忙轮询网卡队列的时长，微秒
+                connection::busy_poll = atoi(optarg);
+                break;
+            case 'I':
+                // 每个客户端IP的"连接数:每秒请求数[:突发]"，0表示不限制该项
+                if (sscanf(optarg, "%d:%d:%d", &client_conns, &client_rate, &client_burst) < 2) {
+                    printf("无效的限流参数 %s\n", optarg);
+                    exit(-1);
+                }
+                break;
+            case 'M':
+                concurrency = optarg;
+                break;
+            default:
+                listen_specs.clear();
+                optind = argc;
+                break;
+        }
+    }
+    for (int i = optind; i < argc; ++i) {
+        listen_specs.push_back(argv[i]);
+    }
+
     // 判断传入参数
-    if (argc <= 1) {
-        printf("请按照如下格式运行：%s port\n", basename(argv[0]));
+    if (listen_specs.empty()) {
+        printf("请按照如下格式运行：%s [-f 配置文件] [--键=值...] [-b 资源包 [-P] [-H]] [-D 磁盘线程数] [-w 发送额度] [-L 未发送低水位] [-B 发送缓冲区] [-l 日志级别] [-a 访问日志] [-c 抓取文件] [-S] [-T 时间线文件 [-t 采样间隔]] [-C] [-R 前缀=上游地址 [-U 连接超时:读超时]] [-K 证书[:私钥]] [-Y 循环自旋微秒] [-W 工作线程自旋微秒] [-N 内核忙轮询微秒] [-I 每IP连接数:每秒请求数[:突发]] [-M hsha|lf] port|监听地址...\n", basename(argv[0]));
+        printf("--help 列出所有配置项\n");
         exit(-1);
     }
+    if (tls_key.empty()) {
+        tls_key = tls_cert;
+    }
+    if (concurrency != "hsha" && concurrency != "lf") {
+        printf("无效的并发模式 %s，只能是 hsha 或 lf\n", concurrency.c_str());
+        exit(-1);
+    }
+    // 反向代理的上游事件只能在事件循环中处理，它与客户端socket共用同一个epoll对象
+    if (concurrency == "lf" && !proxy_routes.empty()) {
+        printf("反向代理只支持 hsha 模式，改用 hsha\n");
+        concurrency = "hsha";
+    }
 
-    // 初始化日志模块
-    Log::get_instance()->init("ServerLog", 2048, 10000, 8);
+    // 写0的几项按机器资源推算
+    machine_info machine = machine_info::probe();
+    if (max_fd <= 0) {
+        // 连接表与用到的缓冲区最多占可用内存的四分之一
+        size_t per_conn = sizeof(connection) + connection::read_buf_size + connection::write_buf_size;
+        long   by_mem   = machine.mem_avail / 4 / per_conn;
+        max_fd          = (int)std::min(machine.nofile, std::min(by_mem, 1L << 20));
+    }
+    if (max_events <= 0) {
+        max_events = std::min(max_fd, 10000);
+    }
+    if (worker_threads <= 0) {
+        worker_threads = std::max(4, machine.cpus * 2);
+    }
+    if (max_requests <= 0) {
+        // ONESHOT下每个连接最多有一个任务在队列中
+        max_requests = max_fd;
+    }
+    if (listen_backlog <= 0) {
+        listen_backlog = machine.somaxconn;
+    }
+    if (warmup_bytes == 0) {
+        warmup_bytes = machine.mem_avail / 4;
+    }
+
+    // 初始化日志模块，异步模式，每个线程一个日志缓冲区
+    Log::get_instance()->init(log_file.c_str(), log_line_size, log_split_lines, log_thread_buf);
+    Log::set_level(log_level);
+    LOG_INFO("machine: cpus %d, nofile %ld, mem available %lu MB, somaxconn %d", machine.cpus, machine.nofile,
+             (unsigned long)(machine.mem_avail >> 20), machine.somaxconn);
+    config.log();
+
+    // 运行时统计放在 /dev/shm/weakserver.端口 中，由 tools/stats_cli 读取；有多个监听地址时以第一个为准
+    char stats_name[64];
+    snprintf(stats_name, sizeof(stats_name), "/weakserver.%s", listener_key(listen_specs[0].c_str()).c_str());
+    server_stats::init(stats_name);
+    trace_clock::calibrate();
+    if (perf_enable && !perf_counters::init()) {
+        printf("没有可用的性能计数器，检查 kernel.perf_event_paranoid\n");
+    }
+
+    // 加载静态资源包，之后所有请求都从资源包中查找
+    if (!bundle_path.empty()) {
+        connection::bundle = new static_bundle();
+        if (!connection::bundle->open(bundle_path.c_str(), bundle_populate, bundle_hugepage)) {
+            printf("加载资源包 %s 失败\n", bundle_path.c_str());
+            exit(-1);
+        }
+    }
+
+    // 打开二进制访问日志，每个完成的请求记录一条
+    if (!access_path.empty()) {
+        connection::access = new access_log();
+        if (!connection::access->open(access_path.c_str())) {
+            printf("打开访问日志 %s 失败\n", access_path.c_str());
+            exit(-1);
+        }
+    }
+
+    // 抓取收到的原始请求，由 tools/replay 重放
+    if (!capture_path.empty()) {
+        connection::capture = new traffic_capture();
+        if (!connection::capture->open(capture_path.c_str())) {
+            printf("打开抓取文件 %s 失败\n", capture_path.c_str());
+            exit(-1);
+        }
+    }
+
+    // 按采样间隔把请求的完整时间线写成 Chrome trace-event JSON
+    if (!trace_path.empty()) {
+        connection::tracer = new trace_dump();
+        if (!connection::tracer->open(trace_path.c_str(), trace_every)) {
+            printf("打开时间线文件 %s 失败\n", trace_path.c_str());
+            exit(-1);
+        }
+    }
+
+    // 反向代理的上游连接与客户端连接共用描述符空间，按同样的大小建表
+    if (!proxy_routes.empty()) {
+        connection::proxy = new reverse_proxy(max_fd);
+        for (const std::string& route : proxy_routes) {
+            if (!connection::proxy->add_route(route.c_str())) {
+                printf("无效的代理规则 %s\n", route.c_str());
+                exit(-1);
+            }
+        }
+    }
+
+    if (client_conns > 0 || client_rate > 0) {
+        connection::limiter = new client_limiter(client_conns, client_rate, client_burst);
+    }
 
     // 忽略SIGPIPE、SIGTERM信号
     addsig(SIGPIPE, SIG_IGN);
@@ -31,75 +369,152 @@ int main(int argc, char* argv[]) {
     // 捕捉信号,防止进程默认终止
     addsig(SIGALRM, alrm_handler);
 
-    // 服务器本地地址信息
-    sockaddr_in local_address;
-    bzero(&local_address, sizeof(local_address));
-    local_address.sin_family      = AF_INET;
-    local_address.sin_addr.s_addr = INADDR_ANY;
-    int local_port                = atoi(argv[1]);
-    local_address.sin_port        = htons(local_port);
-
-    // 创建监听套接字
-    int listenfd = socket(PF_INET, SOCK_STREAM, 0);
-    assert(listenfd != -1);
-
-    // 设置端口复用, 绑定前设置
-    reuse_addr(listenfd);
-
-    // 绑定
-    int ret = bind(listenfd, (sockaddr*)&local_address, sizeof(local_address));
-    assert(ret != -1);
-
-    // 监听
-    ret = listen(listenfd, 5);
-    assert(ret != -1);
+    // 依次创建所有监听套接字，见 listener.h
+    std::vector<int> listenfds;
+    std::vector<int> tls_listenfds;  // 其中需要先做TLS握手的
+    for (const std::string& listen_spec : listen_specs) {
+        const char* spec = listen_spec.c_str();
+        bool        tls  = strip_tls_prefix(spec);
+        if (tls && !connection::tls) {
+            // 所有TLS监听地址共用一份证书与会话票据密钥
+            connection::tls = new tls_context();
+            if (tls_cert.empty() || !connection::tls->open(tls_cert.c_str(), tls_key.c_str())) {
+                printf("监听 %s 需要用 -K 指定可用的证书与私钥，且编译时加 -DWITH_TLS\n", listen_spec.c_str());
+                exit(-1);
+            }
+        }
+        int fd = open_listener(spec, listen_backlog);
+        if (fd == -1) {
+            printf("监听 %s 失败\n", listen_spec.c_str());
+            exit(-1);
+        }
+        listenfds.push_back(fd);
+        if (tls) {
+            tls_listenfds.push_back(fd);
+        }
+    }
 
     // 创建一个epoll对象实例
     int epollfd = epoll_create(1);
     assert(epollfd != -1);
+    if (connection::busy_poll > 0) {
+        set_epoll_busy_poll(epollfd, connection::busy_poll);
+    }
 
     // 将监听文件描述符信息添加到epoll实例
-    add_fd_to_epoll(epollfd, listenfd, false, false);
+    for (int fd : listenfds) {
+        add_fd_to_epoll(epollfd, fd, false, false);
+    }
 
     // 创建epoll事件数组
-    epoll_event events[MAX_EVENT_NUMBER];
+    epoll_event* events = new epoll_event[max_events];
+
+    // 自旋只在生产者与消费者能同时运行时才有意义，单核上空转只会抢走对方的时间片
+    if ((loop_spin > 0 || worker_spin > 0) && sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+        LOG_WARN("only one cpu online, ignore spin budgets -Y %d -W %d", loop_spin, worker_spin);
+        loop_spin   = 0;
+        worker_spin = 0;
+    }
+
+    // 创建一个数组用于保存所有http客户端信息
+    connection* connections = new connection[max_fd];
 
-    // 创建线程池并初始化
-    threadpool<connection>* thread_pool = nullptr;
+    connection::epollfd = epollfd;
+
+    // 领导者/跟随者模式下客户端socket单独放在一个epoll对象中，由池中的线程轮流等待；
+    // 半同步/半反应堆模式下由事件循环读写，工作线程池处理请求
+    threadpool<connection>* thread_pool    = nullptr;
+    lf_pool*                leader_pool    = nullptr;
+    int                     client_epollfd = -1;
     try {
-        thread_pool = new threadpool<connection>;
+        if (concurrency == "lf") {
+            client_epollfd = epoll_create(1);
+            assert(client_epollfd != -1);
+            if (connection::busy_poll > 0) {
+                set_epoll_busy_poll(client_epollfd, connection::busy_poll);
+            }
+            connection::epollfd         = client_epollfd;
+            connection::leader_follower = true;
+            leader_pool                 = new lf_pool(worker_threads, client_epollfd, connections);
+        } else {
+            thread_pool = new threadpool<connection>(worker_threads, max_requests, worker_spin);
+        }
     } catch (...) {
         exit(-1);
     }
 
-    // 创建一个数组用于保存所有http客户端信息
-    connection* connections = new connection[MAX_FD];
+    // 创建磁盘I/O线程池，冷数据在这里读入页缓存，队列有界以免堆积
+    if (disk_threads > 0) {
+        try {
+            connection::disk_pool = new threadpool<connection, &connection::load_file>(disk_threads, disk_queue);
+        } catch (...) {
+            exit(-1);
+        }
+    }
 
-    connection::epollfd = epollfd;
+    // 工作线程通过eventfd把处理完的连接交还给事件循环
+    try {
+        connection::channel = new loop_channel();
+    } catch (...) {
+        exit(-1);
+    }
+    add_fd_to_epoll(epollfd, connection::channel->fd(), false, false);
 
     // 创建一个定时器链表用于保存所有http客户端连接是否超时的信息
     connection::timer_list = new client_timer_list();
 
     // 创建用于信号传输的管道
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
+    int ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
     assert(ret != -1);
     set_fd_nonblock(pipefd[1]);
     add_fd_to_epoll(epollfd, pipefd[0], false, false);
 
     bool timeout = false;
 
+    // 页缓存预热在后台进行，不推迟accept；资源包用 -P 在启动时建立页表
+    if (warmup && !connection::bundle && !start_warmup(doc_root, hot_list, warmup_bytes)) {
+        LOG_WARN("start warmup thread failed");
+    }
+    int hot_list_ticks = 0;  // 每12次tick写一次热点列表
+    if (!hot_list.empty() && !connection::bundle) {
+        init_hot_list(hot_list, &connection::files, hot_list_size);
+    }
+
+    // 本轮epoll_wait中读完请求的连接，遍历完事件后一次性交给线程池
+    connection** ready = new connection*[max_events];
+
     // 定时,5秒后产生SIGALARM信号
     alarm(TIMESLOT);
 
+    // 低延迟模式下最近一次取到事件的时刻，距今不超过 loop_spin 微秒时用0超时轮询，不让线程睡下去
+    uint64_t spin_ns   = (uint64_t)loop_spin * 1000;
+    uint64_t last_busy = 0;
+
     while (1) {
         // 返回检测到几个事件
-        int num = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);  // -1是阻塞
+        int wait_ms = -1;  // -1是阻塞
+        if (spin_ns > 0 && trace_clock::ns_between(last_busy, trace_clock::now()) < spin_ns) {
+            wait_ms = 0;
+        }
+        int num = epoll_wait(epollfd, events, max_events, wait_ms);
+        if (num == 0) {
+            cpu_relax();
+            continue;
+        }
+        if (spin_ns > 0 && num > 0) {
+            last_busy = trace_clock::now();
+        }
+
+        // 从这里到本轮结束的计数器增量计入事件循环，阻塞在epoll_wait中的部分不计入
+        perf_scope perf(PERF_STAGE_LOOP);
 
         if (num == -1 && errno != EINTR) {
             LOG_ERROR("epoll failed");
             break;
         }
 
+        int ready_num = 0;
+
         // 循环遍历事件数组
         for (int i = 0; i < num; ++i) {
             int sockfd = events[i].data.fd;
@@ -118,20 +533,32 @@ int main(int argc, char* argv[]) {
                     timeout = true;
                     break;
                 }
-            } else if (sockfd == listenfd) {
+            } else if (sockfd == connection::channel->fd()) {
+                // 工作线程与磁盘线程投递的命令
+                connection::run_commands();
+
+            } else if (std::find(listenfds.begin(), listenfds.end(), sockfd) != listenfds.end()) {
                 // 新客户端连接
-                sockaddr_in client_address;
-                socklen_t   client_addr_size = sizeof(client_address);
+                sockaddr_storage client_address;
+                socklen_t        client_addr_size = sizeof(client_address);
                 // 接受新连接
-                int cfd = accept(listenfd, (sockaddr*)&client_address, &client_addr_size);
+                int cfd = accept(sockfd, (sockaddr*)&client_address, &client_addr_size);
                 if (cfd < 0) {
                     LOG_ERROR("accept error, errno is: %d", errno);
                     continue;
                 }
 
-                if (connection::user_count >= MAX_FD) {
-                    // 目前最大连接数满
+                if (cfd >= max_fd || connection::user_count >= max_fd) {
+                    // 目前最大连接数满，或描述符超出了连接表
                     show_busy(cfd);
+                    server_stats::add(STAT_SHED);
+                    continue;
+                }
+
+                // 同一IP的连接数已达上限，直接关闭
+                if (connection::limiter && !connection::limiter->on_accept(client_address)) {
+                    close(cfd);
+                    server_stats::add(STAT_SHED);
                     continue;
                 }
 
@@ -140,20 +567,52 @@ int main(int argc, char* argv[]) {
                 connections[cfd].client_address = client_address;
                 // 创建定时器，绑定定时器与用户连接数据
                 connections[cfd].timer = new client_timer(connections[cfd]);
+                // TLS监听地址上的连接先握手，第一个EPOLLIN是ClientHello
+                connections[cfd].tls_sess = nullptr;
+                if (std::find(tls_listenfds.begin(), tls_listenfds.end(), sockfd) != tls_listenfds.end()) {
+                    connections[cfd].tls_sess = connection::tls->create(cfd);
+                    if (!connections[cfd].tls_sess) {
+                        LOG_ERROR("create tls session failed, which sockfd is %d", cfd);
+                        if (connection::limiter) {
+                            connection::limiter->on_close(client_address);
+                        }
+                        close(cfd);
+                        delete connections[cfd].timer;
+                        connections[cfd].sockfd = -1;
+                        continue;
+                    }
+                }
 
                 // 必须在init_conn之前设置好fd和timer
                 connections[cfd].init_conn();
 
+            } else if (connection::proxy && connection::proxy->owns(sockfd)) {
+                // 反向代理的上游连接
+                connection::proxy->on_event(sockfd, events[i].events);
+
             } else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
                 // 对方异常断开或挂起、错误等事件
                 LOG_INFO("opposite close or hup or wrong, which sockfd is %d", sockfd);
                 connections[sockfd].close_conn();
 
+            } else if (connections[sockfd].handshaking()) {
+                // TLS握手未完成，可读可写都用来推进握手
+                if (connections[sockfd].tls_handshake()) {
+                    connections[sockfd].update_timer();
+                } else {
+                    connections[sockfd].close_conn();
+                }
+
             } else if (events[i].events & EPOLLIN) {
                 // 一次性读出所有数据
                 if (connections[sockfd].read()) {
                     connections[sockfd].update_timer();
-                    thread_pool->append(connections + sockfd);
+                    // 超过该IP的请求速率时不进入工作队列
+                    if (connection::limiter && !connection::limiter->on_request(connections[sockfd].client_address)) {
+                        connections[sockfd].reject_request();
+                    } else {
+                        ready[ready_num++] = connections + sockfd;
+                    }
                 } else {
                     LOG_ERROR("read wrong, which sockfd is %d", sockfd);
                     connections[sockfd].close_conn();
@@ -170,27 +629,114 @@ int main(int argc, char* argv[]) {
                 }
             }
         }
+        // 一次加锁放入所有任务，队列放不下的连接直接关闭，否则它们在ONESHOT下再也不会被处理
+        if (ready_num > 0) {
+            uint64_t now = trace_clock::now();
+            for (int i = 0; i < ready_num; ++i) {
+                ready[i]->trace.points[TRACE_ENQUEUE] = now;
+                ready[i]->in_flight                   = true;
+            }
+            // 先计入队列深度，避免工作线程先减后出现负数
+            server_stats::add(STAT_QUEUE_DEPTH, ready_num);
+            int appended = thread_pool->append_bulk(ready, ready_num);
+            server_stats::add(STAT_QUEUE_DEPTH, appended - ready_num);
+            for (int i = appended; i < ready_num; ++i) {
+                LOG_WARN("work queue is full, close sockfd %d", ready[i]->sockfd);
+                ready[i]->in_flight = false;
+                ready[i]->close_conn();
+                server_stats::add(STAT_SHED);
+            }
+        }
+
         /* 
             最后处理定时事件，因为I/O事件有更高的优先级。
             但这样做将导致定时任务不能精准的按照预定的时间执行。
         */
         if (timeout) {
             LOG_INFO("触发5s定时器, curtime: %ld, 开始检测非活跃连接", time(nullptr));
+            // 先检查上游超时，仍在等上游的客户端会顺延自己的定时器
+            if (connection::proxy) {
+                connection::proxy->tick();
+            }
             // 定时处理任务，实际上就是调用tick()函数
-            connection::timer_list->tick();
+            connection::tick_timers();
+            server_stats::heartbeat(TIMESLOT);
+            if (leader_pool) {
+                LOG_INFO("leader/follower: events %lu, requests %lu", lf_pool::stats.events.load(),
+                         lf_pool::stats.requests.load());
+            }
+            LOG_INFO("disk io: probes %lu, cold %lu, queued %lu, rejected %lu, loaded %lu bytes, inflight %ld",
+                     disk_counters.probes.load(), disk_counters.cold.load(), disk_counters.queued.load(),
+                     disk_counters.rejected.load(), disk_counters.loaded_bytes.load(), disk_counters.inflight.load());
+            if (!connection::bundle) {
+                LOG_INFO("file lookups %lu, loads %lu, waited %lu, shared %lu", file_cache::stats.lookups.load(),
+                         file_cache::stats.loads.load(), file_cache::stats.waited.load(),
+                         file_cache::stats.shared.load());
+            }
+            if (warmup_counters.running) {
+                LOG_INFO("warmup: %lu files, %lu bytes so far", warmup_counters.files.load(),
+                         warmup_counters.bytes.load());
+            }
+            if (!hot_list.empty() && !connection::bundle && ++hot_list_ticks >= 12) {
+                request_hot_list();
+                hot_list_ticks = 0;
+            }
+            LOG_INFO("loop commands: posted %lu, wakeups %lu, stale %lu", loop_channel::stats.posted.load(),
+                     loop_channel::stats.wakeups.load(), loop_channel::stats.stale.load());
+            if (connection::limiter) {
+                connection::limiter->expire();
+                LOG_INFO("client limits: tracked %ld, rejected conns %lu, limited requests %lu",
+                         client_limiter::stats.tracked.load(), client_limiter::stats.rejected_conns.load(),
+                         client_limiter::stats.limited_requests.load());
+            }
+            if (connection::tls) {
+                LOG_INFO("tls: handshakes %lu, resumed %lu, ktls send %lu, ktls recv %lu, failures %lu",
+                         tls_context::stats.handshakes.load(), tls_context::stats.resumed.load(),
+                         tls_context::stats.ktls_send.load(), tls_context::stats.ktls_recv.load(),
+                         tls_context::stats.failures.load());
+            }
+            // 访问日志攒满一批才交给日志后台线程写入，这里定期交出不足一批的记录
+            if (connection::access) {
+                connection::access->flush();
+            }
+            if (connection::tracer) {
+                connection::tracer->flush();
+            }
+            if (connection::capture) {
+                connection::capture->flush();
+            }
             // 因为一次 alarm 调用只会引起一次SIGALARM 信号，所以我们要重新定时，以不断触发 SIGALARM信号。
             alarm(TIMESLOT);
             timeout = false;
         }
     }
 
+    // 领导者/跟随者线程使用客户端epoll对象与连接表，先等它们退出
+    delete leader_pool;
     close(epollfd);
-    close(listenfd);
+    if (client_epollfd != -1) {
+        close(client_epollfd);
+    }
+    for (int fd : listenfds) {
+        close(fd);
+    }
     close(pipefd[0]);
     close(pipefd[1]);
 
     delete[] connections;
+    delete[] events;
+    delete[] ready;
     delete thread_pool;
+    delete connection::disk_pool;
+    delete connection::bundle;
+    delete connection::access;
+    delete connection::tracer;
+    delete connection::capture;
+    delete connection::proxy;
+    delete connection::tls;
+    delete connection::limiter;
+    delete connection::channel;
+    server_stats::shutdown();
 
     return 0;
 }
\ No newline at end of file
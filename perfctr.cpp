@@ -0,0 +1,143 @@
+#include "perfctr.h"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "log.h"
+
+bool                                    perf_counters::enabled     = false;
+uint32_t                                perf_counters::m_mask      = 0;
+bool                                    perf_counters::m_user_only = false;
+thread_local perf_counters::thread_state perf_counters::t_state;
+
+// 各 perf_event_id 对应的事件类型与配置
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} event_configs[PERF_EVENT_NUM] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+};
+
+// 打开只统计调用线程的计数器，group_fd 为-1时作为组长
+static int open_event(int e, int group_fd, bool user_only) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = event_configs[e].type;
+    attr.config         = event_configs[e].config;
+    attr.read_format    = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = user_only;
+    attr.exclude_hv     = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+bool perf_counters::init() {
+    // 先尝试连同内核态一起统计，权限不足时改为只统计用户态
+    for (int pass = 0; pass < 2 && m_mask == 0; ++pass) {
+        m_user_only = pass == 1;
+        bool denied = false;
+        for (int e = 0; e < PERF_EVENT_NUM; ++e) {
+            int fd = open_event(e, -1, m_user_only);
+            if (fd >= 0) {
+                m_mask |= 1u << e;
+                close(fd);
+            } else if (errno == EACCES || errno == EPERM) {
+                denied = true;
+            } else {
+                LOG_INFO("perf event %s is not supported, errno is: %d", perf_event_names[e], errno);
+            }
+        }
+        if (denied && !m_user_only) {
+            m_mask = 0;
+        }
+    }
+    // 上下文切换发生在内核中，只统计用户态时总是0
+    if (m_user_only) {
+        m_mask &= ~(1u << PERF_CONTEXT_SWITCHES);
+    }
+    if (m_mask == 0) {
+        LOG_WARN("no perf event is available, check kernel.perf_event_paranoid");
+        return false;
+    }
+
+    char names[128] = "";
+    for (int e = 0; e < PERF_EVENT_NUM; ++e) {
+        if (m_mask & (1u << e)) {
+            strcat(names, " ");
+            strcat(names, perf_event_names[e]);
+        }
+    }
+    LOG_INFO("perf counters enabled, user only: %d, events:%s", m_user_only, names);
+    server_stats::set_perf(m_mask, m_user_only);
+    enabled = true;
+    return true;
+}
+
+bool perf_counters::open_group(thread_state& st) {
+    st.leader = -1;
+    st.num    = 0;
+    for (int e = 0; e < PERF_EVENT_NUM; ++e) {
+        if (!(m_mask & (1u << e))) {
+            continue;
+        }
+        int fd = open_event(e, st.leader, m_user_only);
+        if (fd < 0) {
+            LOG_WARN("open perf event %s failed, errno is: %d", perf_event_names[e], errno);
+            continue;
+        }
+        if (st.leader == -1) {
+            st.leader = fd;
+        }
+        st.events[st.num++] = e;
+    }
+    st.current = PERF_STAGE_NONE;
+    return st.num > 0 && read_group(st, st.last);
+}
+
+bool perf_counters::read_group(thread_state& st, uint64_t values[PERF_EVENT_NUM]) {
+    uint64_t buf[1 + PERF_EVENT_NUM];
+    if (::read(st.leader, buf, sizeof(buf)) < (ssize_t)sizeof(uint64_t)) {
+        return false;
+    }
+    memset(values, 0, sizeof(uint64_t) * PERF_EVENT_NUM);
+    for (uint64_t i = 0; i < buf[0] && i < (uint64_t)st.num; ++i) {
+        values[st.events[i]] = buf[1 + i];
+    }
+    return true;
+}
+
+perf_stage_id perf_counters::switch_to(perf_stage_id stage) {
+    thread_state& st = t_state;
+    if (!st.opened) {
+        if (st.failed) {
+            return PERF_STAGE_NONE;
+        }
+        if (!open_group(st)) {
+            st.failed = true;
+            return PERF_STAGE_NONE;
+        }
+        st.opened = true;
+    }
+
+    uint64_t now[PERF_EVENT_NUM];
+    if (read_group(st, now)) {
+        if (st.current != PERF_STAGE_NONE) {
+            uint64_t delta[PERF_EVENT_NUM];
+            for (int e = 0; e < PERF_EVENT_NUM; ++e) {
+                delta[e] = now[e] - st.last[e];
+            }
+            server_stats::add_perf(st.current, delta);
+        }
+        memcpy(st.last, now, sizeof(now));
+    }
+    perf_stage_id prev = st.current;
+    st.current         = stage;
+    return prev;
+}
@@ -0,0 +1,68 @@
+#ifndef PERFCTR_H
+#define PERFCTR_H
+
+#include <stdint.h>
+
+#include "stats.h"
+
+/*
+    按处理阶段统计硬件性能计数器:
+        每个线程第一次切换阶段时用 perf_event_open 打开一组只统计本线程的计数器，
+        之后每次切换阶段读一次计数器组，把上次读取以来的增量计入切换前的阶段，结果汇总在统计共享内存中。
+    阶段是互斥的，嵌套的 perf_scope 结束时回到外层阶段，外层不会重复计入内层的增量。
+    未开启时 perf_scope 只检查一个在启动时设置、之后不再改变的布尔值。
+    虚拟机中通常没有硬件PMU，此时只统计上下文切换等软件事件；perf_event_paranoid 较高时退化为只统计用户态。
+*/
+
+class perf_counters {
+public:
+    // 在主线程中试探可用的计数器，至少有一个可用时开启；需在创建其他线程之前、server_stats::init 之后调用
+    static bool init();
+
+    // 把上次读取以来的增量计入当前阶段并切换到 stage，返回原来的阶段
+    static perf_stage_id switch_to(perf_stage_id stage);
+
+    static bool enabled;
+
+private:
+    struct thread_state {
+        bool          opened;
+        bool          failed;
+        int           leader;                 // 计数器组的组长，读它即可读出整组
+        int           num;                    // 组内的计数器数
+        int           events[PERF_EVENT_NUM];  // 组内第i个计数器对应的 perf_event_id
+        uint64_t      last[PERF_EVENT_NUM];    // 上次读取的值，按 perf_event_id
+        perf_stage_id current;
+    };
+
+    static bool open_group(thread_state& st);
+    static bool read_group(thread_state& st, uint64_t values[PERF_EVENT_NUM]);
+
+    static uint32_t                  m_mask;       // 可用的计数器
+    static bool                      m_user_only;  // 是否只能统计用户态
+    static thread_local thread_state t_state;
+};
+
+// 在作用域内把计数器增量计入 stage 阶段
+class perf_scope {
+public:
+    explicit perf_scope(perf_stage_id stage) : m_active(perf_counters::enabled), m_prev(PERF_STAGE_NONE) {
+        if (m_active) {
+            m_prev = perf_counters::switch_to(stage);
+        }
+    }
+    ~perf_scope() {
+        if (m_active) {
+            perf_counters::switch_to(m_prev);
+        }
+    }
+
+    perf_scope(const perf_scope&)            = delete;
+    perf_scope& operator=(const perf_scope&) = delete;
+
+private:
+    bool          m_active;
+    perf_stage_id m_prev;
+};
+
+#endif
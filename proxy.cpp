@@ -0,0 +1,880 @@
+#include "proxy.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "connection.h"
+#include "listener.h"
+#include "log.h"
+#include "perfctr.h"
+#include "stats.h"
+
+int reverse_proxy::connect_timeout = 3;
+int reverse_proxy::read_timeout    = 10;
+int reverse_proxy::idle_timeout    = 60;
+int reverse_proxy::max_idle        = 32;
+
+static const size_t MAX_HEAD_SIZE   = 16 * 1024;  // 上游响应头的上限
+static const size_t PIPE_CHUNK      = 64 * 1024;  // 每次splice进管道的字节数，即管道的默认容量
+static const size_t COPY_CHUNK      = 16 * 1024;  // 复制转发时每次读的字节数
+
+enum upstream_state {
+    UPSTREAM_CONNECTING,  // 非阻塞connect尚未完成
+    UPSTREAM_SENDING,     // 发送请求
+    UPSTREAM_HEAD,        // 读取响应头
+    UPSTREAM_BODY,        // 转发响应体
+    UPSTREAM_IDLE         // 在空闲池中
+};
+
+enum body_framing {
+    BODY_NONE,        // 没有响应体：HEAD请求、204、304
+    BODY_LENGTH,      // 长度由Content-Length给出，splice转发
+    BODY_CHUNKED,     // chunked编码，复制转发并解析分块以找到结尾
+    BODY_UNTIL_CLOSE  // 直到上游关闭连接，splice转发，之后两端的连接都不能复用
+};
+
+// chunked响应体的解析状态
+enum chunk_state {
+    CHUNK_SIZE,      // 分块长度的十六进制数字
+    CHUNK_SIZE_LINE, // 分块长度之后到行尾的部分，如分块扩展
+    CHUNK_DATA,      // 分块数据
+    CHUNK_DATA_END,  // 分块数据之后的\r\n
+    CHUNK_TRAILER,   // 最后一个分块之后的尾部字段，以空行结束
+    CHUNK_DONE
+};
+
+struct upstream_conn {
+    int            fd;
+    proxy_route*   route;
+    upstream_state state;
+    connection*    client;        // 转发中的客户端，空闲时为空
+    bool           reused;        // 取自空闲池，上游可能已经关闭了它，还没收到响应时可以换新连接重发一次
+    bool           client_armed;  // 客户端fd上是否注册着事件，等上游时只监听对端关闭
+    time_t         deadline;      // 连接、读或空闲超时的时刻
+    upstream_conn* prev;
+    upstream_conn* next;
+
+    std::string request;       // 改写后的请求
+    size_t      request_sent;
+    std::string head;          // 已读到的响应头，可能带着一部分响应体
+    std::string out;           // 待发给客户端的数据：改写后的响应头、复制转发的响应体
+    size_t      out_sent;
+    bool        replied;       // 是否已经向客户端发出过字节，之后出错只能断开客户端
+
+    int          status;
+    body_framing framing;
+    uint64_t     remaining;          // BODY_LENGTH 时上游还没读出的字节数
+    bool         eof;                // BODY_UNTIL_CLOSE 时上游已关闭
+    bool         keep_alive;         // 响应结束后上游连接能否放回空闲池
+    bool         client_keep_alive;  // 响应结束后客户端连接能否继续使用
+    int          pipe_fd[2];         // splice用的管道，随上游连接一起复用
+    size_t       pipe_fill;          // 管道中还没发给客户端的字节数
+
+    chunk_state chunk;
+    uint64_t    chunk_left;   // 当前分块还没读完的字节数
+    bool        chunk_digit;  // 当前分块长度是否已有数字
+    size_t      chunk_line;   // 尾部字段当前行的长度，不含\r
+};
+
+void upstream_list::push(upstream_conn* u) {
+    u->prev = nullptr;
+    u->next = head;
+    if (head) {
+        head->prev = u;
+    }
+    head = u;
+    ++size;
+}
+
+void upstream_list::remove(upstream_conn* u) {
+    if (u->prev) {
+        u->prev->next = u->next;
+    } else {
+        head = u->next;
+    }
+    if (u->next) {
+        u->next->prev = u->prev;
+    }
+    u->prev = u->next = nullptr;
+    --size;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// 解析一段chunked响应体，返回其中属于本响应的字节数，格式错误时返回-1
+static ssize_t parse_chunks(upstream_conn* u, const char* data, size_t len) {
+    size_t i = 0;
+    while (i < len && u->chunk != CHUNK_DONE) {
+        char c = data[i];
+        switch (u->chunk) {
+            case CHUNK_SIZE: {
+                int v = hex_value(c);
+                if (v >= 0) {
+                    if (u->chunk_left >> 60) {
+                        return -1;
+                    }
+                    u->chunk_left  = u->chunk_left * 16 + v;
+                    u->chunk_digit = true;
+                    ++i;
+                } else if (!u->chunk_digit) {
+                    return -1;
+                } else {
+                    u->chunk = CHUNK_SIZE_LINE;
+                }
+                break;
+            }
+            case CHUNK_SIZE_LINE: {
+                ++i;
+                if (c == '\n') {
+                    u->chunk_line = 0;
+                    u->chunk      = u->chunk_left == 0 ? CHUNK_TRAILER : CHUNK_DATA;
+                }
+                break;
+            }
+            case CHUNK_DATA: {
+                uint64_t n = std::min((uint64_t)(len - i), u->chunk_left);
+                i += n;
+                u->chunk_left -= n;
+                if (u->chunk_left == 0) {
+                    u->chunk = CHUNK_DATA_END;
+                }
+                break;
+            }
+            case CHUNK_DATA_END: {
+                ++i;
+                if (c == '\n') {
+                    u->chunk       = CHUNK_SIZE;
+                    u->chunk_digit = false;
+                } else if (c != '\r') {
+                    return -1;
+                }
+                break;
+            }
+            case CHUNK_TRAILER: {
+                ++i;
+                if (c == '\n') {
+                    if (u->chunk_line == 0) {
+                        u->chunk = CHUNK_DONE;
+                    }
+                    u->chunk_line = 0;
+                } else if (c != '\r') {
+                    ++u->chunk_line;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    return i;
+}
+
+// 判断头部行 [line, line+len) 的字段名是否为name，是则返回去掉首尾空白的字段值
+static bool header_is(const char* line, size_t len, const char* name, std::string* value = nullptr) {
+    size_t n = strlen(name);
+    if (len <= n || line[n] != ':' || strncasecmp(line, name, n) != 0) {
+        return false;
+    }
+    if (value) {
+        const char* b = line + n + 1;
+        const char* e = line + len;
+        while (b < e && (*b == ' ' || *b == '\t')) ++b;
+        while (e > b && (e[-1] == ' ' || e[-1] == '\t')) --e;
+        value->assign(b, e - b);
+    }
+    return true;
+}
+
+// 逐跳头部只对一段连接有效，不转发
+static bool hop_by_hop(const char* line, size_t len) {
+    return header_is(line, len, "Connection") || header_is(line, len, "Keep-Alive") ||
+           header_is(line, len, "Proxy-Connection") || header_is(line, len, "TE") ||
+           header_is(line, len, "Upgrade");
+}
+
+reverse_proxy::reverse_proxy(int max_fd) : m_max_fd(max_fd), m_conns(new upstream_conn*[max_fd]()), m_stats() {}
+
+reverse_proxy::~reverse_proxy() {
+    for (int fd = 0; fd < m_max_fd; ++fd) {
+        if (m_conns[fd]) {
+            close_upstream(m_conns[fd]);
+        }
+    }
+    delete[] m_conns;
+    for (proxy_route* route : m_routes) {
+        delete route;
+    }
+}
+
+bool reverse_proxy::add_route(const char* spec) {
+    const char* eq = strchr(spec, '=');
+    if (!eq || eq == spec || spec[0] != '/') {
+        return false;
+    }
+    proxy_route* route = new proxy_route();
+    route->prefix.assign(spec, eq - spec);
+    route->target = eq + 1;
+    if (!parse_listen_address(route->target.c_str(), route->addr, route->addr_len)) {
+        delete route;
+        return false;
+    }
+    m_routes.push_back(route);
+    LOG_INFO("proxy %s to %s", route->prefix.c_str(), route->target.c_str());
+    return true;
+}
+
+proxy_route* reverse_proxy::match(const char* url) {
+    proxy_route* best = nullptr;
+    for (proxy_route* route : m_routes) {
+        if (strncmp(url, route->prefix.data(), route->prefix.size()) == 0 &&
+            (!best || route->prefix.size() > best->prefix.size())) {
+            best = route;
+        }
+    }
+    return best;
+}
+
+bool reverse_proxy::owns(int fd) const { return fd >= 0 && fd < m_max_fd && m_conns[fd] != nullptr; }
+
+// 非阻塞地连接上游，连接结果在第一次EPOLLOUT时检查
+int reverse_proxy::open_upstream(proxy_route* route) {
+    int fd = socket(route->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        LOG_ERROR("create upstream socket failed, errno is: %d", errno);
+        return -1;
+    }
+    if (fd >= m_max_fd) {
+        close(fd);
+        return -1;
+    }
+    if (route->addr.ss_family != AF_UNIX) {
+        int nodelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    }
+    if (connect(fd, (sockaddr*)&route->addr, route->addr_len) == -1 && errno != EINPROGRESS) {
+        LOG_WARN("connect upstream %s failed, errno is: %d", route->target.c_str(), errno);
+        close(fd);
+        return -1;
+    }
+    ++m_stats.connects;
+    return fd;
+}
+
+// 由源请求重新拼出发给上游的请求：请求行、去掉逐跳字段的头部、X-Forwarded-For 与请求体
+void reverse_proxy::build_request(connection& conn, std::string& req) {
+    char ip[INET6_ADDRSTRLEN] = "";
+    if (conn.client_address.ss_family == AF_INET) {
+        inet_ntop(AF_INET, &((sockaddr_in*)&conn.client_address)->sin_addr, ip, sizeof(ip));
+    } else if (conn.client_address.ss_family == AF_INET6) {
+        inet_ntop(AF_INET6, &((sockaddr_in6*)&conn.client_address)->sin6_addr, ip, sizeof(ip));
+    }
+
+    req.clear();
+    req.append(method_names[conn.method]).append(" ").append(conn.url).append(" HTTP/1.1\r\n");
+
+    // 解析时每行末尾的\r\n被换成了\0\0，头部以空行结束
+    bool        forwarded = false;
+    const char* line      = conn.read_buf + conn.header_idx;
+    while (*line) {
+        size_t len = strlen(line);
+        if (!hop_by_hop(line, len)) {
+            req.append(line, len);
+            if (ip[0] && header_is(line, len, "X-Forwarded-For")) {
+                req.append(", ").append(ip);
+                forwarded = true;
+            }
+            req.append("\r\n");
+        }
+        line += len + 2;
+    }
+    if (ip[0] && !forwarded) {
+        req.append("X-Forwarded-For: ").append(ip).append("\r\n");
+    }
+    req.append("Connection: keep-alive\r\n\r\n");
+    req.append(line + 2, conn.content_len);
+}
+
+bool reverse_proxy::start(connection& conn, proxy_route* route) {
+    upstream_conn* u = nullptr;
+    if (route->idle.head) {
+        u = route->idle.head;
+        route->idle.remove(u);
+        u->state = UPSTREAM_SENDING;
+    }
+
+    bool fresh = u == nullptr;
+    if (fresh) {
+        int fd = open_upstream(route);
+        if (fd == -1) {
+            ++m_stats.errors;
+            return false;
+        }
+        u             = new upstream_conn();
+        u->fd         = fd;
+        u->route      = route;
+        u->state      = UPSTREAM_CONNECTING;
+        u->pipe_fd[0] = u->pipe_fd[1] = -1;
+        m_conns[fd]   = u;
+    } else {
+        ++m_stats.reused;
+    }
+
+    u->client       = &conn;
+    u->reused       = !fresh;
+    u->client_armed = false;
+    u->deadline     = time(nullptr) + (fresh ? connect_timeout : read_timeout);
+    u->request_sent = 0;
+    u->out_sent     = 0;
+    u->replied      = false;
+    u->head.clear();
+    u->out.clear();
+    build_request(conn, u->request);
+    conn.upstream = u;
+
+    m_active.push(u);
+    ++m_stats.requests;
+
+    // 客户端fd等第一次等待上游时再注册
+    if (fresh) {
+        epoll_event event;
+        event.data.fd = u->fd;
+        event.events  = EPOLLOUT | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
+        epoll_ctl(connection::epollfd, EPOLL_CTL_ADD, u->fd, &event);
+    } else {
+        modify_fd_from_epoll(connection::epollfd, u->fd, EPOLLOUT);
+    }
+    return true;
+}
+
+// 复用的连接在收到响应前就失败了，多半是上游在空闲时关闭了它，换一个新连接重发
+bool reverse_proxy::reconnect(upstream_conn* u) {
+    int fd = open_upstream(u->route);
+    if (fd == -1) {
+        return false;
+    }
+    m_conns[u->fd] = nullptr;
+    remove_fd_from_epoll(connection::epollfd, u->fd);
+    if (u->pipe_fd[0] != -1) {
+        close(u->pipe_fd[0]);
+        close(u->pipe_fd[1]);
+        u->pipe_fd[0] = u->pipe_fd[1] = -1;
+    }
+    u->fd           = fd;
+    u->state        = UPSTREAM_CONNECTING;
+    u->reused       = false;
+    u->request_sent = 0;
+    u->deadline     = time(nullptr) + connect_timeout;
+    u->head.clear();
+    m_conns[fd] = u;
+
+    epoll_event event;
+    event.data.fd = fd;
+    event.events  = EPOLLOUT | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
+    epoll_ctl(connection::epollfd, EPOLL_CTL_ADD, fd, &event);
+    return true;
+}
+
+void reverse_proxy::on_event(int fd, uint32_t events) {
+    upstream_conn* u = m_conns[fd];
+
+    // 空闲连接上的任何事件都说明上游关闭了它，或发来了不属于任何请求的数据
+    if (u->state == UPSTREAM_IDLE) {
+        u->route->idle.remove(u);
+        LOG_INFO("upstream %s closed an idle connection, fd is %d", u->route->target.c_str(), fd);
+        close_upstream(u);
+        return;
+    }
+
+    u->client->update_timer();
+    switch (u->state) {
+        case UPSTREAM_CONNECTING: {
+            int       err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err != 0) {
+                LOG_WARN("connect upstream %s failed, errno is: %d", u->route->target.c_str(), err);
+                fail(u, BAD_GATEWAY);
+                return;
+            }
+            u->state    = UPSTREAM_SENDING;
+            u->deadline = time(nullptr) + read_timeout;
+            send_request(u);
+            break;
+        }
+        case UPSTREAM_SENDING:
+            send_request(u);
+            break;
+        case UPSTREAM_HEAD:
+            read_head(u);
+            break;
+        case UPSTREAM_BODY:
+            pump(u);
+            break;
+        default:
+            break;
+    }
+}
+
+bool reverse_proxy::on_client_writable(connection& conn) {
+    upstream_conn* u = conn.upstream;
+    u->client_armed  = false;
+    if (u->state == UPSTREAM_BODY) {
+        pump(u);
+    } else {
+        wait_upstream(u, 0);
+    }
+    return conn.sockfd != -1;
+}
+
+void reverse_proxy::send_request(upstream_conn* u) {
+    while (u->request_sent < u->request.size()) {
+        ssize_t n = send(u->fd, u->request.data() + u->request_sent, u->request.size() - u->request_sent, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                wait_upstream(u, EPOLLOUT);
+                return;
+            }
+            fail(u, BAD_GATEWAY);
+            return;
+        }
+        u->request_sent += n;
+    }
+    u->state    = UPSTREAM_HEAD;
+    u->deadline = time(nullptr) + read_timeout;
+    read_head(u);
+}
+
+void reverse_proxy::read_head(upstream_conn* u) {
+    char buf[4096];
+    while (1) {
+        ssize_t n = recv(u->fd, buf, sizeof(buf), 0);
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                wait_upstream(u, EPOLLIN);
+                return;
+            }
+            fail(u, BAD_GATEWAY);
+            return;
+        }
+        if (n == 0) {
+            fail(u, BAD_GATEWAY);
+            return;
+        }
+        u->deadline = time(nullptr) + read_timeout;
+        u->head.append(buf, n);
+
+        // 1xx临时响应之后还有最终响应，所以可能要连续找多个响应头
+        size_t end;
+        while ((end = u->head.find("\r\n\r\n")) != std::string::npos) {
+            int status = parse_head(u, end + 4);
+            if (status < 0) {
+                LOG_WARN("bad response head from upstream %s", u->route->target.c_str());
+                fail(u, BAD_GATEWAY);
+                return;
+            }
+            if (status >= 200) {
+                start_body(u, end + 4);
+                return;
+            }
+            u->head.erase(0, end + 4);
+        }
+        if (u->head.size() > MAX_HEAD_SIZE) {
+            LOG_WARN("response head from upstream %s is too large", u->route->target.c_str());
+            fail(u, BAD_GATEWAY);
+            return;
+        }
+    }
+}
+
+// 解析响应头并改写成发给客户端的响应头，返回状态码，格式错误返回-1
+int reverse_proxy::parse_head(upstream_conn* u, size_t head_len) {
+    const char* p   = u->head.data();
+    const char* end = p + head_len - 2;  // 不含最后的空行
+    const char* eol = (const char*)memmem(p, end - p, "\r\n", 2);
+    if (eol - p < 12 || strncmp(p, "HTTP/1.", 7) != 0 || p[8] != ' ') {
+        return -1;
+    }
+    int status = atoi(p + 9);
+    if (status < 100 || status > 599) {
+        return -1;
+    }
+    if (status < 200) {
+        // 已经去掉了Upgrade，不应该收到101；其余的1xx直接丢弃
+        return status == 101 ? -1 : status;
+    }
+    bool http11 = p[7] == '1';
+
+    u->out.assign(p, eol + 2 - p);
+    bool        has_length = false, chunked = false, conn_close = !http11, conn_keep = false;
+    uint64_t    length = 0;
+    std::string value;
+    for (const char* line = eol + 2; line < end; line = eol + 2) {
+        eol        = (const char*)memmem(line, end - line, "\r\n", 2);
+        size_t len = eol - line;
+        if (header_is(line, len, "Connection", &value)) {
+            conn_close = strcasestr(value.c_str(), "close") != nullptr;
+            conn_keep  = strcasestr(value.c_str(), "keep-alive") != nullptr;
+            continue;
+        }
+        if (hop_by_hop(line, len)) {
+            continue;
+        }
+        if (header_is(line, len, "Content-Length", &value)) {
+            char* num_end;
+            length     = strtoull(value.c_str(), &num_end, 10);
+            has_length = *num_end == '\0' && !value.empty();
+            if (!has_length) {
+                return -1;
+            }
+        } else if (header_is(line, len, "Transfer-Encoding", &value)) {
+            chunked = strcasestr(value.c_str(), "chunked") != nullptr;
+        }
+        u->out.append(line, len + 2);
+    }
+
+    connection& conn = *u->client;
+    u->status        = status;
+    u->eof           = false;
+    u->remaining     = 0;
+    if (conn.method == HEAD || status == 204 || status == 304) {
+        u->framing = BODY_NONE;
+    } else if (chunked) {
+        u->framing     = BODY_CHUNKED;
+        u->chunk       = CHUNK_SIZE;
+        u->chunk_left  = 0;
+        u->chunk_digit = false;
+        u->chunk_line  = 0;
+    } else if (has_length) {
+        u->framing   = BODY_LENGTH;
+        u->remaining = length;
+    } else {
+        u->framing = BODY_UNTIL_CLOSE;
+    }
+    u->keep_alive        = (!conn_close || conn_keep) && u->framing != BODY_UNTIL_CLOSE;
+    u->client_keep_alive = conn.is_keep_alive && u->framing != BODY_UNTIL_CLOSE;
+
+    static const char keep_alive[] = "Connection: keep-alive\r\n\r\n";
+    static const char close[]      = "Connection: close\r\n\r\n";
+    if (u->client_keep_alive) {
+        u->out.append(keep_alive, sizeof(keep_alive) - 1);
+    } else {
+        u->out.append(close, sizeof(close) - 1);
+    }
+    return status;
+}
+
+// 响应头之后已经读到的部分响应体跟着响应头一起发出，其余的在pump中转发
+void reverse_proxy::start_body(upstream_conn* u, size_t head_len) {
+    const char* extra     = u->head.data() + head_len;
+    size_t      extra_len = u->head.size() - head_len;
+    size_t      take      = extra_len;
+    switch (u->framing) {
+        case BODY_NONE:
+            take = 0;
+            break;
+        case BODY_LENGTH:
+            take = std::min((uint64_t)extra_len, u->remaining);
+            u->remaining -= take;
+            break;
+        case BODY_CHUNKED: {
+            ssize_t n = parse_chunks(u, extra, extra_len);
+            if (n < 0) {
+                fail(u, BAD_GATEWAY);
+                return;
+            }
+            take = n;
+            break;
+        }
+        case BODY_UNTIL_CLOSE:
+            break;
+    }
+    // 上游在响应之后多发了数据，这条连接的状态已经说不清，不再复用
+    if (take < extra_len) {
+        u->keep_alive = false;
+    }
+    u->out.append(extra, take);
+    u->head.clear();
+
+    connection& conn = *u->client;
+    conn.status_code = u->status;
+    server_stats::count_status(u->status);
+    conn.trace.stamp(TRACE_RESPONSE_READY);
+    u->state = UPSTREAM_BODY;
+    pump(u);
+}
+
+// 转发响应体，直到发完、某一端暂时不可读写或出错；每次唤醒最多发送 connection::write_budget 字节
+void reverse_proxy::pump(upstream_conn* u) {
+    perf_scope  perf(PERF_STAGE_WRITE);
+    connection& conn  = *u->client;
+    size_t      round = 0;
+    while (1) {
+        if (connection::write_budget > 0 && round >= connection::write_budget) {
+            wait_client(u);
+            return;
+        }
+
+        // 先发完用户态暂存的数据，再发管道中的数据
+        ssize_t n = 0;
+        if (u->out_sent < u->out.size()) {
+            n = conn.send_bytes(u->out.data() + u->out_sent, u->out.size() - u->out_sent);
+        } else if (u->pipe_fill > 0) {
+            n = splice(u->pipe_fd[0], nullptr, conn.sockfd, nullptr, u->pipe_fill, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        }
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                wait_client(u);
+                return;
+            }
+            LOG_INFO("write to proxied client failed, which sockfd is %d", conn.sockfd);
+            conn.close_conn();
+            return;
+        }
+        if (n > 0) {
+            if (!u->replied) {
+                u->replied = true;
+                conn.trace.stamp(TRACE_FIRST_WRITE);
+            }
+            if (u->out_sent < u->out.size()) {
+                u->out_sent += n;
+                if (u->out_sent == u->out.size()) {
+                    u->out.clear();
+                    u->out_sent = 0;
+                }
+            } else {
+                u->pipe_fill -= n;
+            }
+            conn.bytes_had_send += n;
+            round += n;
+            server_stats::add(STAT_BYTES_OUT, n);
+            continue;
+        }
+
+        // 已读出的都发完了，判断响应是否结束
+        bool done = false;
+        switch (u->framing) {
+            case BODY_NONE:
+                done = true;
+                break;
+            case BODY_LENGTH:
+                done = u->remaining == 0;
+                break;
+            case BODY_CHUNKED:
+                done = u->chunk == CHUNK_DONE;
+                break;
+            case BODY_UNTIL_CLOSE:
+                done = u->eof;
+                break;
+        }
+        if (done) {
+            finish(u);
+            return;
+        }
+
+        // 继续从上游读：chunked与用户态TLS的客户端读到用户态，其余splice进管道
+        if (u->framing == BODY_CHUNKED || !conn.plain_send()) {
+            char   buf[COPY_CHUNK];
+            size_t want = sizeof(buf);
+            if (u->framing == BODY_LENGTH) {
+                want = std::min((uint64_t)want, u->remaining);
+            }
+            n = recv(u->fd, buf, want, 0);
+            if (n > 0) {
+                ssize_t take = n;
+                if (u->framing == BODY_CHUNKED) {
+                    take = parse_chunks(u, buf, n);
+                    if (take < 0) {
+                        fail(u, BAD_GATEWAY);
+                        return;
+                    }
+                    if (take < n) {
+                        u->keep_alive = false;
+                    }
+                } else if (u->framing == BODY_LENGTH) {
+                    u->remaining -= n;
+                }
+                u->out.append(buf, take);
+            }
+        } else {
+            if (u->pipe_fd[0] == -1 && pipe2(u->pipe_fd, O_NONBLOCK | O_CLOEXEC) == -1) {
+                LOG_ERROR("create proxy pipe failed, errno is: %d", errno);
+                u->pipe_fd[0] = u->pipe_fd[1] = -1;
+                fail(u, INTERNAL_ERROR);
+                return;
+            }
+            size_t want = PIPE_CHUNK;
+            if (u->framing == BODY_LENGTH) {
+                want = std::min((uint64_t)want, u->remaining);
+            }
+            n = splice(u->fd, nullptr, u->pipe_fd[1], nullptr, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n > 0) {
+                u->pipe_fill += n;
+                if (u->framing == BODY_LENGTH) {
+                    u->remaining -= n;
+                }
+            }
+        }
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                wait_upstream(u, EPOLLIN);
+                return;
+            }
+            fail(u, BAD_GATEWAY);
+            return;
+        }
+        if (n == 0) {
+            if (u->framing != BODY_UNTIL_CLOSE) {
+                LOG_WARN("upstream %s closed before the response finished", u->route->target.c_str());
+                fail(u, BAD_GATEWAY);
+                return;
+            }
+            u->eof = true;
+        }
+        u->deadline = time(nullptr) + read_timeout;
+    }
+}
+
+// 响应发完，上游连接放回空闲池或关闭，客户端按长连接的约定继续或关闭
+void reverse_proxy::finish(upstream_conn* u) {
+    connection& conn   = *u->client;
+    conn.upstream      = nullptr;
+    conn.is_keep_alive = u->client_keep_alive;
+
+    bool pooled = false;
+    m_active.remove(u);
+    if (u->keep_alive && u->route->idle.size < (size_t)max_idle) {
+        u->state    = UPSTREAM_IDLE;
+        u->client   = nullptr;
+        u->deadline = time(nullptr) + idle_timeout;
+        u->route->idle.push(u);
+        modify_fd_from_epoll(connection::epollfd, u->fd, EPOLLIN);
+        pooled = true;
+    }
+    if (!pooled) {
+        close_upstream(u);
+    }
+
+    if (!conn.end_response()) {
+        conn.close_conn();
+    }
+}
+
+// 连接或读取上游失败：还没回送任何字节时回送错误响应，否则只能断开客户端
+void reverse_proxy::fail(upstream_conn* u, HTTP_CODE code) {
+    connection& conn = *u->client;
+    if (code == BAD_GATEWAY && u->reused && !u->replied && u->head.empty() && conn.method != POST && reconnect(u)) {
+        ++m_stats.retries;
+        return;
+    }
+    if (code == GATEWAY_TIMEOUT) {
+        ++m_stats.timeouts;
+    } else {
+        ++m_stats.errors;
+    }
+
+    bool replied = u->replied;
+    detach(u);
+    if (replied) {
+        conn.close_conn();
+        return;
+    }
+    if (!conn.reply_http(code)) {
+        conn.close_conn();
+        return;
+    }
+    conn.trace.stamp(TRACE_RESPONSE_READY);
+    modify_fd_from_epoll(connection::epollfd, conn.sockfd, EPOLLOUT);
+}
+
+void reverse_proxy::abort(connection& conn) {
+    upstream_conn* u = conn.upstream;
+    if (u) {
+        detach(u);
+    }
+}
+
+// 把转发中的上游连接与客户端分开并关闭它
+void reverse_proxy::detach(upstream_conn* u) {
+    u->client->upstream = nullptr;
+    m_active.remove(u);
+    close_upstream(u);
+}
+
+void reverse_proxy::close_upstream(upstream_conn* u) {
+    // 先清除索引再关闭，关闭之后同一个fd可能马上被新的客户端或上游连接用到
+    m_conns[u->fd] = nullptr;
+    remove_fd_from_epoll(connection::epollfd, u->fd);
+    if (u->pipe_fd[0] != -1) {
+        close(u->pipe_fd[0]);
+        close(u->pipe_fd[1]);
+    }
+    delete u;
+}
+
+// 等待上游可读或可写，同时让客户端fd只报告对端关闭，以便客户端先走时及时放弃上游连接
+void reverse_proxy::wait_upstream(upstream_conn* u, uint32_t ev) {
+    if (ev) {
+        modify_fd_from_epoll(connection::epollfd, u->fd, ev);
+    }
+    if (!u->client_armed) {
+        modify_fd_from_epoll(connection::epollfd, u->client->sockfd, 0);
+        u->client_armed = true;
+    }
+}
+
+void reverse_proxy::wait_client(upstream_conn* u) {
+    modify_fd_from_epoll(connection::epollfd, u->client->sockfd, EPOLLOUT);
+    u->client_armed = true;
+}
+
+void reverse_proxy::tick() {
+    time_t                      now = time(nullptr);
+    std::vector<upstream_conn*> expired, stale;
+
+    for (upstream_conn* u = m_active.head; u; u = u->next) {
+        if (now >= u->deadline) {
+            expired.push_back(u);
+        } else {
+            // 客户端的空闲定时器比上游的超时短时，不让它在等上游期间关闭客户端
+            u->client->update_timer();
+        }
+    }
+    size_t idle = 0;
+    for (proxy_route* route : m_routes) {
+        upstream_conn* next;
+        for (upstream_conn* u = route->idle.head; u; u = next) {
+            next = u->next;
+            if (now >= u->deadline) {
+                route->idle.remove(u);
+                stale.push_back(u);
+            }
+        }
+        idle += route->idle.size;
+    }
+
+    for (upstream_conn* u : stale) {
+        close_upstream(u);
+    }
+    for (upstream_conn* u : expired) {
+        LOG_WARN("upstream %s timed out, which client sockfd is %d", u->route->target.c_str(), u->client->sockfd);
+        fail(u, GATEWAY_TIMEOUT);
+    }
+    LOG_INFO("proxy: requests %lu, connects %lu, reused %lu, retries %lu, errors %lu, timeouts %lu, idle %lu",
+             m_stats.requests.load(), m_stats.connects.load(), m_stats.reused.load(), m_stats.retries.load(),
+             m_stats.errors.load(), m_stats.timeouts.load(), (unsigned long)idle);
+}
@@ -0,0 +1,106 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "state.h"
+
+class connection;
+struct upstream_conn;
+
+/*
+    反向代理:
+        -R 前缀=上游地址 把url以该前缀开头的请求原样转发给上游HTTP服务器，上游地址的写法与监听地址相同(见 listener.h)，
+        多条规则按最长前缀匹配。
+        工作线程解析完请求后投递命令(见 loopcmd.h)，由事件循环去掉逐跳头部、补上 X-Forwarded-For，
+        从该上游的空闲连接池中取一个长连接(没有则非阻塞connect新建)，把上游fd注册到同一个epoll中；
+        之后的发送请求、读响应头、回送响应体也都在事件循环中进行，上游连接的状态只由事件循环访问，不需要加锁。
+        带Content-Length或直到上游关闭才结束的响应体用splice经管道从上游套接字搬到客户端套接字，不复制到用户态；
+        chunked响应体要解析分块才能找到结尾，复制到用户态边解析边转发；客户端是用户态加密的TLS连接时也只能复制。
+        响应完整读完且上游允许长连接时，上游连接回到空闲池，空闲期间仍监听EPOLLIN/EPOLLRDHUP，以便及时发现上游关闭。
+        连接超时、读超时与空闲超时在定时器的tick中检查，精度为TIMESLOT；超时前还没回送任何字节时回送504，否则直接断开客户端。
+*/
+
+// 上游连接的双向链表，所有转发中的连接一个，每个上游的空闲连接各一个
+struct upstream_list {
+    upstream_conn* head;
+    size_t         size;
+
+    upstream_list() : head(nullptr), size(0) {}
+    void push(upstream_conn* u);
+    void remove(upstream_conn* u);
+};
+
+// 一条转发规则
+struct proxy_route {
+    std::string      prefix;    // url前缀
+    std::string      target;    // 上游地址的原始写法，用于日志
+    sockaddr_storage addr;      // 上游地址
+    socklen_t        addr_len;
+    upstream_list    idle;      // 空闲的长连接
+};
+
+// 代理计数器，在定时器tick中输出到日志
+struct proxy_stats {
+    std::atomic<unsigned long> requests;  // 转发的请求数
+    std::atomic<unsigned long> connects;  // 新建的上游连接数
+    std::atomic<unsigned long> reused;    // 复用空闲连接的次数
+    std::atomic<unsigned long> retries;   // 复用的连接已被上游关闭，换新连接重发的次数
+    std::atomic<unsigned long> errors;    // 连接失败或响应有误，回送502或断开客户端的次数
+    std::atomic<unsigned long> timeouts;  // 超时回送504或断开客户端的次数
+};
+
+class reverse_proxy {
+public:
+    static int connect_timeout;  // 连接上游的超时，秒
+    static int read_timeout;     // 发出请求后两次收到上游数据之间的超时，秒
+    static int idle_timeout;     // 空闲连接在池中保留的时间，秒
+    static int max_idle;         // 每个上游最多保留的空闲连接数
+
+    explicit reverse_proxy(int max_fd);  // max_fd 与事件循环的最大文件描述符个数一致
+    ~reverse_proxy();
+
+    bool         add_route(const char* spec);  // 添加一条"前缀=上游地址"规则，启动时调用
+    proxy_route* match(const char* url);       // 查找与url匹配的最长前缀，没有则返回nullptr
+
+    /* 下面这一组函数只在事件循环中调用 */
+
+    // 取得上游连接并开始转发，失败时由调用者回送502
+    bool start(connection& conn, proxy_route* route);
+
+    bool owns(int fd) const;                    // fd是否是上游连接
+    void on_event(int fd, uint32_t events);     // 上游fd上的事件
+    bool on_client_writable(connection& conn);  // 转发中的客户端可写，返回false表示客户端已关闭
+    void abort(connection& conn);               // 客户端关闭或超时，丢弃转发中的上游连接
+    void tick();                                // 检查超时，淘汰过期的空闲连接
+
+private:
+    int  open_upstream(proxy_route* route);
+    bool reconnect(upstream_conn* u);
+    void build_request(connection& conn, std::string& req);
+    void send_request(upstream_conn* u);
+    void read_head(upstream_conn* u);
+    int  parse_head(upstream_conn* u, size_t head_len);
+    void start_body(upstream_conn* u, size_t head_len);
+    void pump(upstream_conn* u);
+    void finish(upstream_conn* u);
+    void fail(upstream_conn* u, HTTP_CODE code);
+    void wait_upstream(upstream_conn* u, uint32_t ev);
+    void wait_client(upstream_conn* u);
+    void detach(upstream_conn* u);
+    void close_upstream(upstream_conn* u);
+
+    std::vector<proxy_route*> m_routes;
+    int                       m_max_fd;
+    upstream_conn**           m_conns;   // 按fd索引的上游连接
+    upstream_list             m_active;  // 转发中的连接
+    proxy_stats               m_stats;
+};
+
+#endif
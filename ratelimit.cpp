@@ -0,0 +1,131 @@
+#include "ratelimit.h"
+
+#include <netinet/in.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+
+limit_stats client_limiter::stats;
+
+static uint64_t monotonic_ms() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+client_limiter::client_limiter(int max_conns, int rate, int burst)
+    : m_max_conns(max_conns), m_rate(rate), m_burst(burst > 0 ? burst : rate) {}
+
+bool client_limiter::key_of(const sockaddr_storage& addr, client_ip& ip) {
+    uint8_t bytes[16];
+    if (addr.ss_family == AF_INET) {
+        // ::ffff:a.b.c.d，与双栈监听上收到的IPv4连接是同一个键
+        memset(bytes, 0, 10);
+        bytes[10] = 0xff;
+        bytes[11] = 0xff;
+        memcpy(bytes + 12, &((const sockaddr_in*)&addr)->sin_addr, 4);
+    } else if (addr.ss_family == AF_INET6) {
+        memcpy(bytes, &((const sockaddr_in6*)&addr)->sin6_addr, 16);
+    } else {
+        return false;
+    }
+    memcpy(&ip.hi, bytes, 8);
+    memcpy(&ip.lo, bytes + 8, 8);
+    return true;
+}
+
+void client_limiter::refill(client_entry& entry, uint64_t now) {
+    if (now > entry.refill_ms) {
+        entry.tokens    = std::min(m_burst, entry.tokens + (now - entry.refill_ms) * m_rate / 1000);
+        entry.refill_ms = now;
+    }
+}
+
+bool client_limiter::on_accept(const sockaddr_storage& addr) {
+    client_ip ip;
+    if (!key_of(addr, ip)) {
+        return true;
+    }
+    stripe& s = stripe_of(ip);
+    s.lock.lock();
+    auto it = s.clients.find(ip);
+    if (it == s.clients.end()) {
+        client_entry entry;
+        entry.conns     = 0;
+        entry.tokens    = m_burst;
+        entry.refill_ms = monotonic_ms();
+        it              = s.clients.emplace(ip, entry).first;
+        ++stats.tracked;
+    }
+    if (m_max_conns > 0 && it->second.conns >= m_max_conns) {
+        s.lock.unlock();
+        ++stats.rejected_conns;
+        return false;
+    }
+    ++it->second.conns;
+    s.lock.unlock();
+    return true;
+}
+
+void client_limiter::on_close(const sockaddr_storage& addr) {
+    client_ip ip;
+    if (!key_of(addr, ip)) {
+        return;
+    }
+    stripe& s = stripe_of(ip);
+    s.lock.lock();
+    auto it = s.clients.find(ip);
+    if (it != s.clients.end() && it->second.conns > 0) {
+        --it->second.conns;
+    }
+    s.lock.unlock();
+}
+
+bool client_limiter::on_request(const sockaddr_storage& addr) {
+    client_ip ip;
+    if (m_rate <= 0 || !key_of(addr, ip)) {
+        return true;
+    }
+    stripe& s = stripe_of(ip);
+    s.lock.lock();
+    auto it = s.clients.find(ip);
+    if (it == s.clients.end()) {
+        // 连接在accept时已登记，正常不会走到这里
+        s.lock.unlock();
+        return true;
+    }
+    client_entry& entry = it->second;
+    refill(entry, monotonic_ms());
+    bool allowed = entry.tokens >= 1;
+    if (allowed) {
+        entry.tokens -= 1;
+    }
+    s.lock.unlock();
+    if (!allowed) {
+        ++stats.limited_requests;
+    }
+    return allowed;
+}
+
+void client_limiter::expire() {
+    uint64_t now = monotonic_ms();
+    for (int i = 0; i < STRIPES; ++i) {
+        stripe& s = m_stripes[i];
+        s.lock.lock();
+        for (auto it = s.clients.begin(); it != s.clients.end();) {
+            client_entry& entry = it->second;
+            if (m_rate > 0) {
+                refill(entry, now);
+            }
+            // 没有连接、令牌已补满的条目与新建的条目没有区别
+            if (entry.conns == 0 && (m_rate <= 0 || entry.tokens >= m_burst)) {
+                it = s.clients.erase(it);
+                --stats.tracked;
+            } else {
+                ++it;
+            }
+        }
+        s.lock.unlock();
+    }
+}
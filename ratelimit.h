@@ -0,0 +1,92 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include <atomic>
+#include <unordered_map>
+
+#include "locker.h"
+
+/*
+    按客户端IP限流:
+        -I 连接数:每秒请求数[:突发] 限制每个IP同时占用的连接数与请求速率，任一项为0表示不限制该项。
+        accept时检查连接数，超过上限的连接直接关闭；事件循环读完一个请求、交给线程池之前从该IP的令牌桶取一个令牌，
+        取不到时在事件循环中直接回送429并关闭连接，请求不会进入工作队列。
+        IPv4地址按 ::ffff:a.b.c.d 的形式与IPv6放在同一张表中，Unix域套接字的连接来自本机，不限流。
+        表按地址哈希分成若干段，每段一把锁，事件循环与关闭连接的工作线程只在同一段上竞争；
+        没有连接且令牌已经补满的条目在定时器tick中删除，不会丢失任何状态。
+*/
+
+// 16字节的客户端地址
+struct client_ip {
+    uint64_t hi;
+    uint64_t lo;
+
+    bool operator==(const client_ip& other) const { return hi == other.hi && lo == other.lo; }
+};
+
+// IPv4的键hi恒为0、lo的低字节恒为0，合并之后用fmix64打散，否则按段取模时所有IPv4地址都落在同一段
+struct client_ip_hash {
+    size_t operator()(const client_ip& ip) const {
+        uint64_t h = (ip.hi * 0x9E3779B97F4A7C15ULL) ^ ip.lo;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+};
+
+// 一个IP的状态
+struct client_entry {
+    int      conns;      // 当前连接数
+    double   tokens;     // 令牌桶中剩余的令牌
+    uint64_t refill_ms;  // 上次补充令牌的时刻，单调时钟毫秒
+};
+
+// 限流计数器，在定时器tick中输出到日志
+struct limit_stats {
+    std::atomic<unsigned long> rejected_conns;    // 超过连接数上限被关闭的连接
+    std::atomic<unsigned long> limited_requests;  // 超过速率被回送429的请求
+    std::atomic<long>          tracked;           // 表中的IP数
+};
+
+class client_limiter {
+public:
+    client_limiter(int max_conns, int rate, int burst);
+
+    // 地址不需要限流时返回false，否则把它转成表中的键
+    static bool key_of(const sockaddr_storage& addr, client_ip& ip);
+
+    bool on_accept(const sockaddr_storage& addr);   // 登记新连接，超过连接数上限时返回false且不登记
+    void on_close(const sockaddr_storage& addr);    // 登记过的连接关闭
+    bool on_request(const sockaddr_storage& addr);  // 取一个令牌，超过速率时返回false
+    void expire();                                  // 删除没有状态的条目，在定时器tick中调用
+
+    static limit_stats stats;
+
+    static const int STRIPES = 64;
+
+    // 段号取哈希的高位，段内的unordered_map按低位分桶，两者互不相关
+    static int stripe_index(const client_ip& ip) { return (client_ip_hash()(ip) >> 32) % STRIPES; }
+
+private:
+
+    struct stripe {
+        locker                                                      lock;
+        std::unordered_map<client_ip, client_entry, client_ip_hash> clients;
+    };
+
+    stripe& stripe_of(const client_ip& ip) { return m_stripes[stripe_index(ip)]; }
+    void    refill(client_entry& entry, uint64_t now);
+
+    int    m_max_conns;  // 每个IP的连接数上限，0表示不限制
+    double m_rate;       // 每秒补充的令牌数，0表示不限制请求速率
+    double m_burst;      // 令牌桶容量
+    stripe m_stripes[STRIPES];
+};
+
+#endif
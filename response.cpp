@@ -0,0 +1,24 @@
+#include "response.h"
+
+#include <time.h>
+
+// 每个线程一份缓存，避免加锁；同一秒内直接返回上次格式化的结果
+struct date_cache {
+    time_t sec;
+    size_t len;
+    char   buf[64];
+};
+
+static thread_local date_cache cached_date = {-1, 0, {0}};
+
+const char* http_date_header(size_t& len) {
+    time_t now = time(nullptr);
+    if (now != cached_date.sec) {
+        struct tm gmt;
+        gmtime_r(&now, &gmt);
+        cached_date.len = strftime(cached_date.buf, sizeof(cached_date.buf), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &gmt);
+        cached_date.sec = now;
+    }
+    len = cached_date.len;
+    return cached_date.buf;
+}
@@ -0,0 +1,212 @@
+#ifndef RESPONSE_H
+#define RESPONSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+/*
+    编译期生成的HTTP响应片段:
+        状态行、错误响应的头部与响应体、扩展名到MIME类型的哈希表在编译期构造完毕，
+        运行时拼装响应头只需要若干次memcpy，不再调用printf族函数。
+*/
+
+// 编译期可构造的定长字符串
+template <size_t N>
+struct const_str {
+    char   data[N] = {};
+    size_t len     = 0;
+
+    constexpr void append(const char* s) {
+        while (*s) {
+            data[len++] = *s++;
+        }
+    }
+
+    constexpr void append_uint(size_t v) {
+        char   tmp[20] = {};
+        size_t n       = 0;
+        do {
+            tmp[n++] = '0' + v % 10;
+            v /= 10;
+        } while (v);
+        while (n) {
+            data[len++] = tmp[--n];
+        }
+    }
+};
+
+constexpr size_t const_strlen(const char* s) {
+    size_t n = 0;
+    while (s[n]) {
+        ++n;
+    }
+    return n;
+}
+
+constexpr const_str<64> make_status_line(int status, const char* title) {
+    const_str<64> line;
+    line.append("HTTP/1.1 ");
+    line.append_uint(status);
+    line.append(" ");
+    line.append(title);
+    line.append("\r\n");
+    return line;
+}
+
+// 错误响应: head 为状态行加上 Content-Length 与 Content-Type，之后由连接补上 Date、Connection 与空行
+struct error_response {
+    const_str<128> head;
+    const char*    body;
+    size_t         body_len;
+};
+
+constexpr error_response make_error_response(int status, const char* title, const char* body) {
+    error_response resp{};
+    const_str<64>  line = make_status_line(status, title);
+    resp.head.append(line.data);
+    resp.head.append("Content-Length: ");
+    resp.head.append_uint(const_strlen(body));
+    resp.head.append("\r\nContent-Type: text/html\r\n");
+    resp.body     = body;
+    resp.body_len = const_strlen(body);
+    return resp;
+}
+
+constexpr const_str<64> status_200 = make_status_line(200, "OK");
+constexpr const_str<64> status_304 = make_status_line(304, "Not Modified");
+
+constexpr error_response error_400 =
+    make_error_response(400, "Bad Request", "Your request has bad syntax or is inherently impossible to satisfy.\n");
+constexpr error_response error_403 =
+    make_error_response(403, "Forbidden", "You do not have permission to get file from this server.\n");
+constexpr error_response error_404 =
+    make_error_response(404, "Not Found", "The requested file was not found on this server.\n");
+constexpr error_response error_429 =
+    make_error_response(429, "Too Many Requests", "You are sending requests too quickly, please slow down.\n");
+constexpr error_response error_500 =
+    make_error_response(500, "Internal Error", "There was an unusual problem serving the requested file.\n");
+constexpr error_response error_502 =
+    make_error_response(502, "Bad Gateway", "The upstream server could not be reached or sent an invalid response.\n");
+constexpr error_response error_504 =
+    make_error_response(504, "Gateway Timeout", "The upstream server did not respond in time.\n");
+
+// 扩展名到MIME类型的对应表，编译期构造成开放寻址哈希表
+struct mime_entry {
+    const char* ext;
+    const char* type;
+};
+
+constexpr mime_entry mime_types[] = {
+    {"html", "text/html"},         {"htm", "text/html"},           {"css", "text/css"},
+    {"js", "text/javascript"},     {"mjs", "text/javascript"},     {"json", "application/json"},
+    {"txt", "text/plain"},         {"xml", "text/xml"},            {"csv", "text/csv"},
+    {"md", "text/markdown"},       {"png", "image/png"},           {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},        {"gif", "image/gif"},           {"svg", "image/svg+xml"},
+    {"ico", "image/x-icon"},       {"webp", "image/webp"},         {"avif", "image/avif"},
+    {"bmp", "image/bmp"},          {"mp3", "audio/mpeg"},          {"wav", "audio/wav"},
+    {"ogg", "audio/ogg"},          {"mp4", "video/mp4"},           {"webm", "video/webm"},
+    {"woff", "font/woff"},         {"woff2", "font/woff2"},        {"ttf", "font/ttf"},
+    {"otf", "font/otf"},           {"pdf", "application/pdf"},     {"zip", "application/zip"},
+    {"gz", "application/gzip"},    {"tar", "application/x-tar"},   {"wasm", "application/wasm"},
+    {"map", "application/json"},
+};
+
+constexpr size_t      MIME_NUM      = sizeof(mime_types) / sizeof(mime_types[0]);
+constexpr size_t      MIME_BUCKETS  = 128;  // 2的幂，且远大于 MIME_NUM 以缩短探测
+constexpr size_t      MIME_EXT_MAX  = 8;    // 扩展名的最大长度
+constexpr const char* MIME_FALLBACK = "application/octet-stream";
+
+constexpr char mime_lower(char c) { return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c; }
+
+constexpr uint32_t mime_hash(const char* ext, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)mime_lower(ext[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+struct mime_index {
+    uint8_t slot[MIME_BUCKETS] = {};  // mime_types 下标+1，0为空槽
+};
+
+constexpr mime_index build_mime_index() {
+    mime_index index;
+    for (size_t i = 0; i < MIME_NUM; ++i) {
+        size_t b = mime_hash(mime_types[i].ext, const_strlen(mime_types[i].ext)) & (MIME_BUCKETS - 1);
+        while (index.slot[b]) {
+            b = (b + 1) & (MIME_BUCKETS - 1);
+        }
+        index.slot[b] = i + 1;
+    }
+    return index;
+}
+
+constexpr mime_index mime_table = build_mime_index();
+
+static_assert(MIME_NUM < MIME_BUCKETS / 2, "mime table is too full");
+
+// 根据路径的扩展名查找MIME类型，未知类型返回 application/octet-stream
+inline const char* mime_type_of(const char* path, size_t len) {
+    size_t dot = len;
+    while (dot > 0 && path[dot - 1] != '.' && path[dot - 1] != '/') {
+        --dot;
+    }
+    if (dot == 0 || path[dot - 1] != '.' || len - dot == 0 || len - dot > MIME_EXT_MAX) {
+        return MIME_FALLBACK;
+    }
+    const char* ext = path + dot;
+    size_t      n   = len - dot;
+    for (size_t b = mime_hash(ext, n) & (MIME_BUCKETS - 1); mime_table.slot[b]; b = (b + 1) & (MIME_BUCKETS - 1)) {
+        const mime_entry& e = mime_types[mime_table.slot[b] - 1];
+        if (strlen(e.ext) == n && strncasecmp(e.ext, ext, n) == 0) {
+            return e.type;
+        }
+    }
+    return MIME_FALLBACK;
+}
+
+// 两位一组的十进制数字表，整数转字符串时每次除以100
+struct digit_pairs {
+    char data[200] = {};
+};
+
+constexpr digit_pairs build_digit_pairs() {
+    digit_pairs d;
+    for (int i = 0; i < 100; ++i) {
+        d.data[i * 2]     = '0' + i / 10;
+        d.data[i * 2 + 1] = '0' + i % 10;
+    }
+    return d;
+}
+
+constexpr digit_pairs decimal_digits = build_digit_pairs();
+
+// 无符号整数转十进制字符串，不写'\0'，返回写入的字节数，out 至少20字节
+inline size_t u64_to_dec(char* out, uint64_t v) {
+    char  buf[20];
+    char* p = buf + sizeof(buf);
+    while (v >= 100) {
+        const char* d = decimal_digits.data + (v % 100) * 2;
+        v /= 100;
+        *--p = d[1];
+        *--p = d[0];
+    }
+    if (v >= 10) {
+        *--p = decimal_digits.data[v * 2 + 1];
+        *--p = decimal_digits.data[v * 2];
+    } else {
+        *--p = '0' + v;
+    }
+    size_t n = buf + sizeof(buf) - p;
+    memcpy(out, p, n);
+    return n;
+}
+
+// 返回当前线程缓存的 "Date: ...\r\n" 头部，每个线程每秒最多重新格式化一次
+const char* http_date_header(size_t& len);
+
+#endif
@@ -2,6 +2,7 @@
 #define SEM_H
 
 #include <semaphore.h>
+#include <time.h>
 
 #include <exception>
 
@@ -15,6 +16,8 @@ public:
     ~sem();
     bool wait();  // 等待信号量
     bool post();  // 增加信号量
+
+    bool timewait(int ms_timeout);  // 等待信号量，超时返回false
 };
 
 inline sem::sem() {
@@ -29,4 +32,16 @@ inline bool sem::wait() { return sem_wait(&sema) == 0; }
 
 inline bool sem::post() { return sem_post(&sema) == 0; }
 
+inline bool sem::timewait(int ms_timeout) {
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    t.tv_sec += ms_timeout / 1000;
+    t.tv_nsec += (long)(ms_timeout % 1000) * 1000000;
+    if (t.tv_nsec >= 1000000000) {
+        t.tv_sec += 1;
+        t.tv_nsec -= 1000000000;
+    }
+    return sem_timedwait(&sema, &t) == 0;
+}
+
 #endif
\ No newline at end of file
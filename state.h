@@ -3,9 +3,11 @@
 
 // 解析客户端请求
 
-// HTTP请求方法，这里只支持GET
+// HTTP请求方法，本地只支持GET，其余方法只转发给反向代理的上游
 enum METHOD { GET = 0, POST, HEAD, PUT, DELETE, TRACE, OPTIONS, CONNECT };
 
+const char* const method_names[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT"};
+
 /*
     主状态机的状态:
         CHECK_STATE_REQUESTLINE:当前正在分析请求首行
@@ -34,6 +36,13 @@ enum LINE_STATUS { LINE_OK = 0, LINE_BAD, LINE_OPEN };
     NO_RESOURCE         :   表示服务器没有资源
     FORBIDDEN_REQUEST   :   表示客户对资源没有足够的访问权限
     FILE_REQUEST        :   文件请求,获取文件成功
+    BUNDLE_REQUEST      :   在静态资源包中命中了请求的资源
+    NOT_MODIFIED        :   客户端缓存的资源与服务器一致(ETag匹配)
+    STATS_REQUEST       :   请求运行时统计
+    PROXY_REQUEST       :   请求匹配反向代理规则，转发给上游
+    BAD_GATEWAY         :   连接上游失败或上游的响应有误
+    GATEWAY_TIMEOUT     :   上游在超时时间内没有响应
+    TOO_MANY_REQUESTS   :   客户端IP超过请求速率上限
     INTERNAL_ERROR      :   表示服务器内部错误
     CLOSED_CONNECTION   :   表示客户端已经关闭连接了
 */
@@ -44,6 +53,13 @@ enum HTTP_CODE {
     NO_RESOURCE,
     FORBIDDEN_REQUEST,
     FILE_REQUEST,
+    BUNDLE_REQUEST,
+    NOT_MODIFIED,
+    STATS_REQUEST,
+    PROXY_REQUEST,
+    BAD_GATEWAY,
+    GATEWAY_TIMEOUT,
+    TOO_MANY_REQUESTS,
     INTERNAL_ERROR,
     CLOSED_CONNECTION
 };
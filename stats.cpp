@@ -0,0 +1,190 @@
+#include "stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+// 在 init 之前记录的统计写入这里，保证 add 永远有槽可写
+static stats_segment fallback_segment;
+
+stats_segment*                server_stats::m_segment = &fallback_segment;
+char                          server_stats::m_name[64];
+thread_local stats_slot*      server_stats::t_slot    = nullptr;
+thread_local stats_hist_slot* server_stats::t_hist    = nullptr;
+
+bool server_stats::init(const char* name) {
+    bool  shared = true;
+    void* addr   = MAP_FAILED;
+    int   fd     = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        if (ftruncate(fd, sizeof(stats_segment)) == 0) {
+            addr = mmap(nullptr, sizeof(stats_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+    }
+    if (addr == MAP_FAILED) {
+        LOG_WARN("create stats segment %s failed, errno is: %d", name, errno);
+        shared = false;
+        addr   = mmap(nullptr, sizeof(stats_segment), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED) {
+            return false;
+        }
+    }
+
+    // 新映射的内存全为0，与原子变量的初始值一致
+    stats_segment* seg = (stats_segment*)addr;
+    memcpy(seg->magic, STATS_MAGIC, sizeof(STATS_MAGIC));
+    seg->version    = STATS_VERSION;
+    seg->stat_num   = STAT_NUM;
+    seg->slot_num   = STATS_MAX_SLOTS;
+    seg->pid        = getpid();
+    seg->start_time = time(nullptr);
+    seg->heartbeat.store(seg->start_time, std::memory_order_relaxed);
+    seg->slots_used.store(1, std::memory_order_release);
+    seg->hist_slots_used.store(1, std::memory_order_release);
+
+    // init 之前的计数并入0号槽，之后各线程重新分配槽；init 之前还没有请求，不必迁移直方图
+    int64_t before[STAT_NUM];
+    stats_sum(m_segment, before);
+    for (int i = 0; i < STAT_NUM; ++i) {
+        seg->slots[0].values[i].store(before[i], std::memory_order_relaxed);
+    }
+    m_segment = seg;
+    t_slot    = nullptr;
+    t_hist    = nullptr;
+    if (shared) {
+        snprintf(m_name, sizeof(m_name), "%s", name);
+    }
+    LOG_INFO("stats segment %s, shared: %d", name, shared);
+    return shared;
+}
+
+void server_stats::shutdown() {
+    if (m_name[0]) {
+        shm_unlink(m_name);
+        m_name[0] = '\0';
+    }
+}
+
+stats_slot* server_stats::local_slot() {
+    uint32_t i = m_segment->slots_used.fetch_add(1, std::memory_order_acq_rel);
+    if (i >= STATS_MAX_SLOTS) {
+        m_segment->slots_used.store(STATS_MAX_SLOTS, std::memory_order_release);
+        i = 0;
+    }
+    t_slot = &m_segment->slots[i];
+    return t_slot;
+}
+
+stats_hist_slot* server_stats::local_hist() {
+    uint32_t i = m_segment->hist_slots_used.fetch_add(1, std::memory_order_acq_rel);
+    if (i >= STATS_MAX_HIST_SLOTS) {
+        m_segment->hist_slots_used.store(STATS_MAX_HIST_SLOTS, std::memory_order_release);
+        i = 0;
+    }
+    t_hist = &m_segment->hist_slots[i];
+    return t_hist;
+}
+
+void server_stats::count_status(int status) {
+    add(STAT_REQUESTS);
+    switch (status) {
+        case 200:
+            add(STAT_STATUS_200);
+            break;
+        case 304:
+            add(STAT_STATUS_304);
+            break;
+        case 400:
+            add(STAT_STATUS_400);
+            break;
+        case 403:
+            add(STAT_STATUS_403);
+            break;
+        case 404:
+            add(STAT_STATUS_404);
+            break;
+        case 500:
+            add(STAT_STATUS_500);
+            break;
+        default:
+            add(STAT_STATUS_OTHER);
+            break;
+    }
+}
+
+// 与snprintf相同，缓冲区写满后继续累加所需长度，调用方据此判断是否被截断
+static void json_append(char* buf, size_t len, size_t& n, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int ret = n < len ? vsnprintf(buf + n, len - n, fmt, args) : vsnprintf(nullptr, 0, fmt, args);
+    va_end(args);
+    if (ret > 0) {
+        n += ret;
+    }
+}
+
+size_t server_stats::render_json(char* buf, size_t len) {
+    int64_t values[STAT_NUM];
+    stats_sum(m_segment, values);
+
+    size_t n = 0;
+    json_append(buf, len, n, "{\"uptime\":%ld", (long)(time(nullptr) - m_segment->start_time));
+    for (int i = 0; i < STAT_NUM; ++i) {
+        json_append(buf, len, n, ",\"%s\":%lld", stat_names[i], (long long)values[i]);
+    }
+
+    // 各阶段耗时的分位数，单位纳秒
+    json_append(buf, len, n, ",\"stages_ns\":{");
+    uint64_t counts[HIST_BUCKETS];
+    for (int i = 0; i < STAGE_NUM; ++i) {
+        uint64_t max   = stats_hist_sum(m_segment, i, counts);
+        uint64_t total = 0;
+        for (int b = 0; b < HIST_BUCKETS; ++b) {
+            total += counts[b];
+        }
+        json_append(buf, len, n,
+                    "%s\"%s\":{\"count\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}",
+                    i ? "," : "", stage_names[i], (unsigned long long)total,
+                    (unsigned long long)hist_percentile(counts, 0.5), (unsigned long long)hist_percentile(counts, 0.9),
+                    (unsigned long long)hist_percentile(counts, 0.99),
+                    (unsigned long long)hist_percentile(counts, 0.999), (unsigned long long)max);
+    }
+    json_append(buf, len, n, "}");
+
+    // 各阶段的硬件计数器总数、IPC以及平均每个请求的计数
+    uint32_t mask = m_segment->perf_mask;
+    if (mask) {
+        uint64_t perf[PERF_STAGE_NUM][PERF_EVENT_NUM];
+        stats_perf_sum(m_segment, perf);
+        double requests = values[STAT_REQUESTS] > 0 ? (double)values[STAT_REQUESTS] : 1;
+        json_append(buf, len, n, ",\"perf\":{\"user_only\":%s", m_segment->perf_user_only ? "true" : "false");
+        for (int st = 0; st < PERF_STAGE_NUM; ++st) {
+            json_append(buf, len, n, ",\"%s\":{", perf_stage_names[st]);
+            for (int e = 0, first = 1; e < PERF_EVENT_NUM; ++e) {
+                if (mask & (1u << e)) {
+                    json_append(buf, len, n, "%s\"%s\":%llu,\"%s_per_req\":%.1f", first ? "" : ",",
+                                perf_event_names[e], (unsigned long long)perf[st][e], perf_event_names[e],
+                                perf[st][e] / requests);
+                    first = 0;
+                }
+            }
+            if ((mask & (1u << PERF_CYCLES)) && (mask & (1u << PERF_INSTRUCTIONS))) {
+                uint64_t cycles = perf[st][PERF_CYCLES];
+                json_append(buf, len, n, ",\"ipc\":%.3f",
+                            cycles ? (double)perf[st][PERF_INSTRUCTIONS] / cycles : 0.0);
+            }
+            json_append(buf, len, n, "}");
+        }
+        json_append(buf, len, n, "}");
+    }
+    json_append(buf, len, n, "}\n");
+    return n;
+}
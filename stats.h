@@ -0,0 +1,256 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <atomic>
+
+#include "histogram.h"
+
+/*
+    运行时统计:
+        每个线程独占一个按缓存行对齐的计数槽，只有该线程写入，写入是普通的load+store，不需要锁也不需要原子加；
+        读取方把所有槽相加得到总数。增减发生在不同线程上的量(如连接数)按增量记录，相加后即为当前值。
+    所有槽放在 /dev/shm 下的共享内存段中，tools/stats_cli 可以在不打扰服务器的情况下直接读取。
+    各处理阶段的耗时同样按线程记录在直方图槽中，见 trace.h；开启硬件计数器时各阶段的计数也记录在计数槽中，见 perfctr.h。
+*/
+
+// 计数器与量规，顺序与 stat_names 一致
+enum stat_id {
+    STAT_ACCEPTS = 0,      // 接受的连接数
+    STAT_REQUESTS,         // 生成响应的请求数
+    STAT_STATUS_200,       // 各状态码的响应数
+    STAT_STATUS_304,
+    STAT_STATUS_400,
+    STAT_STATUS_403,
+    STAT_STATUS_404,
+    STAT_STATUS_500,
+    STAT_STATUS_OTHER,
+    STAT_BYTES_IN,         // 读入的字节数
+    STAT_BYTES_OUT,        // 发出的字节数
+    STAT_TIMEOUTS,         // 超时关闭的连接数
+    STAT_SHED,             // 因过载而拒绝的连接或请求数
+    STAT_ACTIVE_CONNS,     // 量规：当前连接数
+    STAT_KEEPALIVE_CONNS,  // 量规：当前处于长连接复用状态的连接数
+    STAT_QUEUE_DEPTH,      // 量规：等待工作线程处理的请求数
+    STAT_NUM
+};
+
+const stat_id STAT_FIRST_GAUGE = STAT_ACTIVE_CONNS;
+
+const char* const stat_names[STAT_NUM] = {
+    "accepts",    "requests",   "status_200",   "status_304", "status_400", "status_403",
+    "status_404", "status_500", "status_other", "bytes_in",   "bytes_out",  "timeouts",
+    "shed",       "active_conns", "keepalive_conns", "queue_depth",
+};
+
+// 请求的处理阶段，每个阶段一个耗时直方图，顺序与 stage_names 一致
+enum stage_id {
+    STAGE_READ = 0,  // 请求开始到读完请求
+    STAGE_DISPATCH,  // 读完请求到放入任务队列
+    STAGE_QUEUE,     // 在任务队列中等待工作线程
+    STAGE_PARSE,     // 解析请求
+    STAGE_FETCH,     // 查找文件并生成响应头
+    STAGE_WAIT_OUT,  // 响应就绪到发出第一个字节，即等待EPOLLOUT
+    STAGE_SEND,      // 发出第一个字节到最后一个字节
+    STAGE_TOTAL,     // 请求开始到发完响应
+    STAGE_NUM
+};
+
+const char* const stage_names[STAGE_NUM] = {
+    "read", "dispatch", "queue", "parse", "fetch", "wait_out", "send", "total",
+};
+
+// 硬件性能计数器，顺序与 perf_event_names 一致
+enum perf_event_id {
+    PERF_CYCLES = 0,        // CPU周期
+    PERF_INSTRUCTIONS,      // 退休的指令数
+    PERF_CACHE_MISSES,      // 末级缓存未命中
+    PERF_BRANCH_MISSES,     // 分支预测失败
+    PERF_CONTEXT_SWITCHES,  // 上下文切换，软件事件
+    PERF_EVENT_NUM
+};
+
+const char* const perf_event_names[PERF_EVENT_NUM] = {
+    "cycles", "instructions", "cache_misses", "branch_misses", "context_switches",
+};
+
+// 计数器增量归属的处理阶段，顺序与 perf_stage_names 一致
+enum perf_stage_id {
+    PERF_STAGE_LOOP = 0,  // 事件循环：读请求、接受连接、分发任务、处理定时器
+    PERF_STAGE_PARSE,     // 工作线程解析请求
+    PERF_STAGE_RESPONSE,  // 工作线程查找文件、生成响应
+    PERF_STAGE_WRITE,     // 事件循环发送响应
+    PERF_STAGE_NUM
+};
+
+const perf_stage_id PERF_STAGE_NONE = PERF_STAGE_NUM;  // 不计入任何阶段，如阻塞在 epoll_wait 或任务队列上
+
+const char* const perf_stage_names[PERF_STAGE_NUM] = {
+    "loop", "parse", "response", "write",
+};
+
+const char     STATS_MAGIC[8]       = {'W', 'S', 'S', 'T', 'A', 'T', 'S', '\0'};
+const uint32_t STATS_VERSION        = 4;
+const int      STATS_MAX_SLOTS      = 64;  // 0号槽由超出数量的线程共享，使用原子加
+const int      STATS_MAX_HIST_SLOTS = 8;   // 记录直方图的线程较少，同样由0号槽兜底
+
+struct alignas(64) stats_slot {
+    std::atomic<uint64_t> values[STAT_NUM];
+    std::atomic<uint64_t> perf[PERF_STAGE_NUM][PERF_EVENT_NUM];  // 各阶段的计数器增量
+};
+
+// 各阶段的耗时直方图，单位纳秒
+struct alignas(64) stats_hist_slot {
+    std::atomic<uint64_t> counts[STAGE_NUM][HIST_BUCKETS];
+    std::atomic<uint64_t> max[STAGE_NUM];
+};
+
+struct stats_segment {
+    char                  magic[8];
+    uint32_t              version;
+    uint32_t              stat_num;
+    uint32_t              slot_num;
+    int32_t               pid;
+    uint64_t              start_time;  // 服务器启动时间，秒
+    std::atomic<uint64_t> heartbeat;       // 定时器tick最近一次更新的时间，秒；长时间不变说明进程已退出或卡住
+    uint32_t              tick_interval;   // 定时器tick的间隔，秒
+    uint32_t              perf_mask;       // 可用的硬件计数器，按 perf_event_id 的位，0表示未开启
+    uint32_t              perf_user_only;  // 计数器是否只统计用户态
+    std::atomic<uint32_t> slots_used;       // 已分配的槽数，含0号槽
+    std::atomic<uint32_t> hist_slots_used;  // 已分配的直方图槽数，含0号槽
+    alignas(64) stats_slot slots[STATS_MAX_SLOTS];
+    stats_hist_slot hist_slots[STATS_MAX_HIST_SLOTS];
+};
+
+// 把所有槽相加，量规按有符号数解释
+inline void stats_sum(const stats_segment* seg, int64_t out[STAT_NUM]) {
+    uint32_t used = seg->slots_used.load(std::memory_order_acquire);
+    if (used > STATS_MAX_SLOTS) {
+        used = STATS_MAX_SLOTS;
+    }
+    for (int i = 0; i < STAT_NUM; ++i) {
+        uint64_t sum = 0;
+        for (uint32_t s = 0; s < used; ++s) {
+            sum += seg->slots[s].values[i].load(std::memory_order_relaxed);
+        }
+        out[i] = (int64_t)sum;
+    }
+}
+
+// 把所有槽中各阶段的计数器增量相加
+inline void stats_perf_sum(const stats_segment* seg, uint64_t out[PERF_STAGE_NUM][PERF_EVENT_NUM]) {
+    uint32_t used = seg->slots_used.load(std::memory_order_acquire);
+    if (used > STATS_MAX_SLOTS) {
+        used = STATS_MAX_SLOTS;
+    }
+    for (int st = 0; st < PERF_STAGE_NUM; ++st) {
+        for (int e = 0; e < PERF_EVENT_NUM; ++e) {
+            uint64_t sum = 0;
+            for (uint32_t s = 0; s < used; ++s) {
+                sum += seg->slots[s].perf[st][e].load(std::memory_order_relaxed);
+            }
+            out[st][e] = sum;
+        }
+    }
+}
+
+// 把所有直方图槽中某个阶段的计数相加，返回最大值
+inline uint64_t stats_hist_sum(const stats_segment* seg, int stage, uint64_t counts[HIST_BUCKETS]) {
+    uint32_t used = seg->hist_slots_used.load(std::memory_order_acquire);
+    if (used > STATS_MAX_HIST_SLOTS) {
+        used = STATS_MAX_HIST_SLOTS;
+    }
+    uint64_t max = 0;
+    for (int i = 0; i < HIST_BUCKETS; ++i) {
+        counts[i] = 0;
+    }
+    for (uint32_t s = 0; s < used; ++s) {
+        const stats_hist_slot& h = seg->hist_slots[s];
+        for (int i = 0; i < HIST_BUCKETS; ++i) {
+            counts[i] += h.counts[stage][i].load(std::memory_order_relaxed);
+        }
+        uint64_t m = h.max[stage].load(std::memory_order_relaxed);
+        max        = m > max ? m : max;
+    }
+    return max;
+}
+
+class server_stats {
+public:
+    // 创建名为 name 的共享内存段，失败时退化为进程内的匿名内存，统计仍可通过 /__stats 读取；
+    // 需在创建其他线程之前调用
+    static bool init(const char* name);
+
+    // 正常退出时删除共享内存段，stats_cli 不会读到已退出进程留下的数据
+    static void shutdown();
+
+    // 在每次定时器tick中调用，interval 为tick的间隔，秒
+    static void heartbeat(int interval) {
+        m_segment->tick_interval = interval;
+        m_segment->heartbeat.store(time(nullptr), std::memory_order_relaxed);
+    }
+
+    static void add(stat_id id, int64_t n = 1) {
+        stats_slot* s = t_slot ? t_slot : local_slot();
+        if (s == &m_segment->slots[0]) {
+            s->values[id].fetch_add(n, std::memory_order_relaxed);
+        } else {
+            s->values[id].store(s->values[id].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+    }
+
+    static void count_status(int status);
+
+    // 把一段计数器增量计入 stage 阶段
+    static void add_perf(perf_stage_id stage, const uint64_t delta[PERF_EVENT_NUM]) {
+        stats_slot* s = t_slot ? t_slot : local_slot();
+        for (int e = 0; e < PERF_EVENT_NUM; ++e) {
+            std::atomic<uint64_t>& v = s->perf[stage][e];
+            if (s == &m_segment->slots[0]) {
+                v.fetch_add(delta[e], std::memory_order_relaxed);
+            } else {
+                v.store(v.load(std::memory_order_relaxed) + delta[e], std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // 记录可用的硬件计数器，由 perf_counters::init 调用
+    static void set_perf(uint32_t mask, bool user_only) {
+        m_segment->perf_mask      = mask;
+        m_segment->perf_user_only = user_only;
+    }
+
+    // 记录一个阶段的耗时，单位纳秒
+    static void record(stage_id stage, uint64_t ns) {
+        stats_hist_slot*       h = t_hist ? t_hist : local_hist();
+        std::atomic<uint64_t>& c = h->counts[stage][hist_index(ns)];
+        if (h == &m_segment->hist_slots[0]) {
+            c.fetch_add(1, std::memory_order_relaxed);
+            uint64_t m = h->max[stage].load(std::memory_order_relaxed);
+            while (ns > m && !h->max[stage].compare_exchange_weak(m, ns, std::memory_order_relaxed)) {
+            }
+        } else {
+            c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            if (ns > h->max[stage].load(std::memory_order_relaxed)) {
+                h->max[stage].store(ns, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // 以JSON格式输出当前统计，与snprintf一样返回完整输出所需的字节数(不含'\0')，不小于len说明被截断
+    static size_t render_json(char* buf, size_t len);
+
+private:
+    static stats_slot*      local_slot();  // 为当前线程分配槽
+    static stats_hist_slot* local_hist();  // 为当前线程分配直方图槽
+
+    static stats_segment*                m_segment;
+    static char                          m_name[64];  // 共享内存段的名称，退化为匿名内存时为空
+    static thread_local stats_slot*      t_slot;
+    static thread_local stats_hist_slot* t_hist;
+};
+
+#endif
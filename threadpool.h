@@ -5,47 +5,44 @@
 #include <stdio.h>
 
 #include <exception>
-#include <queue>
+#include <utility>
 
-#include "locker.h"
-#include "sem.h"
+#include "blockqueue.h"
 #include "log.h"
 
 /*
     int             num_of_thread;         :    线程数量
     pthread_t*      threads;               :    线程池数组
-    int             max_num_of_task;       :    请求队列大小
-    std::queue<T*>  workqueue;             :    请求队列
-    locker          queuelocker;           :    互斥锁
-    sem             queuestat;             :    信号量，用于判断是否有任务需要处理
+    blockqueue<T*>  workqueue;             :    有界的请求队列，容量由构造函数的max给出，自带互斥锁与条件变量
     bool            is_need_stop;          :    是否结束线程
+    int             spin_us;               :    取不到任务时先在锁外自旋的微秒数(pop_spin)，仍为空才阻塞，0表示直接阻塞
+    handler                                :    线程处理任务时调用的成员函数，默认为process
 */
 
 // 线程池模板类
-template <typename T>
+template <typename T, void (T::*handler)() = &T::process>
 class threadpool {
 private:
-    int               num_of_thread;
-    pthread_t*        threads;
-    long unsigned int max_num_of_task;
-    std::queue<T*>    workqueue;
-    locker            queuelocker;
-    sem               queuestat;
-    bool              is_need_stop;
+    int            num_of_thread;
+    pthread_t*     threads;
+    blockqueue<T*> workqueue;
+    bool           is_need_stop;
+    int            spin_us;  // 队列为空时先自旋的微秒数，0表示直接阻塞
 
 public:
-    threadpool(int num = 8, int max = 10000);
+    threadpool(int num = 8, int max = 10000, int spin = 0);
     ~threadpool();
 
     static void* worker(void*);
 
     bool append(T*);
+    int  append_bulk(T** tasks, int n);  // 一次加锁放入多个任务，返回放入的个数
     void run();
 };
 
-template <typename T>
-threadpool<T>::threadpool(int num, int max)
-    : num_of_thread(num), threads(nullptr), max_num_of_task(max), is_need_stop(false) {
+template <typename T, void (T::*handler)()>
+threadpool<T, handler>::threadpool(int num, int max, int spin)
+    : num_of_thread(num), threads(nullptr), workqueue(max > 0 ? max : 1), is_need_stop(false), spin_us(spin) {
     if (num <= 0 || max <= 0) {
         throw std::exception();
     }
@@ -73,58 +70,46 @@ threadpool<T>::threadpool(int num, int max)
     }
 }
 
-template <typename T>
-threadpool<T>::~threadpool() {
+template <typename T, void (T::*handler)()>
+threadpool<T, handler>::~threadpool() {
     delete[] threads;
     is_need_stop = true;
 }
 
-template <typename T>
-bool threadpool<T>::append(T* task) {
-    queuelocker.lock();
-    if (workqueue.size() >= max_num_of_task) {
-        queuelocker.unlock();
-        return false;
-    }
+template <typename T, void (T::*handler)()>
+bool threadpool<T, handler>::append(T* task) {
+    return workqueue.push(std::move(task));
+}
 
-    workqueue.push(task);
-    queuelocker.unlock();
-    queuestat.post();  // 信号量的V操作
-    return true;
+template <typename T, void (T::*handler)()>
+int threadpool<T, handler>::append_bulk(T** tasks, int n) {
+    return workqueue.push_bulk(tasks, n);
 }
 
-template <typename T>
-void* threadpool<T>::worker(void* arg) {
+template <typename T, void (T::*handler)()>
+void* threadpool<T, handler>::worker(void* arg) {
     threadpool* pool = (threadpool*)arg;
     pool->run();
     return pool;
 }
 
-template <typename T>
-void threadpool<T>::run() {
+template <typename T, void (T::*handler)()>
+void threadpool<T, handler>::run() {
     // 线程池一旦对象析构，stop设置为true，所有子线程执行结束
     while (!is_need_stop) {
-        // 先加锁后wait，如果wait阻塞了，那锁也不释放，造成死锁
-        queuestat.wait();  // 信号量的P操作
-        queuelocker.lock();
-
-        // 防止虚假唤醒
-        if (workqueue.empty()) {
-            queuelocker.unlock();
+        // 队列为空时(自旋一段时间后)阻塞在条件变量上，每次只取一个任务，其余任务留给其他线程
+        T* task = nullptr;
+        if (!workqueue.pop_spin(task, spin_us)) {
             continue;
         }
 
-        T* task = workqueue.front();
-        workqueue.pop();
-        queuelocker.unlock();
-
         // 如果传进的连接task本身就是个null的话，必须要判断
         if (!task) {
             continue;
         }
 
-        // process函数在taskection类
-        task->process();
+        // 默认调用connection类的process函数
+        (task->*handler)();
     }
 }
 
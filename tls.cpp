@@ -0,0 +1,186 @@
+#include "tls.h"
+
+#include <errno.h>
+#include <limits.h>
+
+#include "log.h"
+
+tls_stats tls_context::stats;
+
+#ifdef WITH_TLS
+
+#include <openssl/bio.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+tls_context::tls_context() : m_ctx(nullptr) {}
+
+tls_context::~tls_context() {
+    if (m_ctx) {
+        SSL_CTX_free(m_ctx);
+    }
+}
+
+bool tls_context::open(const char* cert_file, const char* key_file) {
+    m_ctx = SSL_CTX_new(TLS_server_method());
+    if (!m_ctx) {
+        return false;
+    }
+    SSL_CTX_set_min_proto_version(m_ctx, TLS1_2_VERSION);
+
+    // 发送路径会在EAGAIN之后从新的位置重试同一段数据，长连接空闲时释放读写缓冲
+    SSL_CTX_set_mode(m_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                                SSL_MODE_RELEASE_BUFFERS);
+
+    // 会话恢复只靠无状态票据，票据密钥在进程启动时随机生成，服务端不需要会话缓存
+    SSL_CTX_set_session_cache_mode(m_ctx, SSL_SESS_CACHE_OFF);
+    SSL_CTX_set_num_tickets(m_ctx, 1);
+
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_CTX_set_options(m_ctx, SSL_OP_ENABLE_KTLS);
+#endif
+
+    if (SSL_CTX_use_certificate_chain_file(m_ctx, cert_file) != 1 ||
+        SSL_CTX_use_PrivateKey_file(m_ctx, key_file, SSL_FILETYPE_PEM) != 1 || SSL_CTX_check_private_key(m_ctx) != 1) {
+        LOG_ERROR("load tls certificate %s or key %s failed, error is: %lu", cert_file, key_file, ERR_get_error());
+        return false;
+    }
+    LOG_INFO("tls enabled, certificate %s", cert_file);
+    return true;
+}
+
+tls_session* tls_context::create(int fd) {
+    SSL* ssl = SSL_new(m_ctx);
+    if (!ssl) {
+        return nullptr;
+    }
+    SSL_set_fd(ssl, fd);
+    SSL_set_accept_state(ssl);
+    return new tls_session(ssl);
+}
+
+tls_session::tls_session(SSL* ssl) : m_ssl(ssl), m_established(false), m_ktls_send(false) {}
+
+tls_session::~tls_session() { SSL_free(m_ssl); }
+
+tls_status tls_session::handshake() {
+    int ret = SSL_do_handshake(m_ssl);
+    if (ret != 1) {
+        switch (SSL_get_error(m_ssl, ret)) {
+            case SSL_ERROR_WANT_READ:
+                return TLS_WANT_READ;
+            case SSL_ERROR_WANT_WRITE:
+                return TLS_WANT_WRITE;
+            default:
+                ++tls_context::stats.failures;
+                ERR_clear_error();
+                return TLS_ERROR;
+        }
+    }
+
+    m_established = true;
+    ++tls_context::stats.handshakes;
+    if (SSL_session_reused(m_ssl)) {
+        ++tls_context::stats.resumed;
+    }
+#ifdef BIO_get_ktls_send
+    m_ktls_send = BIO_get_ktls_send(SSL_get_wbio(m_ssl));
+    if (m_ktls_send) {
+        ++tls_context::stats.ktls_send;
+    }
+    if (BIO_get_ktls_recv(SSL_get_rbio(m_ssl))) {
+        ++tls_context::stats.ktls_recv;
+    }
+#endif
+    return TLS_DONE;
+}
+
+ssize_t tls_session::read(void* buf, size_t len) {
+    int ret = SSL_read(m_ssl, buf, len > INT_MAX ? INT_MAX : len);
+    if (ret > 0) {
+        return ret;
+    }
+    switch (SSL_get_error(m_ssl, ret)) {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_ZERO_RETURN:
+            return 0;
+        default:
+            ERR_clear_error();
+            errno = EIO;
+            return -1;
+    }
+}
+
+// 逐段SSL_write，部分写入的约定与writev相同；EAGAIN之后调用者必须从同一位置重试
+ssize_t tls_session::writev(const struct iovec* iov, int count) {
+    ssize_t total = 0;
+    for (int i = 0; i < count; ++i) {
+        const char* p    = (const char*)iov[i].iov_base;
+        size_t      left = iov[i].iov_len;
+        while (left > 0) {
+            int ret = SSL_write(m_ssl, p, left > INT_MAX ? INT_MAX : left);
+            if (ret <= 0) {
+                int err = SSL_get_error(m_ssl, ret);
+                if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) {
+                    if (total > 0) {
+                        return total;
+                    }
+                    errno = EAGAIN;
+                    return -1;
+                }
+                ERR_clear_error();
+                errno = EPIPE;
+                return -1;
+            }
+            p += ret;
+            left -= ret;
+            total += ret;
+        }
+    }
+    return total;
+}
+
+void tls_session::shutdown() {
+    if (m_established) {
+        SSL_shutdown(m_ssl);
+    }
+    ERR_clear_error();
+}
+
+#else
+
+// 未启用TLS时的空实现，tls_context::open 总是失败，连接上不会有TLS会话
+
+tls_context::tls_context() : m_ctx(nullptr) {}
+
+tls_context::~tls_context() {}
+
+bool tls_context::open(const char*, const char*) {
+    LOG_ERROR("tls is not compiled in, rebuild with -DWITH_TLS -lssl -lcrypto");
+    return false;
+}
+
+tls_session* tls_context::create(int) { return nullptr; }
+
+tls_session::tls_session(ssl_st* ssl) : m_ssl(ssl), m_established(false), m_ktls_send(false) {}
+
+tls_session::~tls_session() {}
+
+tls_status tls_session::handshake() { return TLS_ERROR; }
+
+ssize_t tls_session::read(void*, size_t) {
+    errno = EIO;
+    return -1;
+}
+
+ssize_t tls_session::writev(const struct iovec*, int) {
+    errno = EIO;
+    return -1;
+}
+
+void tls_session::shutdown() {}
+
+#endif
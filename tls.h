@@ -0,0 +1,75 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <atomic>
+
+/*
+    TLS终止:
+        编译时加 -DWITH_TLS 并链接 -lssl -lcrypto 才启用，否则 tls_context::open 总是失败。
+        握手由OpenSSL在事件循环中非阻塞地完成，支持TLS1.2与TLS1.3，使用无状态会话票据恢复会话，服务端不保存会话。
+        握手完成后OpenSSL把对称加密交给内核(kTLS，TCP_ULP "tls")，此后发送方向就是普通套接字，
+        原有的 writev 发送mmap文件、splice转发上游响应的路径都不用改；接收方向仍经过 SSL_read，由它处理内核上报的控制消息。
+        内核没有tls模块或OpenSSL未编译kTLS时退回用户态加解密，发送经 SSL_write 复制一次，功能不变。
+*/
+
+struct ssl_st;
+struct ssl_ctx_st;
+
+// 握手推进一步的结果
+enum tls_status { TLS_DONE = 0, TLS_WANT_READ, TLS_WANT_WRITE, TLS_ERROR };
+
+// TLS计数器，在定时器tick中输出到日志
+struct tls_stats {
+    std::atomic<unsigned long> handshakes;  // 完成的握手数
+    std::atomic<unsigned long> resumed;     // 其中通过会话票据恢复的
+    std::atomic<unsigned long> ktls_send;   // 发送方向交给内核加密的连接数
+    std::atomic<unsigned long> ktls_recv;   // 接收方向交给内核解密的连接数
+    std::atomic<unsigned long> failures;    // 握手失败数
+};
+
+class tls_session;
+
+class tls_context {
+public:
+    tls_context();
+    ~tls_context();
+
+    // 加载证书链与私钥，两者可以在同一个PEM文件中
+    bool open(const char* cert_file, const char* key_file);
+
+    // 为新接受的连接创建会话，失败返回nullptr
+    tls_session* create(int fd);
+
+    static tls_stats stats;
+
+private:
+    ssl_ctx_st* m_ctx;
+};
+
+// 一个连接上的TLS会话，只在事件循环中使用
+class tls_session {
+public:
+    explicit tls_session(ssl_st* ssl);
+    ~tls_session();
+
+    tls_status handshake();                   // 推进握手
+    bool       handshaking() const { return !m_established; }
+    bool       ktls_send() const { return m_ktls_send; }  // 发送方向已交给内核，可以直接写套接字
+
+    // 与 recv/writev 的约定相同：出错返回-1并设置errno，暂时不能读写时errno为EAGAIN，对方关闭时读返回0
+    ssize_t read(void* buf, size_t len);
+    ssize_t writev(const struct iovec* iov, int count);
+
+    void shutdown();  // 尽力发出close_notify，不等待对方回应
+
+private:
+    ssl_st* m_ssl;
+    bool    m_established;
+    bool    m_ktls_send;
+};
+
+#endif
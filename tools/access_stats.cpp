@@ -0,0 +1,145 @@
+/*
+    离线统计二进制访问日志
+    编译：g++ -O2 tools/access_stats.cpp -o access_stats -I.
+    用法：./access_stats [-j] 访问日志...
+    默认按 url+状态码 分组输出请求数、字节数以及首字节时间、总耗时的分位数；
+    -j 把每条记录转换成一行JSON输出，便于交给其他工具处理。
+*/
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "accesslog.h"
+
+struct group_stats {
+    unsigned long         count = 0;
+    unsigned long long    bytes = 0;
+    std::vector<uint32_t> ttfb;
+    std::vector<uint32_t> total;
+};
+
+static std::map<std::pair<std::string, int>, group_stats> groups;  // (url, 状态码) -> 统计
+
+// 取排好序的样本中的分位数，q 取值 0~1
+static uint32_t percentile(const std::vector<uint32_t>& sorted, double q) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t i = (size_t)(q * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+static void print_json_string(const std::string& s) {
+    putchar('"');
+    for (size_t i = 0; i < s.size(); ++i) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\') {
+            printf("\\%c", c);
+        } else if (c < 0x20) {
+            printf("\\u%04x", c);
+        } else {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+static void print_json(const access_record& rec, const std::string& url) {
+    char addr[INET6_ADDRSTRLEN] = "-";
+    if (rec.family == AF_INET || rec.family == AF_INET6) {
+        inet_ntop(rec.family, rec.addr, addr, sizeof(addr));
+    }
+    printf("{\"time_ns\":%llu,\"client\":\"%s\",\"port\":%u,\"method\":%u,\"url\":", (unsigned long long)rec.time_ns,
+           addr, rec.port, rec.method);
+    print_json_string(url);
+    printf(",\"status\":%u,\"bytes\":%llu,\"keep_alive\":%s,\"ttfb_us\":%u,\"total_us\":%u}\n", rec.status,
+           (unsigned long long)rec.bytes_sent, rec.keep_alive ? "true" : "false", rec.ttfb_us, rec.total_us);
+}
+
+static bool read_log(const char* path, bool json) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        perror(path);
+        return false;
+    }
+    char     magic[sizeof(ACCESS_MAGIC)];
+    uint32_t version;
+    if (fread(magic, sizeof(magic), 1, fp) != 1 || memcmp(magic, ACCESS_MAGIC, sizeof(magic)) != 0 ||
+        fread(&version, sizeof(version), 1, fp) != 1 || version != ACCESS_VERSION) {
+        fprintf(stderr, "%s is not an access log or has a wrong version\n", path);
+        fclose(fp);
+        return false;
+    }
+
+    access_record rec;
+    std::string   url;
+    while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+        url.resize(rec.url_len);
+        if (rec.url_len && fread(&url[0], 1, rec.url_len, fp) != rec.url_len) {
+            fprintf(stderr, "%s: truncated record\n", path);
+            break;
+        }
+        if (json) {
+            print_json(rec, url);
+            continue;
+        }
+        group_stats& g = groups[std::make_pair(url, (int)rec.status)];
+        ++g.count;
+        g.bytes += rec.bytes_sent;
+        g.ttfb.push_back(rec.ttfb_us);
+        g.total.push_back(rec.total_us);
+    }
+    fclose(fp);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    bool json  = false;
+    int  first = 1;
+    if (argc > 1 && strcmp(argv[1], "-j") == 0) {
+        json  = true;
+        first = 2;
+    }
+    if (first >= argc) {
+        printf("请按照如下格式运行：%s [-j] 访问日志...\n", basename(argv[0]));
+        return 1;
+    }
+    for (int i = first; i < argc; ++i) {
+        if (!read_log(argv[i], json)) {
+            return 1;
+        }
+    }
+    if (json) {
+        return 0;
+    }
+
+    // 请求数多的分组排在前面
+    std::vector<std::pair<std::string, int> > keys;
+    for (std::map<std::pair<std::string, int>, group_stats>::iterator it = groups.begin(); it != groups.end(); ++it) {
+        keys.push_back(it->first);
+    }
+    std::stable_sort(keys.begin(), keys.end(),
+                     [](const std::pair<std::string, int>& a, const std::pair<std::string, int>& b) {
+                         return groups[a].count > groups[b].count;
+                     });
+
+    printf("%-32s %6s %8s %12s %9s %9s %9s %9s %9s %9s\n", "url", "status", "count", "bytes", "ttfb_p50",
+           "ttfb_p99", "p50_us", "p90_us", "p99_us", "p999_us");
+    for (size_t i = 0; i < keys.size(); ++i) {
+        group_stats& g = groups[keys[i]];
+        std::sort(g.ttfb.begin(), g.ttfb.end());
+        std::sort(g.total.begin(), g.total.end());
+        printf("%-32s %6d %8lu %12llu %9u %9u %9u %9u %9u %9u\n", keys[i].first.c_str(), keys[i].second, g.count,
+               g.bytes, percentile(g.ttfb, 0.5), percentile(g.ttfb, 0.99), percentile(g.total, 0.5),
+               percentile(g.total, 0.9), percentile(g.total, 0.99), percentile(g.total, 0.999));
+    }
+    return 0;
+}
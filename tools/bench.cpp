@@ -0,0 +1,636 @@
+/*
+    基于epoll的HTTP压测工具，与服务器在同一台机器上运行，用来验证每一次性能改动
+    编译：g++ -O2 tools/bench.cpp -o bench -I.
+    用法：./bench [选项] 目标
+        目标          host:port，或 unix:/路径、unix:@抽象名
+        -c 连接数     并发连接数，默认16
+        -d 秒数       压测时长，默认10
+        -r 速率       开环模式每秒发出的请求数；不指定为闭环模式，每个连接收到响应后立即发下一个
+        -p 深度       每个连接的流水线深度，默认1
+        -k 0|1        1为长连接(默认)，0为每个请求新建连接
+        -f 模板文件   请求模板，如 httpget.txt，可指定多次，轮流发送；换行会统一成\r\n
+        -u url        替换模板中的请求路径，默认模板为 GET /index.html
+        -s 连接数     其中有多少个慢速客户端，它们按 -S 的节奏一点点发送请求、读取响应，不计入延迟统计
+        -S 字节:毫秒  慢速客户端每隔多少毫秒收发多少字节，默认 1:100
+        -t 毫秒       请求超时，默认5000
+        -j            最后以一行JSON输出结果，便于比较不同版本
+    延迟统计:
+        开环模式下延迟从请求"计划发出"的时刻算起，连接忙或服务器变慢导致的排队时间也计入，
+        即修正了协调遗漏(coordinated omission)；同时给出从实际发出算起的服务时间。
+        闭环模式下两者相同，结果只反映服务器在该并发度下的服务时间。
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "histogram.h"
+
+static uint64_t now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+struct inflight {
+    uint64_t sched_ns;  // 计划发出的时间
+    uint64_t sent_ns;   // 实际开始发送的时间
+};
+
+struct bench_conn {
+    int                  fd;
+    bool                 connected;
+    bool                 slow;
+    std::string          out;       // 待发送的数据
+    size_t               out_off;   // 已发送的位置
+    std::deque<inflight> requests;  // 已发出、尚未收到响应的请求
+    uint64_t             last_progress_ns;
+
+    // 响应解析
+    bool        in_body;
+    std::string head;
+    size_t      body_left;
+};
+
+struct bench_options {
+    std::string              target;
+    int                      conns       = 16;
+    int                      duration    = 10;
+    double                   rate        = 0;
+    int                      depth       = 1;
+    bool                     keep_alive  = true;
+    int                      slow_conns  = 0;
+    size_t                   slow_bytes  = 1;
+    int                      slow_ms     = 100;
+    int                      timeout_ms  = 5000;
+    bool                     json        = false;
+    const char*              url         = nullptr;
+    std::vector<std::string> templates;
+};
+
+static bench_options            opt;
+static sockaddr_storage         target_addr;
+static socklen_t                target_len;
+static std::vector<std::string> requests;  // 处理好的请求报文
+static size_t                   next_request = 0;
+static int                      epfd;
+static std::vector<bench_conn>  conns;
+
+// 统计
+static uint64_t      latency[HIST_BUCKETS];  // 从计划发出算起
+static uint64_t      service[HIST_BUCKETS];  // 从实际发出算起
+static uint64_t      latency_max = 0, service_max = 0;
+static unsigned long completed = 0, slow_completed = 0, errors = 0, timeouts = 0, connects = 0;
+static unsigned long status_2xx = 0, status_3xx = 0, status_4xx = 0, status_5xx = 0;
+static unsigned long long bytes_read = 0;
+
+static bool parse_target(const std::string& target) {
+    memset(&target_addr, 0, sizeof(target_addr));
+    if (target.compare(0, 5, "unix:") == 0) {
+        sockaddr_un* un = (sockaddr_un*)&target_addr;
+        std::string  path = target.substr(5);
+        if (path.empty() || path.size() >= sizeof(un->sun_path)) {
+            return false;
+        }
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, path.data(), path.size());
+        if (path[0] == '@') {
+            // 抽象命名空间，地址长度不含结尾的'\0'
+            un->sun_path[0] = '\0';
+            target_len      = offsetof(sockaddr_un, sun_path) + path.size();
+        } else {
+            target_len = sizeof(sockaddr_un);
+        }
+        return true;
+    }
+    size_t colon = target.rfind(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+    std::string host = target.substr(0, colon);
+    std::string port = target.substr(colon + 1);
+    if (host.size() > 2 && host[0] == '[' && host[host.size() - 1] == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+    addrinfo hints, *res = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0 || !res) {
+        return false;
+    }
+    memcpy(&target_addr, res->ai_addr, res->ai_addrlen);
+    target_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return true;
+}
+
+// 把模板整理成可直接发送的请求：统一换行，按选项替换路径与Connection头部
+static std::string build_request(const std::string& text) {
+    std::vector<std::string> lines;
+    size_t                   pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find('\n', pos);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        std::string line = text.substr(pos, end - pos);
+        if (!line.empty() && line[line.size() - 1] == '\r') {
+            line.erase(line.size() - 1);
+        }
+        pos = end + 1;
+        if (line.empty()) {
+            break;  // 头部结束，请求体不支持
+        }
+        lines.push_back(line);
+    }
+    std::string req;
+    for (size_t i = 0; i < lines.size(); ++i) {
+        std::string& line = lines[i];
+        if (i == 0 && opt.url) {
+            size_t a = line.find(' ');
+            size_t b = line.find(' ', a + 1);
+            if (a != std::string::npos && b != std::string::npos) {
+                line = line.substr(0, a + 1) + opt.url + line.substr(b);
+            }
+        }
+        if (i > 0 && strncasecmp(line.c_str(), "Connection:", 11) == 0) {
+            continue;
+        }
+        req += line + "\r\n";
+    }
+    req += opt.keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+    return req;
+}
+
+static bool load_templates() {
+    if (opt.templates.empty()) {
+        requests.push_back(build_request("GET /index.html HTTP/1.1\nHost: localhost\n"));
+        return true;
+    }
+    for (size_t i = 0; i < opt.templates.size(); ++i) {
+        FILE* fp = fopen(opt.templates[i].c_str(), "rb");
+        if (!fp) {
+            perror(opt.templates[i].c_str());
+            return false;
+        }
+        std::string text;
+        char        buf[4096];
+        size_t      n;
+        while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+            text.append(buf, n);
+        }
+        fclose(fp);
+        requests.push_back(build_request(text));
+    }
+    return true;
+}
+
+static void update_events(bench_conn& c) {
+    if (c.slow) {
+        return;  // 慢速客户端由定时节拍驱动，不注册事件
+    }
+    epoll_event ev;
+    ev.data.ptr = &c;
+    ev.events   = EPOLLIN | EPOLLRDHUP;
+    if (!c.connected || c.out_off < c.out.size()) {
+        ev.events |= EPOLLOUT;
+    }
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c.fd, &ev);
+}
+
+static bool open_conn(bench_conn& c) {
+    c.fd = socket(target_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (c.fd < 0) {
+        perror("socket");
+        return false;
+    }
+    c.connected        = false;
+    c.out.clear();
+    c.out_off          = 0;
+    c.in_body          = false;
+    c.head.clear();
+    c.body_left        = 0;
+    c.last_progress_ns = now_ns();
+    if (connect(c.fd, (sockaddr*)&target_addr, target_len) < 0 && errno != EINPROGRESS) {
+        close(c.fd);
+        c.fd = -1;
+        return false;
+    }
+    ++connects;
+    epoll_event ev;
+    ev.data.ptr = &c;
+    ev.events   = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, c.fd, &ev);
+    return true;
+}
+
+// 关闭连接并重新建立，count_error 为真时未完成的请求计为错误
+static void reset_conn(bench_conn& c, bool count_error) {
+    if (c.fd >= 0) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, c.fd, nullptr);
+        close(c.fd);
+        c.fd = -1;
+    }
+    if (count_error) {
+        errors += c.requests.size();
+    }
+    c.requests.clear();
+    open_conn(c);
+}
+
+static void flush_out(bench_conn& c, size_t limit) {
+    while (c.out_off < c.out.size() && limit > 0) {
+        size_t  n = std::min(c.out.size() - c.out_off, limit);
+        ssize_t w = write(c.fd, c.out.data() + c.out_off, n);
+        if (w <= 0) {
+            break;
+        }
+        c.out_off += w;
+        limit -= w;
+    }
+    if (c.out_off == c.out.size()) {
+        c.out.clear();
+        c.out_off = 0;
+    }
+}
+
+static void send_request(bench_conn& c, uint64_t sched_ns) {
+    inflight r;
+    r.sched_ns = sched_ns;
+    r.sent_ns  = now_ns();
+    c.requests.push_back(r);
+    c.out += requests[next_request++ % requests.size()];
+    if (!c.slow && c.connected) {
+        flush_out(c, (size_t)-1);
+    }
+    update_events(c);
+}
+
+static void record(uint64_t counts[], uint64_t& max, uint64_t ns) {
+    ++counts[hist_index(ns)];
+    max = ns > max ? ns : max;
+}
+
+static void response_done(bench_conn& c, int status) {
+    uint64_t now = now_ns();
+    inflight r   = c.requests.front();
+    c.requests.pop_front();
+    if (c.slow) {
+        ++slow_completed;
+    } else {
+        ++completed;
+        record(latency, latency_max, now - r.sched_ns);
+        record(service, service_max, now - r.sent_ns);
+    }
+    if (status >= 500) {
+        ++status_5xx;
+    } else if (status >= 400) {
+        ++status_4xx;
+    } else if (status >= 300) {
+        ++status_3xx;
+    } else {
+        ++status_2xx;
+    }
+}
+
+// 解析收到的数据，返回完成的响应数，出错返回-1
+static int consume(bench_conn& c, const char* data, size_t len) {
+    int done = 0;
+    while (len > 0) {
+        if (c.in_body) {
+            size_t n = std::min(len, c.body_left);
+            c.body_left -= n;
+            data += n;
+            len -= n;
+        } else {
+            size_t old = c.head.size();
+            c.head.append(data, len);
+            size_t end = c.head.find("\r\n\r\n", old >= 3 ? old - 3 : 0);
+            if (end == std::string::npos) {
+                return c.head.size() > 65536 ? -1 : done;
+            }
+            size_t used = end + 4 - old;
+            data += used;
+            len -= used;
+            c.in_body   = true;
+            c.body_left = 0;
+            const char* cl = strcasestr(c.head.c_str(), "\r\nContent-Length:");
+            if (cl) {
+                c.body_left = strtoull(cl + 17, nullptr, 10);
+            }
+        }
+        if (c.in_body && c.body_left == 0) {
+            if (c.requests.empty()) {
+                return -1;  // 收到了没有请求对应的响应
+            }
+            int status = c.head.size() > 12 ? atoi(c.head.c_str() + 9) : 0;
+            response_done(c, status);
+            c.in_body = false;
+            c.head.clear();
+            ++done;
+        }
+    }
+    return done;
+}
+
+// 读取并解析响应，连接被关闭或出错返回false
+static bool read_conn(bench_conn& c, size_t limit) {
+    static char buf[65536];
+    while (limit > 0) {
+        ssize_t n = read(c.fd, buf, std::min(sizeof(buf), limit));
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        if (n == 0) {
+            return false;
+        }
+        bytes_read += n;
+        limit -= n;
+        c.last_progress_ns = now_ns();
+        if (consume(c, buf, n) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static double percentile_us(const uint64_t counts[], double q) { return hist_percentile(counts, q) / 1000.0; }
+
+int main(int argc, char* argv[]) {
+    int o;
+    while ((o = getopt(argc, argv, "c:d:r:p:k:f:u:s:S:t:j")) != -1) {
+        switch (o) {
+            case 'c':
+                opt.conns = atoi(optarg);
+                break;
+            case 'd':
+                opt.duration = atoi(optarg);
+                break;
+            case 'r':
+                opt.rate = atof(optarg);
+                break;
+            case 'p':
+                opt.depth = atoi(optarg);
+                break;
+            case 'k':
+                opt.keep_alive = atoi(optarg) != 0;
+                break;
+            case 'f':
+                opt.templates.push_back(optarg);
+                break;
+            case 'u':
+                opt.url = optarg;
+                break;
+            case 's':
+                opt.slow_conns = atoi(optarg);
+                break;
+            case 'S':
+                if (sscanf(optarg, "%zu:%d", &opt.slow_bytes, &opt.slow_ms) != 2) {
+                    fprintf(stderr, "-S 的格式为 字节:毫秒\n");
+                    return 1;
+                }
+                break;
+            case 't':
+                opt.timeout_ms = atoi(optarg);
+                break;
+            case 'j':
+                opt.json = true;
+                break;
+            default:
+                optind = argc + 1;
+                break;
+        }
+    }
+    if (optind != argc - 1 || opt.conns <= 0 || opt.depth <= 0 || opt.slow_conns >= opt.conns ||
+        opt.slow_bytes == 0 || opt.slow_ms <= 0) {
+        printf("请按照如下格式运行：%s [-c 连接数] [-d 秒数] [-r 速率] [-p 深度] [-k 0|1] [-f 模板]... [-u url] "
+               "[-s 慢速连接数 [-S 字节:毫秒]] [-t 超时毫秒] [-j] host:port|unix:路径\n",
+               basename(argv[0]));
+        return 1;
+    }
+    if (!opt.keep_alive) {
+        opt.depth = 1;  // 短连接上没有流水线
+    }
+    opt.target = argv[optind];
+    if (!parse_target(opt.target)) {
+        fprintf(stderr, "无法解析目标地址 %s\n", opt.target.c_str());
+        return 1;
+    }
+    if (!load_templates()) {
+        return 1;
+    }
+
+    epfd    = epoll_create1(0);
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    {
+        epoll_event ev;
+        ev.data.ptr = nullptr;
+        ev.events   = EPOLLIN;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
+    }
+    conns.resize(opt.conns);
+    for (int i = 0; i < opt.conns; ++i) {
+        conns[i].slow = i < opt.slow_conns;
+        if (!open_conn(conns[i])) {
+            fprintf(stderr, "connect %s failed: %s\n", opt.target.c_str(), strerror(errno));
+            return 1;
+        }
+    }
+
+    const bool     open_loop   = opt.rate > 0;
+    const uint64_t interval_ns = open_loop ? (uint64_t)(1e9 / opt.rate) : 0;
+    const uint64_t timeout_ns  = (uint64_t)opt.timeout_ms * 1000000;
+    const uint64_t slow_ns     = (uint64_t)opt.slow_ms * 1000000;
+    const uint64_t start       = now_ns();
+    const uint64_t end         = start + (uint64_t)opt.duration * 1000000000ULL;
+    uint64_t       next_sched  = start;
+    uint64_t       next_slow   = start;
+    uint64_t       next_check  = start + 100000000;
+    size_t         rr          = 0;     // 开环模式下轮流选择连接
+    std::deque<inflight> backlog;       // 开环模式下已到计划时间、但没有空闲连接的请求
+
+    epoll_event events[1024];
+    uint64_t    now = start;
+    while (now < end) {
+        // 开环：按计划时间生成请求，分配给有空位的连接
+        if (open_loop) {
+            while (next_sched <= now) {
+                inflight r = {next_sched, 0};
+                backlog.push_back(r);
+                next_sched += interval_ns;
+            }
+            for (int tried = 0; !backlog.empty() && tried < opt.conns; ++tried) {
+                bench_conn& c = conns[rr++ % opt.conns];
+                if (c.slow || !c.connected || (int)c.requests.size() >= opt.depth) {
+                    continue;
+                }
+                send_request(c, backlog.front().sched_ns);
+                backlog.pop_front();
+                tried = -1;
+            }
+        }
+
+        // 慢速客户端：每个节拍收发少量字节，保持流水线满
+        if (now >= next_slow) {
+            for (int i = 0; i < opt.slow_conns; ++i) {
+                bench_conn& c = conns[i];
+                if (!c.connected) {
+                    continue;
+                }
+                while ((int)c.requests.size() < opt.depth) {
+                    send_request(c, now);
+                }
+                flush_out(c, opt.slow_bytes);
+                if (!read_conn(c, opt.slow_bytes)) {
+                    reset_conn(c, !c.requests.empty() && opt.keep_alive);
+                }
+            }
+            next_slow = now + slow_ns;
+        }
+
+        // 超时检查
+        if (now >= next_check) {
+            for (int i = 0; i < opt.conns; ++i) {
+                bench_conn& c = conns[i];
+                if (!c.requests.empty() && now - c.last_progress_ns > timeout_ns) {
+                    timeouts += c.requests.size();
+                    c.requests.clear();
+                    reset_conn(c, false);
+                }
+            }
+            next_check = now + 100000000;
+        }
+
+        // 计算唤醒时间，开环模式下最多等到下一个计划时间；用timerfd定时，精度不受epoll_wait毫秒粒度的限制
+        uint64_t wake = std::min(end, next_check);
+        if (opt.slow_conns > 0) {
+            wake = std::min(wake, next_slow);
+        }
+        if (open_loop) {
+            wake = std::min(wake, backlog.empty() ? next_sched : now + 1000000);
+        }
+        int wait_ms = 0;
+        if (wake > now) {
+            itimerspec its;
+            memset(&its, 0, sizeof(its));
+            its.it_value.tv_sec  = wake / 1000000000ULL;
+            its.it_value.tv_nsec = wake % 1000000000ULL;
+            timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, nullptr);
+            wait_ms = -1;
+        }
+
+        int num = epoll_wait(epfd, events, 1024, wait_ms);
+        for (int i = 0; i < num; ++i) {
+            if (!events[i].data.ptr) {
+                uint64_t expirations;
+                ssize_t  n = read(tfd, &expirations, sizeof(expirations));
+                (void)n;
+                continue;
+            }
+            bench_conn& c = *(bench_conn*)events[i].data.ptr;
+            if (!c.connected && (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+                int       err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err != 0) {
+                    ++errors;
+                    reset_conn(c, true);
+                    continue;
+                }
+                c.connected        = true;
+                c.last_progress_ns = now_ns();
+                if (c.slow) {
+                    // 慢速客户端建立连接后改由定时节拍驱动
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, c.fd, nullptr);
+                    continue;
+                }
+                // 闭环：连接建立后立即填满流水线
+                if (!open_loop) {
+                    while ((int)c.requests.size() < opt.depth) {
+                        send_request(c, now_ns());
+                    }
+                }
+                if (c.out_off < c.out.size()) {
+                    flush_out(c, (size_t)-1);
+                }
+                update_events(c);
+                continue;
+            }
+            if (events[i].events & EPOLLIN) {
+                size_t before = completed;
+                bool   ok     = read_conn(c, (size_t)-1);
+                if (!ok || (!opt.keep_alive && c.requests.empty() && completed != before)) {
+                    // 短连接收完响应、或连接被关闭
+                    reset_conn(c, ok ? false : !c.requests.empty());
+                    continue;
+                }
+                if (!open_loop) {
+                    uint64_t t = now_ns();
+                    while ((int)c.requests.size() < opt.depth) {
+                        send_request(c, t);
+                    }
+                }
+            } else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                reset_conn(c, !c.requests.empty());
+                continue;
+            }
+            if (events[i].events & EPOLLOUT) {
+                flush_out(c, (size_t)-1);
+                update_events(c);
+            }
+        }
+        now = now_ns();
+    }
+
+    double elapsed = (now - start) / 1e9;
+    if (opt.json) {
+        printf("{\"target\":\"%s\",\"mode\":\"%s\",\"conns\":%d,\"depth\":%d,\"keep_alive\":%s,\"rate\":%.0f,"
+               "\"duration_s\":%.3f,\"requests\":%lu,\"rps\":%.1f,\"mb_per_s\":%.3f,\"errors\":%lu,\"timeouts\":%lu,"
+               "\"backlog\":%zu,\"connects\":%lu,\"status_2xx\":%lu,\"status_3xx\":%lu,\"status_4xx\":%lu,"
+               "\"status_5xx\":%lu,\"slow_requests\":%lu,"
+               "\"latency_us\":{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f},"
+               "\"service_us\":{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}}\n",
+               opt.target.c_str(), open_loop ? "open" : "closed", opt.conns, opt.depth,
+               opt.keep_alive ? "true" : "false", opt.rate, elapsed, completed, completed / elapsed,
+               bytes_read / elapsed / 1e6, errors, timeouts, backlog.size(), connects, status_2xx, status_3xx,
+               status_4xx, status_5xx, slow_completed, percentile_us(latency, 0.5), percentile_us(latency, 0.9),
+               percentile_us(latency, 0.99), percentile_us(latency, 0.999), latency_max / 1000.0,
+               percentile_us(service, 0.5), percentile_us(service, 0.9), percentile_us(service, 0.99),
+               percentile_us(service, 0.999), service_max / 1000.0);
+        return 0;
+    }
+    printf("%s, %s loop, %d connections (%d slow), depth %d, %s\n", opt.target.c_str(), open_loop ? "open" : "closed",
+           opt.conns, opt.slow_conns, opt.depth, opt.keep_alive ? "keep-alive" : "short-lived");
+    printf("%lu requests in %.2fs, %.1f req/s, %.2f MB/s read\n", completed, elapsed, completed / elapsed,
+           bytes_read / elapsed / 1e6);
+    printf("status 2xx %lu, 3xx %lu, 4xx %lu, 5xx %lu; errors %lu, timeouts %lu, connects %lu, slow requests %lu\n",
+           status_2xx, status_3xx, status_4xx, status_5xx, errors, timeouts, connects, slow_completed);
+    if (open_loop && !backlog.empty()) {
+        printf("warning: %zu scheduled requests were never sent, the target rate was not sustained\n",
+               backlog.size());
+    }
+    printf("%-24s %10s %10s %10s %10s %10s\n", "latency(us)", "p50", "p90", "p99", "p99.9", "max");
+    printf("%-24s %10.1f %10.1f %10.1f %10.1f %10.1f\n", open_loop ? "from schedule" : "from send",
+           percentile_us(latency, 0.5), percentile_us(latency, 0.9), percentile_us(latency, 0.99),
+           percentile_us(latency, 0.999), latency_max / 1000.0);
+    if (open_loop) {
+        printf("%-24s %10.1f %10.1f %10.1f %10.1f %10.1f\n", "service (uncorrected)", percentile_us(service, 0.5),
+               percentile_us(service, 0.9), percentile_us(service, 0.99), percentile_us(service, 0.999),
+               service_max / 1000.0);
+    }
+    return 0;
+}
@@ -0,0 +1,210 @@
+/*
+    把 doc_root 目录树打包成服务器可直接mmap的静态资源包
+    编译：g++ -O2 tools/bundle_pack.cpp -o bundle_pack -I.
+    用法：./bundle_pack doc_root 输出文件
+    若存在同名的 xxx.gz 文件，则作为 xxx 的预压缩版本一并打包。
+    先写入临时文件再rename，部署时替换资源包是一次原子操作。
+*/
+
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "bundle.h"
+#include "response.h"
+
+struct source_file {
+    std::string path;  // 磁盘上的完整路径
+    std::string gzip;  // 预压缩版本的完整路径，没有则为空
+};
+
+static std::string                        root;
+static std::map<std::string, source_file> files;  // url -> 源文件，按url排序保证输出稳定
+
+static int collect(const char* path, const struct stat* st, int type, struct FTW*) {
+    // 与服务器的权限检查保持一致，只打包其他用户可读的普通文件
+    if (type != FTW_F || !S_ISREG(st->st_mode) || !(st->st_mode & S_IROTH)) {
+        return 0;
+    }
+    std::string url = path + root.size();
+    if (url.empty() || url[0] != '/') {
+        url = "/" + url;
+    }
+    if (url.size() > 3 && url.compare(url.size() - 3, 3, ".gz") == 0) {
+        files[url.substr(0, url.size() - 3)].gzip = path;
+    }
+    files[url].path = path;
+    return 0;
+}
+
+static bool read_file(const std::string& path, std::string& out) {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        return false;
+    }
+    out.clear();
+    char   buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        out.append(buf, n);
+    }
+    bool ok = !ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+static uint64_t align_page(uint64_t off) { return (off + BUNDLE_PAGE_SIZE - 1) & ~(uint64_t)(BUNDLE_PAGE_SIZE - 1); }
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        printf("请按照如下格式运行：%s doc_root 输出文件\n", basename(argv[0]));
+        return 1;
+    }
+    root = argv[1];
+    while (root.size() > 1 && root[root.size() - 1] == '/') {
+        root.erase(root.size() - 1);
+    }
+    if (nftw(root.c_str(), collect, 32, FTW_PHYS) != 0) {
+        perror("nftw");
+        return 1;
+    }
+    // 只有 .gz 没有原文件的条目视为普通文件，已经以 .gz 的url收录
+    for (std::map<std::string, source_file>::iterator it = files.begin(); it != files.end();) {
+        if (it->second.path.empty()) {
+            files.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+
+    uint32_t count   = files.size();
+    uint32_t buckets = 1;
+    while (buckets < count * 2) {
+        buckets <<= 1;
+    }
+
+    std::vector<bundle_entry> entries(count);
+    std::vector<uint32_t>     index(buckets, 0);
+    std::vector<std::string>  bodies;  // 按写入顺序保存的响应体
+    std::string               strings;
+
+    uint64_t index_off   = sizeof(bundle_header);
+    uint64_t entry_off   = index_off + (uint64_t)buckets * sizeof(uint32_t);
+    uint64_t strings_off = entry_off + (uint64_t)count * sizeof(bundle_entry);
+
+    uint32_t i = 0;
+    for (std::map<std::string, source_file>::iterator it = files.begin(); it != files.end(); ++it, ++i) {
+        const std::string& url = it->first;
+        bundle_entry&      e   = entries[i];
+        memset(&e, 0, sizeof(e));
+        e.hash       = bundle_hash(url.data(), url.size());
+        e.url_offset = strings_off + strings.size();
+        e.url_len    = url.size();
+        strings += url;
+
+        const char* paths[BUNDLE_VARIANT_NUM] = {it->second.path.c_str(), it->second.gzip.c_str()};
+        for (int v = 0; v < BUNDLE_VARIANT_NUM; ++v) {
+            if (paths[v][0] == '\0') {
+                continue;
+            }
+            std::string body;
+            if (!read_file(paths[v], body)) {
+                fprintf(stderr, "read %s failed\n", paths[v]);
+                return 1;
+            }
+            // gzip形式的ETag由原始内容的哈希加"-gz"，原始内容总是先处理
+            if (v == BUNDLE_IDENTITY) {
+                uint64_t h = bundle_hash(body.data(), body.size());
+                snprintf(e.variants[v].etag, BUNDLE_ETAG_LEN, "\"%016llx\"", (unsigned long long)h);
+            } else {
+                const char* tag = e.variants[BUNDLE_IDENTITY].etag;
+                snprintf(e.variants[v].etag, BUNDLE_ETAG_LEN, "%.*s-gz\"", (int)strlen(tag) - 1, tag);
+            }
+            // 有gzip形式时两种响应都要带Vary，否则共享缓存会把一种形式回给要另一种的客户端
+            bool vary = !it->second.gzip.empty();
+            char header[512];
+            int  len = snprintf(header, sizeof(header),
+                                "HTTP/1.1 200 OK\r\nContent-Length: %lu\r\nContent-Type: %s\r\nETag: %s\r\n%s%s",
+                                (unsigned long)body.size(), mime_type_of(url.data(), url.size()), e.variants[v].etag,
+                                v == BUNDLE_GZIP ? "Content-Encoding: gzip\r\n" : "",
+                                vary ? "Vary: Accept-Encoding\r\n" : "");
+            e.variants[v].present       = 1;
+            e.variants[v].header_offset = strings_off + strings.size();
+            e.variants[v].header_len    = len;
+            e.variants[v].body_size     = body.size();
+            e.variants[v].body_offset   = bodies.size();  // 暂存响应体序号，排版时替换为偏移
+            strings.append(header, len);
+            bodies.push_back(body);
+        }
+
+        uint32_t mask = buckets - 1;
+        uint32_t slot = (uint32_t)e.hash & mask;
+        while (index[slot] != 0) {
+            slot = (slot + 1) & mask;
+        }
+        index[slot] = i + 1;
+    }
+
+    // 响应体按页对齐，使每个资源独占连续的页，便于mincore/readahead按资源处理
+    std::vector<uint64_t> body_offsets(bodies.size());
+    uint64_t              off = align_page(strings_off + strings.size());
+    for (size_t b = 0; b < bodies.size(); ++b) {
+        body_offsets[b] = off;
+        off             = align_page(off + bodies[b].size());
+    }
+    for (uint32_t k = 0; k < count; ++k) {
+        for (int v = 0; v < BUNDLE_VARIANT_NUM; ++v) {
+            if (entries[k].variants[v].present) {
+                entries[k].variants[v].body_offset = body_offsets[entries[k].variants[v].body_offset];
+            }
+        }
+    }
+
+    bundle_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC));
+    hdr.version      = BUNDLE_VERSION;
+    hdr.page_size    = BUNDLE_PAGE_SIZE;
+    hdr.entry_count  = count;
+    hdr.bucket_count = buckets;
+    hdr.index_offset = index_off;
+    hdr.entry_offset = entry_off;
+    hdr.total_size   = off;
+
+    std::string tmp = std::string(argv[2]) + ".tmp";
+    FILE*       fp  = fopen(tmp.c_str(), "wb");
+    if (!fp) {
+        perror("fopen");
+        return 1;
+    }
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    fwrite(index.data(), sizeof(uint32_t), index.size(), fp);
+    if (count) {
+        fwrite(entries.data(), sizeof(bundle_entry), count, fp);
+    }
+    fwrite(strings.data(), 1, strings.size(), fp);
+    for (size_t b = 0; b < bodies.size(); ++b) {
+        fseek(fp, body_offsets[b], SEEK_SET);
+        fwrite(bodies[b].data(), 1, bodies[b].size(), fp);
+    }
+    // 最后一个响应体之后补齐到页边界
+    if (fflush(fp) != 0 || ftruncate(fileno(fp), off) != 0 || fsync(fileno(fp)) != 0) {
+        perror("write");
+        fclose(fp);
+        return 1;
+    }
+    fclose(fp);
+    if (rename(tmp.c_str(), argv[2]) != 0) {
+        perror("rename");
+        return 1;
+    }
+    printf("packed %u files into %s, %llu bytes\n", count, argv[2], (unsigned long long)off);
+    return 0;
+}
@@ -0,0 +1,500 @@
+/*
+    服务器内部组件的微基准测试，输出一行一个结果的JSON，便于比较两次构建
+    编译：g++ -O2 tools/microbench.cpp accesslog.cpp bundle.cpp capture.cpp clientlist.cpp connection.cpp diskio.cpp \
+          epfd.cpp filecache.cpp filewriter.cpp listener.cpp log.cpp loopcmd.cpp perfctr.cpp proxy.cpp ratelimit.cpp response.cpp stats.cpp tls.cpp trace.cpp -o microbench -I. -pthread
+    用法：./microbench [-f 名称过滤] [-t 每项最短毫秒数] [请求样本文件...]
+        请求样本文件为原始请求报文，如 httpget.txt；不指定时使用内置的几种请求
+    测试项:
+        parse        解析器：完整解析一个请求，资源查找走一个空的资源包，不产生文件系统调用
+        response     拼装响应头
+        timer        升序链表定时器在1万~6.5万个定时器时的插入、调整、删除
+        queue        blockqueue 在1~N个生产者与消费者下的吞吐，以及无锁的单生产者单消费者版本
+        threadpool   任务从投递到被工作线程执行的吞吐
+        log          每条日志的开销，包括被级别过滤掉的日志，同时给出因缓冲区满而丢弃的比例
+        limiter      按IP限流取令牌的开销，同时检查1万个IPv4地址是否分散到各段，集中在少数几段时以非0状态退出
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "blockqueue.h"
+#include "bundle.h"
+#include "clientlist.h"
+#include "connection.h"
+#include "log.h"
+#include "ratelimit.h"
+#include "threadpool.h"
+#include "timer.h"
+
+// 服务器的 main.cpp 中定义的全局变量
+int TIMESLOT  = 5;
+int pipefd[2] = {-1, -1};
+
+static const char* filter     = nullptr;
+static int         min_run_ms = 200;
+
+static uint64_t now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static bool selected(const std::string& name) { return !filter || name.find(filter) != std::string::npos; }
+
+static void report(const std::string& name, double ns_per_op, unsigned long long ops, const char* extra = "") {
+    printf("{\"name\":\"%s\",\"ns_per_op\":%.2f,\"ops\":%llu%s}\n", name.c_str(), ns_per_op, ops, extra);
+    fflush(stdout);
+}
+
+struct bench_result {
+    double             ns_per_op;
+    unsigned long long ops;
+};
+
+/*
+    反复执行 body(n) 直到总时长超过 min_run_ms，n 每轮翻倍；body(n) 执行 n*scale 次操作。
+    重复5次取中位数，减少调度与频率变化的影响
+*/
+template <typename F>
+static bench_result measure(F body, unsigned long long scale = 1) {
+    std::vector<double> samples;
+    unsigned long long  total_ops = 0;
+    for (int round = 0; round < 5; ++round) {
+        unsigned long long n       = 1;
+        uint64_t           elapsed = 0;
+        while (true) {
+            uint64_t t0 = now_ns();
+            body(n);
+            elapsed = now_ns() - t0;
+            if (elapsed >= (uint64_t)min_run_ms * 1000000 / 5 || n >= (1ULL << 40)) {
+                break;
+            }
+            n *= 2;
+        }
+        samples.push_back((double)elapsed / (n * scale));
+        total_ops += n * scale;
+    }
+    std::sort(samples.begin(), samples.end());
+    return {samples[samples.size() / 2], total_ops};
+}
+
+template <typename F>
+static void run(const std::string& name, F body, unsigned long long scale = 1) {
+    if (selected(name)) {
+        bench_result r = measure(body, scale);
+        report(name, r.ns_per_op, r.ops);
+    }
+}
+
+// 直接驱动 connection 的私有解析与响应函数
+class connection_bench {
+public:
+    static HTTP_CODE parse(connection& c, const std::string& req) {
+        c.init_parse();
+        memcpy(c.read_buf, req.data(), req.size());
+        c.read_idx = req.size();
+        return c.parse_http();
+    }
+
+    static bool file_headers(connection& c) {
+        c.write_idx     = 0;
+        c.is_keep_alive = true;
+        c.url           = (char*)"/index.html";
+        return c.add_status_line(status_200) && c.add_headers(4096);
+    }
+
+    static bool error_response(connection& c) {
+        c.write_idx = 0;
+        return c.add_error(error_404);
+    }
+};
+
+struct corpus_entry {
+    std::string name;
+    std::string text;
+};
+
+// 统一成\r\n换行，并保证以空行结束
+static std::string normalize(const std::string& raw) {
+    std::string out;
+    for (size_t i = 0; i < raw.size(); ++i) {
+        if (raw[i] == '\n' && (i == 0 || raw[i - 1] != '\r')) {
+            out += "\r\n";
+        } else {
+            out += raw[i];
+        }
+    }
+    while (out.size() >= 2 && out.compare(out.size() - 2, 2, "\r\n") == 0) {
+        out.erase(out.size() - 2);
+    }
+    return out + "\r\n\r\n";
+}
+
+static std::vector<corpus_entry> load_corpus(int argc, char* argv[], int first) {
+    std::vector<corpus_entry> corpus;
+    for (int i = first; i < argc; ++i) {
+        FILE* fp = fopen(argv[i], "rb");
+        if (!fp) {
+            perror(argv[i]);
+            continue;
+        }
+        std::string text;
+        char        buf[4096];
+        size_t      n;
+        while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+            text.append(buf, n);
+        }
+        fclose(fp);
+        const char* base = strrchr(argv[i], '/');
+        corpus.push_back({base ? base + 1 : argv[i], normalize(text)});
+    }
+    if (corpus.empty()) {
+        corpus.push_back({"minimal", normalize("GET /index.html HTTP/1.1\nHost: localhost\n")});
+        corpus.push_back({"curl", normalize("GET /big.txt HTTP/1.1\nHost: 127.0.0.1:10000\nUser-Agent: curl/8.5.0\n"
+                                            "Accept: */*\nConnection: keep-alive\n")});
+        corpus.push_back(
+            {"browser",
+             normalize("GET /index.html HTTP/1.1\nHost: 192.168.30.128:10000\nConnection: keep-alive\n"
+                       "Cache-Control: max-age=0\nUpgrade-Insecure-Requests: 1\n"
+                       "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) "
+                       "Chrome/103.0.0.0 Safari/537.36\n"
+                       "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,"
+                       "image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.9\n"
+                       "Accept-Encoding: gzip, deflate\nAccept-Language: zh-CN,zh;q=0.9\n"
+                       "If-None-Match: \"0123456789abcdef\"\n")});
+        corpus.push_back({"bad", normalize("POST /form HTTP/1.1\nHost: localhost\n")});
+    }
+    return corpus;
+}
+
+static void bench_parser(const std::vector<corpus_entry>& corpus) {
+    static static_bundle empty_bundle;  // 未打开的资源包，查找总是未命中
+    static_bundle*       saved = connection::bundle;
+    connection::bundle         = &empty_bundle;
+
+    connection* c = new connection();
+    for (size_t i = 0; i < corpus.size(); ++i) {
+        const std::string& req = corpus[i].text;
+        if (req.size() >= 2048) {
+            fprintf(stderr, "skip %s: larger than the read buffer\n", corpus[i].name.c_str());
+            continue;
+        }
+        run("parse/" + corpus[i].name, [&](unsigned long long n) {
+            for (unsigned long long k = 0; k < n; ++k) {
+                connection_bench::parse(*c, req);
+            }
+        });
+    }
+    run("response/file_headers", [&](unsigned long long n) {
+        for (unsigned long long k = 0; k < n; ++k) {
+            connection_bench::file_headers(*c);
+        }
+    });
+    run("response/error_404", [&](unsigned long long n) {
+        for (unsigned long long k = 0; k < n; ++k) {
+            connection_bench::error_response(*c);
+        }
+    });
+    delete c;
+    connection::bundle = saved;
+}
+
+static void bench_timers() {
+    connection* dummy = new connection();  // 定时器只保存连接的指针，这里不会用到连接本身
+    const int   sizes[] = {10000, 30000, 65000};
+    for (int size : sizes) {
+        std::string suffix = "/" + std::to_string(size);
+        srand(size);
+
+        // 从空链表插满 size 个定时器再逐个删除，超时时间随机分布；结果为每个定时器的插入加删除开销。
+        // 插满一次是 O(size^2)，6.5万个要十几秒，只测1万个
+        if (size <= 10000) {
+            run(
+                "timer/fill" + suffix,
+                [&](unsigned long long n) {
+                    for (unsigned long long k = 0; k < n; ++k) {
+                        client_timer_list           list;
+                        std::vector<client_timer*> timers;
+                        for (int i = 0; i < size; ++i) {
+                            client_timer* t = new client_timer(*dummy);
+                            t->expire       = 1000000 + rand() % (3 * TIMESLOT * 1000);
+                            list.add_timer_to_list(t);
+                            timers.push_back(t);
+                        }
+                        for (client_timer* t : timers) {
+                            list.del_timer_from_list(t);
+                        }
+                    }
+                },
+                size);
+        }
+
+        // 在已有 size 个定时器的链表上，随机挑选定时器延长超时时间，与收到请求时的 update_timer 一致
+        client_timer_list           list;
+        std::vector<client_timer*> timers;
+        time_t                      base = 1000000;
+        for (int i = 0; i < size; ++i) {
+            client_timer* t = new client_timer(*dummy);
+            t->expire       = base + i * (3 * TIMESLOT) / size;
+            list.add_timer_to_list(t);
+            timers.push_back(t);
+        }
+        run("timer/adjust" + suffix, [&](unsigned long long n) {
+            for (unsigned long long k = 0; k < n; ++k) {
+                client_timer* t = timers[rand() % size];
+                t->expire       = list.tail->expire + 1;
+                list.adjust_timer_on_list(t);
+            }
+        });
+        run("timer/delete_insert" + suffix, [&](unsigned long long n) {
+            for (unsigned long long k = 0; k < n; ++k) {
+                int           i = rand() % size;
+                client_timer* t = new client_timer(*dummy);
+                t->expire       = timers[i]->expire;
+                list.del_timer_from_list(timers[i]);
+                list.add_timer_to_list(t);
+                timers[i] = t;
+            }
+        });
+        for (client_timer* t : timers) {
+            list.del_timer_from_list(t);
+        }
+    }
+    delete dummy;
+}
+
+// producers 个线程共放入 n 个元素，consumers 个线程取完为止；生产者结束后每个消费者收到一个空指针退出，不靠超时
+template <typename Q>
+static void push_wait(Q& q, long* item) {
+    while (!q.push(std::move(item))) {
+        std::this_thread::yield();
+    }
+}
+
+template <typename Q>
+static void queue_round(Q& q, int producers, int consumers, unsigned long long n) {
+    std::vector<std::thread> consumer_threads;
+    std::vector<std::thread> producer_threads;
+    for (int c = 0; c < consumers; ++c) {
+        consumer_threads.emplace_back([&] {
+            long* item;
+            while (true) {
+                if (q.pop(item, 10) && !item) {
+                    break;
+                }
+            }
+        });
+    }
+    for (int p = 0; p < producers; ++p) {
+        producer_threads.emplace_back([&, p] {
+            unsigned long long share = n / producers + (p < (int)(n % producers) ? 1 : 0);
+            for (unsigned long long k = 0; k < share; ++k) {
+                push_wait(q, (long*)(uintptr_t)(k + 1));
+            }
+        });
+    }
+    for (std::thread& t : producer_threads) {
+        t.join();
+    }
+    for (int c = 0; c < consumers; ++c) {
+        push_wait(q, (long*)nullptr);
+    }
+    for (std::thread& t : consumer_threads) {
+        t.join();
+    }
+}
+
+static void bench_queues() {
+    int max_threads = std::max(2u, std::min(8u, std::thread::hardware_concurrency()));
+    for (int p = 1; p <= max_threads; p *= 2) {
+        for (int c = 1; c <= max_threads; c *= 2) {
+            std::string name = "queue/mutex/p" + std::to_string(p) + "c" + std::to_string(c);
+            run(name, [&](unsigned long long n) {
+                blockqueue<long*> q(1024);
+                queue_round(q, p, c, n);
+            });
+        }
+    }
+    run("queue/mutex/bulk16", [&](unsigned long long n) {
+        blockqueue<long*> q(1024);
+        std::thread       consumer([&] {
+            std::vector<long*> items;
+            unsigned long long got = 0;
+            while (got < n) {
+                items.clear();
+                got += q.pop_all(items, 10);
+            }
+        });
+        long* batch[16];
+        for (unsigned long long k = 0; k < n;) {
+            int m = (int)std::min<unsigned long long>(16, n - k);
+            for (int i = 0; i < m; ++i) {
+                batch[i] = (long*)(uintptr_t)(k + i + 1);
+            }
+            int pushed = q.push_bulk(batch, m);
+            k += pushed;
+            if (pushed < m) {
+                std::this_thread::yield();
+            }
+        }
+        consumer.join();
+    });
+    run("queue/spsc", [&](unsigned long long n) {
+        blockqueue<long*, true> q(1024);
+        queue_round(q, 1, 1, n);
+    });
+}
+
+struct bench_task {
+    static std::atomic<unsigned long long> done;
+    void                                   process() { done.fetch_add(1, std::memory_order_relaxed); }
+};
+std::atomic<unsigned long long> bench_task::done(0);
+
+static void bench_threadpool() {
+    static threadpool<bench_task>* pool = new threadpool<bench_task>(4, 10000);  // 工作线程常驻，不销毁
+    static bench_task              task;
+    run("threadpool/append", [&](unsigned long long n) {
+        unsigned long long start = bench_task::done.load();
+        for (unsigned long long k = 0; k < n;) {
+            if (pool->append(&task)) {
+                ++k;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        while (bench_task::done.load() - start < n) {
+            std::this_thread::yield();
+        }
+    });
+}
+
+// 日志测试同时报告这段时间内因线程缓冲区满而丢弃的比例，丢弃过多说明测到的是丢弃路径
+template <typename F>
+static void run_log(const std::string& name, F body) {
+    if (!selected(name)) {
+        return;
+    }
+    // measure 的翻倍预热也会写日志并产生丢弃，分母按所有调用的总条数计算
+    unsigned long long logged = 0;
+    unsigned long      before = Log::get_instance()->dropped();
+    bench_result       r      = measure([&](unsigned long long n) {
+        logged += n;
+        body(n);
+    });
+    unsigned long after = Log::get_instance()->dropped();
+    char          extra[64];
+    snprintf(extra, sizeof(extra), ",\"dropped_ratio\":%.4f", logged ? (double)(after - before) / logged : 0.0);
+    report(name, r.ns_per_op, r.ops, extra);
+}
+
+static void bench_log() {
+    int saved = Log::level();
+    Log::set_level(LOG_LEVEL_DEBUG);
+    run_log("log/info_3args", [&](unsigned long long n) {
+        for (unsigned long long k = 0; k < n; ++k) {
+            LOG_INFO("connection %d request file: %s, %lu bytes", (int)k, "/index.html", (unsigned long)k);
+        }
+    });
+    run_log("log/info_no_args", [&](unsigned long long n) {
+        for (unsigned long long k = 0; k < n; ++k) {
+            LOG_INFO("empty timer list");
+        }
+    });
+    Log::set_level(LOG_LEVEL_ERROR);
+    run_log("log/filtered", [&](unsigned long long n) {
+        for (unsigned long long k = 0; k < n; ++k) {
+            LOG_INFO("connection %d request file: %s", (int)k, "/index.html");
+        }
+    });
+    Log::set_level(saved);
+    Log::get_instance()->flush();
+}
+
+static bool checks_failed = false;
+
+static sockaddr_storage ipv4_addr(uint32_t host) {
+    sockaddr_storage addr;
+    memset(&addr, 0, sizeof(addr));
+    sockaddr_in* in     = (sockaddr_in*)&addr;
+    in->sin_family      = AF_INET;
+    in->sin_addr.s_addr = htonl(host);
+    return addr;
+}
+
+static void bench_limiter() {
+    const int                     clients = 10000;
+    std::vector<sockaddr_storage> addrs;
+    std::vector<bool>             used(client_limiter::STRIPES, false);
+    int                           stripes = 0;
+    for (int i = 0; i < clients; ++i) {
+        // 10.0.0.0/8 中连续的地址，与同一网段的大量客户端相同
+        addrs.push_back(ipv4_addr(0x0A000000u + i));
+        client_ip ip;
+        client_limiter::key_of(addrs.back(), ip);
+        int s = client_limiter::stripe_index(ip);
+        if (!used[s]) {
+            used[s] = true;
+            ++stripes;
+        }
+    }
+    if (stripes < client_limiter::STRIPES / 2) {
+        fprintf(stderr, "limiter: %d IPv4 addresses use only %d of %d stripes\n", clients, stripes,
+                client_limiter::STRIPES);
+        checks_failed = true;
+    }
+
+    if (!selected("limiter/request")) {
+        return;
+    }
+    client_limiter limiter(0, 1000000000, 0);
+    bench_result   r = measure([&](unsigned long long n) {
+        for (unsigned long long k = 0; k < n; ++k) {
+            limiter.on_request(addrs[k % clients]);
+        }
+    });
+    char extra[64];
+    snprintf(extra, sizeof(extra), ",\"stripes\":%d", stripes);
+    report("limiter/request", r.ns_per_op, r.ops, extra);
+}
+
+int main(int argc, char* argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "f:t:")) != -1) {
+        switch (opt) {
+            case 'f':
+                filter = optarg;
+                break;
+            case 't':
+                min_run_ms = atoi(optarg);
+                break;
+            default:
+                printf("请按照如下格式运行：%s [-f 名称过滤] [-t 每项最短毫秒数] [请求样本文件...]\n", basename(argv[0]));
+                return 1;
+        }
+    }
+
+    // 日志写入 /tmp，除日志测试外只记录错误，避免日志开销混入其他测试
+    Log::get_instance()->init("/tmp/microbench_log", 2048, 5000000, 1 << 20);
+    Log::set_level(LOG_LEVEL_ERROR + 1);
+
+    std::vector<corpus_entry> corpus = load_corpus(argc, argv, optind);
+    bench_parser(corpus);
+    bench_timers();
+    bench_queues();
+    bench_threadpool();
+    bench_log();
+    bench_limiter();
+    return checks_failed ? 1 : 0;
+}
@@ -0,0 +1,607 @@
+/*
+    按抓取时的连接与时间节奏重放服务器 -c 抓取的流量
+    编译：g++ -O2 tools/replay.cpp -o replay -I.
+    用法：./replay [选项] 抓取文件 目标
+        目标          host:port，或 unix:/路径、unix:@抽象名
+        -x 倍速       按多少倍速重放，默认1；0表示不等待抓取中的间隔，每个连接收到响应后立即发出后续请求
+        -p            按计划时刻直接发出数据，即使同一连接上前面的响应还没收到(流水线)；
+                      默认像不使用流水线的客户端一样，等前面的响应收完再发，推迟的时间计入落后时间
+        -t 毫秒       最后一个事件之后等待未完成响应的时间，默认5000
+        -j            最后以一行JSON输出结果，便于比较不同版本
+    每个抓到的连接在同样的相对时刻建立，每段数据在同样的相对时刻发出，服务器关闭连接的时刻在重放时由客户端关闭
+    (若还有未收到的响应，则等收完再关闭)。延迟从请求最后一段数据"计划发出"的时刻算起到收完响应，
+    重放跟不上计划时落后的时间也计入；因等待前面的响应而推迟的请求从实际发出时算起。落后时间的分布单独给出。
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "capture.h"
+#include "histogram.h"
+
+static uint64_t now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+struct replay_event {
+    uint64_t time_ns;  // 抓取中的相对时间
+    uint32_t conn;     // 在 conns 中的下标
+    uint8_t  type;     // capture_type
+    size_t   off;      // DATA 的数据在 capture_data 中的位置
+    uint32_t len;
+};
+
+struct replay_conn {
+    int                  fd        = -1;
+    bool                 opened    = false;  // 已经按计划建立过，连接关闭后不再重建
+    bool                 connected = false;
+    bool                 closing   = false;  // 抓取中服务器已关闭连接，收完响应后关闭
+    std::string          out;                // 待发送的数据
+    size_t               out_off   = 0;
+    std::deque<uint64_t> requests;           // 已发出、尚未收到响应的请求的延迟起点
+    std::deque<size_t>   deferred;           // 等待前面的响应而推迟发出的 DATA 事件
+
+    // 请求边界的识别：请求头以空行结束，之后跳过 Content-Length 字节的请求体
+    std::string req_head;
+    size_t      req_body_left = 0;
+
+    // 响应解析
+    bool        in_body   = false;
+    std::string head;
+    size_t      body_left = 0;
+};
+
+struct replay_options {
+    double      speed      = 1;
+    bool        pipeline   = false;
+    int         timeout_ms = 5000;
+    bool        json       = false;
+    std::string target;
+};
+
+static replay_options            opt;
+static sockaddr_storage          target_addr;
+static socklen_t                 target_len;
+static std::string               capture_data;  // 整个抓取文件
+static std::vector<replay_event> events;
+static std::vector<replay_conn>  conns;
+static int                       epfd;
+static unsigned long             inflight = 0;  // 所有连接上等待响应的请求数
+static uint64_t                  replay_start;   // 重放开始的时间
+static uint64_t                  capture_first;  // 抓取中第一个事件的时间
+
+// 统计
+static uint64_t           latency[HIST_BUCKETS];  // 从计划发出算起
+static uint64_t           lag[HIST_BUCKETS];      // 事件实际执行比计划晚的时间
+static uint64_t           latency_max = 0, lag_max = 0;
+static unsigned long      sent = 0, completed = 0, unmatched = 0, errors = 0, dropped = 0, connects = 0;
+static unsigned long      status_2xx = 0, status_3xx = 0, status_4xx = 0, status_5xx = 0;
+static unsigned long long bytes_sent = 0, bytes_read = 0;
+
+static bool parse_target(const std::string& target) {
+    memset(&target_addr, 0, sizeof(target_addr));
+    if (target.compare(0, 5, "unix:") == 0) {
+        sockaddr_un* un   = (sockaddr_un*)&target_addr;
+        std::string  path = target.substr(5);
+        if (path.empty() || path.size() >= sizeof(un->sun_path)) {
+            return false;
+        }
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, path.data(), path.size());
+        if (path[0] == '@') {
+            // 抽象命名空间，地址长度不含结尾的'\0'
+            un->sun_path[0] = '\0';
+            target_len      = offsetof(sockaddr_un, sun_path) + path.size();
+        } else {
+            target_len = sizeof(sockaddr_un);
+        }
+        return true;
+    }
+    size_t colon = target.rfind(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+    std::string host = target.substr(0, colon);
+    std::string port = target.substr(colon + 1);
+    if (host.size() > 2 && host[0] == '[' && host[host.size() - 1] == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+    addrinfo hints, *res = nullptr;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0 || !res) {
+        return false;
+    }
+    memcpy(&target_addr, res->ai_addr, res->ai_addrlen);
+    target_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return true;
+}
+
+// 读入抓取文件，把记录整理成按时间排序的事件，连接编号映射成 conns 的下标
+static bool load_capture(const char* path) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "打开抓取文件 %s 失败: %s\n", path, strerror(errno));
+        return false;
+    }
+    char   buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        capture_data.append(buf, n);
+    }
+    fclose(fp);
+
+    capture_file_header header;
+    if (capture_data.size() < sizeof(header)) {
+        fprintf(stderr, "%s 不是抓取文件\n", path);
+        return false;
+    }
+    memcpy(&header, capture_data.data(), sizeof(header));
+    if (memcmp(header.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0 || header.version != CAPTURE_VERSION) {
+        fprintf(stderr, "%s 不是抓取文件或版本不符\n", path);
+        return false;
+    }
+
+    std::unordered_map<uint32_t, uint32_t> ids;  // 未关闭的连接的编号 -> 下标
+    uint32_t                               conn_num = 0;
+    size_t                                 off      = sizeof(header);
+    while (off + sizeof(capture_record) <= capture_data.size()) {
+        capture_record rec;
+        memcpy(&rec, capture_data.data() + off, sizeof(rec));
+        off += sizeof(rec);
+        if (off + rec.len > capture_data.size()) {
+            break;  // 服务器被强行结束时最后一条记录可能不完整
+        }
+        auto it = ids.find(rec.conn_id);
+        if (it == ids.end()) {
+            if (rec.type != CAPTURE_OPEN) {
+                off += rec.len;
+                continue;  // 抓取达到上限等原因缺少开头的连接，无法重放
+            }
+            it = ids.emplace(rec.conn_id, conn_num++).first;
+        }
+        replay_event e;
+        e.time_ns = rec.time_ns;
+        e.conn    = it->second;
+        e.type    = rec.type;
+        e.off     = off;
+        e.len     = rec.len;
+        events.push_back(e);
+        off += rec.len;
+        if (rec.type == CAPTURE_CLOSE) {
+            ids.erase(it);  // 编号不会复用，这里只是让后续记录不会误用已关闭的连接
+        }
+    }
+    // 关闭连接可能在工作线程中记录，与事件循环的记录之间可能略有乱序
+    std::stable_sort(events.begin(), events.end(),
+                     [](const replay_event& a, const replay_event& b) { return a.time_ns < b.time_ns; });
+    conns.resize(conn_num);
+    return true;
+}
+
+// 第一个事件在开始时刻执行，其余按相对时间除以倍速排定
+static uint64_t sched_of(const replay_event& e) {
+    return opt.speed > 0 ? replay_start + (uint64_t)((e.time_ns - capture_first) / opt.speed) : replay_start;
+}
+
+static void record(uint64_t counts[], uint64_t& max, uint64_t ns) {
+    ++counts[hist_index(ns)];
+    max = ns > max ? ns : max;
+}
+
+static void update_events(replay_conn& c) {
+    epoll_event ev;
+    ev.data.ptr = &c;
+    ev.events   = EPOLLIN | EPOLLRDHUP;
+    if (!c.connected || c.out_off < c.out.size()) {
+        ev.events |= EPOLLOUT;
+    }
+    epoll_ctl(epfd, EPOLL_CTL_MOD, c.fd, &ev);
+}
+
+static void close_conn(replay_conn& c) {
+    if (c.fd < 0) {
+        return;
+    }
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c.fd, nullptr);
+    close(c.fd);
+    c.fd = -1;
+    errors += c.requests.size();
+    inflight -= c.requests.size();
+    dropped += c.deferred.size();
+    c.requests.clear();
+    c.deferred.clear();
+}
+
+static void open_conn(replay_conn& c) {
+    c.opened = true;
+    c.fd     = socket(target_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (c.fd < 0) {
+        ++errors;
+        return;
+    }
+    if (connect(c.fd, (sockaddr*)&target_addr, target_len) < 0 && errno != EINPROGRESS) {
+        close(c.fd);
+        c.fd = -1;
+        ++errors;
+        return;
+    }
+    ++connects;
+    epoll_event ev;
+    ev.data.ptr = &c;
+    ev.events   = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, c.fd, &ev);
+}
+
+static void flush_out(replay_conn& c) {
+    while (c.out_off < c.out.size()) {
+        ssize_t w = write(c.fd, c.out.data() + c.out_off, c.out.size() - c.out_off);
+        if (w <= 0) {
+            break;
+        }
+        c.out_off += w;
+        bytes_sent += w;
+    }
+    if (c.out_off == c.out.size()) {
+        c.out.clear();
+        c.out_off = 0;
+    }
+}
+
+// 在发出的数据中找出请求的结束位置，每个结束的请求等待一个响应
+static void count_requests(replay_conn& c, const char* data, size_t len, uint64_t sched_ns) {
+    while (len > 0) {
+        if (c.req_body_left > 0) {
+            size_t n = std::min(len, c.req_body_left);
+            c.req_body_left -= n;
+            data += n;
+            len -= n;
+            if (c.req_body_left == 0) {
+                c.requests.push_back(sched_ns);
+                ++sent;
+                ++inflight;
+            }
+            continue;
+        }
+        size_t old = c.req_head.size();
+        c.req_head.append(data, len);
+        size_t end = c.req_head.find("\r\n\r\n", old >= 3 ? old - 3 : 0);
+        if (end == std::string::npos) {
+            return;
+        }
+        size_t used = end + 4 - old;
+        data += used;
+        len -= used;
+        const char* cl  = strcasestr(c.req_head.c_str(), "\r\nContent-Length:");
+        c.req_body_left = cl ? strtoull(cl + 17, nullptr, 10) : 0;
+        c.req_head.clear();
+        if (c.req_body_left == 0) {
+            c.requests.push_back(sched_ns);
+            ++sent;
+            ++inflight;
+        }
+    }
+}
+
+static void response_done(replay_conn& c, int status) {
+    if (c.requests.empty()) {
+        ++unmatched;  // 如请求不完整时服务器直接返回的400
+    } else {
+        uint64_t sched = c.requests.front();
+        c.requests.pop_front();
+        --inflight;
+        ++completed;
+        uint64_t now = now_ns();
+        record(latency, latency_max, now > sched ? now - sched : 0);
+    }
+    if (status >= 500) {
+        ++status_5xx;
+    } else if (status >= 400) {
+        ++status_4xx;
+    } else if (status >= 300) {
+        ++status_3xx;
+    } else {
+        ++status_2xx;
+    }
+}
+
+// 解析收到的数据，出错返回false
+static bool consume(replay_conn& c, const char* data, size_t len) {
+    while (len > 0) {
+        if (c.in_body) {
+            size_t n = std::min(len, c.body_left);
+            c.body_left -= n;
+            data += n;
+            len -= n;
+        } else {
+            size_t old = c.head.size();
+            c.head.append(data, len);
+            size_t end = c.head.find("\r\n\r\n", old >= 3 ? old - 3 : 0);
+            if (end == std::string::npos) {
+                return c.head.size() <= 65536;
+            }
+            size_t used = end + 4 - old;
+            data += used;
+            len -= used;
+            c.in_body      = true;
+            c.body_left    = 0;
+            const char* cl = strcasestr(c.head.c_str(), "\r\nContent-Length:");
+            if (cl) {
+                c.body_left = strtoull(cl + 17, nullptr, 10);
+            }
+        }
+        if (c.in_body && c.body_left == 0) {
+            int status = c.head.size() > 12 ? atoi(c.head.c_str() + 9) : 0;
+            response_done(c, status);
+            c.in_body = false;
+            c.head.clear();
+        }
+    }
+    return true;
+}
+
+// 读取并解析响应，连接被关闭或出错返回false
+static bool read_conn(replay_conn& c) {
+    static char buf[65536];
+    while (1) {
+        ssize_t n = read(c.fd, buf, sizeof(buf));
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        if (n == 0) {
+            return false;
+        }
+        bytes_read += n;
+        if (!consume(c, buf, n)) {
+            return false;
+        }
+    }
+}
+
+// 抓取中服务器已关闭的连接，数据发完、响应收完后关闭
+static void maybe_close(replay_conn& c) {
+    if (c.closing && c.requests.empty() && c.deferred.empty() && c.out.empty()) {
+        close_conn(c);
+    }
+}
+
+// 发出一段数据，from_ns 为其中完成的请求计算延迟的起点
+static void send_data(replay_conn& c, const replay_event& e, uint64_t from_ns) {
+    c.out.append(capture_data.data() + e.off, e.len);
+    count_requests(c, capture_data.data() + e.off, e.len, from_ns);
+    if (c.connected) {
+        flush_out(c);
+    }
+    update_events(c);
+}
+
+// 前面的响应都已收到，发出被推迟的数据，直到又有请求在等待响应
+static void release_deferred(replay_conn& c) {
+    while (c.fd >= 0 && c.requests.empty() && !c.deferred.empty()) {
+        const replay_event& e   = events[c.deferred.front()];
+        uint64_t            now = now_ns();
+        c.deferred.pop_front();
+        record(lag, lag_max, now - sched_of(e));
+        send_data(c, e, now);
+    }
+    maybe_close(c);
+}
+
+static void run_event(size_t idx, uint64_t now) {
+    const replay_event& e     = events[idx];
+    replay_conn&        c     = conns[e.conn];
+    uint64_t            sched = sched_of(e);
+    switch (e.type) {
+        case CAPTURE_OPEN:
+            record(lag, lag_max, now - sched);
+            if (!c.opened) {
+                open_conn(c);
+            }
+            break;
+        case CAPTURE_DATA:
+            if (c.fd < 0) {
+                ++dropped;  // 连接已被服务器关闭或没能建立
+                break;
+            }
+            if (!opt.pipeline && (!c.requests.empty() || !c.deferred.empty())) {
+                c.deferred.push_back(idx);
+                break;
+            }
+            record(lag, lag_max, now - sched);
+            send_data(c, e, sched);
+            break;
+        case CAPTURE_CLOSE:
+            c.closing = true;
+            if (c.fd >= 0) {
+                maybe_close(c);
+            }
+            break;
+    }
+}
+
+static double percentile_us(const uint64_t counts[], double q) { return hist_percentile(counts, q) / 1000.0; }
+
+int main(int argc, char* argv[]) {
+    int o;
+    while ((o = getopt(argc, argv, "x:pt:j")) != -1) {
+        switch (o) {
+            case 'x':
+                opt.speed = atof(optarg);
+                break;
+            case 'p':
+                opt.pipeline = true;
+                break;
+            case 't':
+                opt.timeout_ms = atoi(optarg);
+                break;
+            case 'j':
+                opt.json = true;
+                break;
+            default:
+                optind = argc + 1;
+                break;
+        }
+    }
+    if (optind != argc - 2 || opt.speed < 0) {
+        printf("请按照如下格式运行：%s [-x 倍速] [-p] [-t 超时毫秒] [-j] 抓取文件 host:port|unix:路径\n", basename(argv[0]));
+        return 1;
+    }
+    opt.target = argv[optind + 1];
+    if (!parse_target(opt.target)) {
+        fprintf(stderr, "无法解析目标地址 %s\n", opt.target.c_str());
+        return 1;
+    }
+    if (!load_capture(argv[optind])) {
+        return 1;
+    }
+    if (events.empty()) {
+        fprintf(stderr, "抓取文件中没有可重放的连接\n");
+        return 1;
+    }
+
+    epfd    = epoll_create1(0);
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    {
+        epoll_event ev;
+        ev.data.ptr = nullptr;
+        ev.events   = EPOLLIN;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev);
+    }
+
+    const uint64_t timeout_ns = (uint64_t)opt.timeout_ms * 1000000;
+    const uint64_t start      = now_ns();
+    replay_start              = start;
+    capture_first             = events[0].time_ns;
+    size_t   next     = 0;
+    uint64_t deadline = 0;  // 所有事件执行完后等待剩余响应的截止时间
+
+    epoll_event evs[1024];
+    uint64_t    now = start;
+    while (next < events.size() || (inflight > 0 && now < deadline)) {
+        while (next < events.size() && sched_of(events[next]) <= now) {
+            run_event(next, now);
+            ++next;
+            if (next == events.size()) {
+                deadline = now_ns() + timeout_ns;
+            }
+        }
+        if (next == events.size() && inflight == 0) {
+            break;
+        }
+
+        uint64_t wake = next < events.size() ? sched_of(events[next]) : deadline;
+        int      wait_ms = 0;
+        if (wake > now) {
+            itimerspec its;
+            memset(&its, 0, sizeof(its));
+            its.it_value.tv_sec  = wake / 1000000000ULL;
+            its.it_value.tv_nsec = wake % 1000000000ULL;
+            timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, nullptr);
+            wait_ms = -1;
+        }
+
+        int num = epoll_wait(epfd, evs, 1024, wait_ms);
+        for (int i = 0; i < num; ++i) {
+            if (!evs[i].data.ptr) {
+                uint64_t expirations;
+                ssize_t  n = read(tfd, &expirations, sizeof(expirations));
+                (void)n;
+                continue;
+            }
+            replay_conn& c = *(replay_conn*)evs[i].data.ptr;
+            if (c.fd < 0) {
+                continue;  // 同一轮中已被关闭
+            }
+            if (!c.connected && (evs[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+                int       err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err != 0) {
+                    ++errors;
+                    close_conn(c);
+                    continue;
+                }
+                c.connected = true;
+                flush_out(c);
+                update_events(c);
+                maybe_close(c);
+                continue;
+            }
+            if (evs[i].events & EPOLLIN) {
+                if (!read_conn(c)) {
+                    close_conn(c);
+                    continue;
+                }
+                release_deferred(c);
+                if (c.fd < 0) {
+                    continue;
+                }
+            } else if (evs[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                close_conn(c);
+                continue;
+            }
+            if (evs[i].events & EPOLLOUT) {
+                flush_out(c);
+                update_events(c);
+                maybe_close(c);
+            }
+        }
+        now = now_ns();
+    }
+    // 超时仍未收到的响应单独计数，抓取结束时仍打开的连接直接关闭
+    unsigned long timeouts = inflight;
+    for (replay_conn& c : conns) {
+        inflight -= c.requests.size();
+        c.requests.clear();
+        close_conn(c);
+    }
+
+    double elapsed  = (now - start) / 1e9;
+    double captured = (events.back().time_ns - capture_first) / 1e9;
+    if (opt.json) {
+        printf("{\"target\":\"%s\",\"speed\":%.2f,\"captured_s\":%.3f,\"duration_s\":%.3f,\"connections\":%zu,"
+               "\"connects\":%lu,\"requests\":%lu,\"responses\":%lu,\"unmatched\":%lu,\"errors\":%lu,\"timeouts\":%lu,"
+               "\"dropped\":%lu,\"bytes_sent\":%llu,\"bytes_read\":%llu,\"status_2xx\":%lu,\"status_3xx\":%lu,"
+               "\"status_4xx\":%lu,\"status_5xx\":%lu,"
+               "\"latency_us\":{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f},"
+               "\"lag_us\":{\"p50\":%.1f,\"p99\":%.1f,\"max\":%.1f}}\n",
+               opt.target.c_str(), opt.speed, captured, elapsed, conns.size(), connects, sent, completed, unmatched,
+               errors, timeouts, dropped, bytes_sent, bytes_read, status_2xx, status_3xx, status_4xx, status_5xx,
+               percentile_us(latency, 0.5), percentile_us(latency, 0.9), percentile_us(latency, 0.99),
+               percentile_us(latency, 0.999), latency_max / 1000.0, percentile_us(lag, 0.5), percentile_us(lag, 0.99),
+               lag_max / 1000.0);
+        return 0;
+    }
+    printf("%s, %zu connections, %.2fs captured, replayed at %.2fx in %.2fs\n", opt.target.c_str(), conns.size(),
+           captured, opt.speed, elapsed);
+    printf("%lu requests, %lu responses (%lu unmatched), %llu bytes sent, %llu bytes read\n", sent, completed,
+           unmatched, bytes_sent, bytes_read);
+    printf("status 2xx %lu, 3xx %lu, 4xx %lu, 5xx %lu; errors %lu, timeouts %lu, dropped sends %lu\n", status_2xx,
+           status_3xx, status_4xx, status_5xx, errors, timeouts, dropped);
+    printf("%-24s %10s %10s %10s %10s %10s\n", "latency(us)", "p50", "p90", "p99", "p99.9", "max");
+    printf("%-24s %10.1f %10.1f %10.1f %10.1f %10.1f\n", "from schedule", percentile_us(latency, 0.5),
+           percentile_us(latency, 0.9), percentile_us(latency, 0.99), percentile_us(latency, 0.999),
+           latency_max / 1000.0);
+    printf("%-24s %10.1f %10s %10.1f %10s %10.1f\n", "replay lag", percentile_us(lag, 0.5), "",
+           percentile_us(lag, 0.99), "", lag_max / 1000.0);
+    return 0;
+}
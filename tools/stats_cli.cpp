@@ -0,0 +1,140 @@
+/*
+    读取服务器发布在 /dev/shm 中的运行时统计，不与服务器进程交互
+    编译：g++ -O2 tools/stats_cli.cpp -o stats_cli -I. -lrt
+    用法：./stats_cli port [间隔秒数]
+    port 为服务器的第一个监听地址对应的名称：TCP为端口号，Unix域套接字为 unix 加上路径中的字母数字(其余字符换成_)，如 unix_tmp_ws_sock
+    不带间隔时输出一次当前值、各处理阶段耗时的分位数，以及开启 -C 时各阶段的硬件计数器；带间隔时每隔一段时间输出一次，计数器显示每秒增量，量规显示当前值。
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+/*
+    服务器正常退出时会删除共享内存段，崩溃或被强行结束时段会留下来。
+    进程不存在，或定时器tick超过3个间隔没有更新心跳(进程卡住，或pid已被别的进程复用)时提示数据已过期，只提示一次
+*/
+static void check_alive(const stats_segment* seg) {
+    static bool warned = false;
+    if (warned) {
+        return;
+    }
+    long idle     = (long)(time(nullptr) - seg->heartbeat.load(std::memory_order_relaxed));
+    long interval = seg->tick_interval > 0 ? seg->tick_interval : 5;
+    if (kill(seg->pid, 0) != 0 && errno == ESRCH) {
+        fprintf(stderr, "warning: server pid %d is not running, values are stale\n", seg->pid);
+        warned = true;
+    } else if (idle > 3 * interval) {
+        fprintf(stderr, "warning: stats not updated for %ld s, server pid %d may be hung or gone\n", idle, seg->pid);
+        warned = true;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2 && argc != 3) {
+        printf("请按照如下格式运行：%s port [间隔秒数]\n", basename(argv[0]));
+        return 1;
+    }
+    int interval = argc == 3 ? atoi(argv[2]) : 0;
+
+    char name[64];
+    snprintf(name, sizeof(name), "/weakserver.%s", argv[1]);
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(stderr, "open /dev/shm%s failed: %s\n", name, strerror(errno));
+        return 1;
+    }
+    void* addr = mmap(nullptr, sizeof(stats_segment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    const stats_segment* seg = (const stats_segment*)addr;
+    if (memcmp(seg->magic, STATS_MAGIC, sizeof(STATS_MAGIC)) != 0 || seg->version != STATS_VERSION ||
+        seg->stat_num != STAT_NUM || seg->slot_num != STATS_MAX_SLOTS) {
+        fprintf(stderr, "%s is not a stats segment of this version\n", name);
+        return 1;
+    }
+    check_alive(seg);
+
+    int64_t prev[STAT_NUM];
+    stats_sum(seg, prev);
+    if (interval <= 0) {
+        printf("pid %d, uptime %ld s\n", seg->pid, (long)(time(nullptr) - seg->start_time));
+        for (int i = 0; i < STAT_NUM; ++i) {
+            printf("%-16s %lld\n", stat_names[i], (long long)prev[i]);
+        }
+
+        static uint64_t counts[HIST_BUCKETS];
+        printf("\n%-10s %10s %10s %10s %10s %10s %10s\n", "stage(us)", "count", "p50", "p90", "p99", "p999", "max");
+        for (int i = 0; i < STAGE_NUM; ++i) {
+            uint64_t max   = stats_hist_sum(seg, i, counts);
+            uint64_t total = 0;
+            for (int b = 0; b < HIST_BUCKETS; ++b) {
+                total += counts[b];
+            }
+            printf("%-10s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", stage_names[i], (unsigned long long)total,
+                   hist_percentile(counts, 0.5) / 1000.0, hist_percentile(counts, 0.9) / 1000.0,
+                   hist_percentile(counts, 0.99) / 1000.0, hist_percentile(counts, 0.999) / 1000.0, max / 1000.0);
+        }
+
+        // 开启 -C 时输出各阶段平均每个请求的硬件计数器与IPC，不可用的计数器显示为 -
+        if (seg->perf_mask) {
+            static uint64_t perf[PERF_STAGE_NUM][PERF_EVENT_NUM];
+            stats_perf_sum(seg, perf);
+            double requests = prev[STAT_REQUESTS] > 0 ? (double)prev[STAT_REQUESTS] : 1;
+            printf("\nper request%s\n%-10s", seg->perf_user_only ? " (user space only)" : "", "stage");
+            for (int e = 0; e < PERF_EVENT_NUM; ++e) {
+                printf(" %16s", perf_event_names[e]);
+            }
+            printf(" %8s\n", "ipc");
+            for (int st = 0; st < PERF_STAGE_NUM; ++st) {
+                printf("%-10s", perf_stage_names[st]);
+                for (int e = 0; e < PERF_EVENT_NUM; ++e) {
+                    if (seg->perf_mask & (1u << e)) {
+                        printf(" %16.1f", perf[st][e] / requests);
+                    } else {
+                        printf(" %16s", "-");
+                    }
+                }
+                uint64_t cycles = perf[st][PERF_CYCLES];
+                if (cycles && (seg->perf_mask & (1u << PERF_INSTRUCTIONS))) {
+                    printf(" %8.3f\n", (double)perf[st][PERF_INSTRUCTIONS] / cycles);
+                } else {
+                    printf(" %8s\n", "-");
+                }
+            }
+        }
+        return 0;
+    }
+
+    for (int line = 0;; ++line) {
+        sleep(interval);
+        check_alive(seg);
+        int64_t cur[STAT_NUM];
+        stats_sum(seg, cur);
+        if (line % 20 == 0) {
+            for (int i = 0; i < STAT_NUM; ++i) {
+                printf("%*s ", (int)strlen(stat_names[i]) > 10 ? (int)strlen(stat_names[i]) : 10, stat_names[i]);
+            }
+            printf("\n");
+        }
+        for (int i = 0; i < STAT_NUM; ++i) {
+            int     width = (int)strlen(stat_names[i]) > 10 ? (int)strlen(stat_names[i]) : 10;
+            int64_t v     = i >= STAT_FIRST_GAUGE ? cur[i] : (cur[i] - prev[i]) / interval;
+            printf("%*lld ", width, (long long)v);
+        }
+        printf("\n");
+        fflush(stdout);
+        memcpy(prev, cur, sizeof(prev));
+    }
+}
@@ -0,0 +1,114 @@
+#include "trace.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "stats.h"
+
+double   trace_clock::m_ns_per_tick = 1.0;
+uint64_t trace_clock::m_base        = 0;
+
+static uint64_t monotonic_now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+void trace_clock::calibrate() {
+#if defined(__x86_64__) || defined(__i386__)
+    // 对照单调时钟测量20毫秒内的TSC增量
+    uint64_t ns0 = monotonic_now();
+    uint64_t t0  = now();
+    struct timespec pause = {0, 20 * 1000000};
+    nanosleep(&pause, nullptr);
+    uint64_t ns1 = monotonic_now();
+    uint64_t t1  = now();
+    if (t1 > t0) {
+        m_ns_per_tick = (double)(ns1 - ns0) / (t1 - t0);
+    }
+#endif
+    m_base = now();
+}
+
+// 每个阶段由前后两个时间点确定
+struct stage_span {
+    stage_id    stage;
+    trace_point from;
+    trace_point to;
+};
+
+static const stage_span stage_spans[STAGE_NUM] = {
+    {STAGE_READ, TRACE_START, TRACE_READ_DONE},
+    {STAGE_DISPATCH, TRACE_READ_DONE, TRACE_ENQUEUE},
+    {STAGE_QUEUE, TRACE_ENQUEUE, TRACE_DEQUEUE},
+    {STAGE_PARSE, TRACE_DEQUEUE, TRACE_PARSE_DONE},
+    {STAGE_FETCH, TRACE_PARSE_DONE, TRACE_RESPONSE_READY},
+    {STAGE_WAIT_OUT, TRACE_RESPONSE_READY, TRACE_FIRST_WRITE},
+    {STAGE_SEND, TRACE_FIRST_WRITE, TRACE_LAST_WRITE},
+    {STAGE_TOTAL, TRACE_START, TRACE_LAST_WRITE},
+};
+
+void trace_finish(const request_trace& trace, trace_dump* dump, uint32_t conn_id, const char* url, int status) {
+    for (int i = 0; i < STAGE_NUM; ++i) {
+        const stage_span& s = stage_spans[i];
+        // 没经过的阶段(如429、/__stats 不入队)两端不全，不能当作0耗时计入分位数
+        if (!trace.points[s.from] || !trace.points[s.to]) {
+            continue;
+        }
+        server_stats::record(s.stage, trace.between(s.from, s.to));
+    }
+    if (dump) {
+        dump->finish(trace, conn_id, url, status);
+    }
+}
+
+trace_dump::trace_dump() : m_sample_every(1), m_seen(0), m_file(FLUSH_SIZE) {}
+
+bool trace_dump::open(const char* path, unsigned sample_every) {
+    if (!m_file.open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) {
+        return false;
+    }
+    m_sample_every = sample_every ? sample_every : 1;
+    m_file.append("[\n", 2);
+    return true;
+}
+
+void trace_dump::finish(const request_trace& trace, uint32_t conn_id, const char* url, int status) {
+    unsigned seen = m_seen.fetch_add(1, std::memory_order_relaxed);
+    if (seen % m_sample_every != 0 && trace.between(TRACE_START, TRACE_LAST_WRITE) < TRACE_SLOW_NS) {
+        return;
+    }
+
+    // url 可能包含需要转义的字符，只保留可打印且无需转义的部分
+    char name[128];
+    size_t n = 0;
+    for (const char* p = url ? url : "-"; *p && n < sizeof(name) - 1; ++p) {
+        if (*p >= 0x20 && *p != '"' && *p != '\\') {
+            name[n++] = *p;
+        }
+    }
+    name[n] = '\0';
+
+    // 一个请求的所有事件先拼在栈上，作为一条记录追加，不同线程的请求不会交错
+    char   events[2048];
+    size_t len = 0;
+    for (int i = 0; i < STAGE_NUM - 1; ++i) {
+        const stage_span& s = stage_spans[i];
+        if (!trace.points[s.from] || !trace.points[s.to]) {
+            continue;
+        }
+        len += snprintf(events + len, sizeof(events) - len,
+                        "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f},\n",
+                        stage_names[s.stage], conn_id, trace_clock::to_ns(trace.points[s.from]) / 1000.0,
+                        trace.between(s.from, s.to) / 1000.0);
+    }
+    len += snprintf(events + len, sizeof(events) - len,
+                    "{\"name\":\"%s\",\"cat\":\"request\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,"
+                    "\"dur\":%.3f,\"args\":{\"status\":%d}},\n",
+                    name, conn_id, trace_clock::to_ns(trace.points[TRACE_START]) / 1000.0,
+                    trace.between(TRACE_START, TRACE_LAST_WRITE) / 1000.0, status);
+    m_file.append(events, len < sizeof(events) ? len : sizeof(events) - 1);
+}
+
+void trace_dump::flush() { m_file.flush(); }
@@ -0,0 +1,105 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <atomic>
+
+#include "filewriter.h"
+
+/*
+    请求的阶段追踪:
+        每个请求在几个固定的时间点用TSC打时间戳，响应发完时换算成各阶段的耗时计入 stats.h 中的直方图；
+        可选地按采样间隔把完整的时间线以 Chrome trace-event JSON 格式写入文件，用 chrome://tracing 或 Perfetto 查看。
+*/
+
+// 请求的时间点
+enum trace_point {
+    TRACE_START = 0,       // 请求开始：第一个请求为accept的时间，长连接上的后续请求为收到第一个字节的时间
+    TRACE_READ_DONE,       // 读完请求
+    TRACE_ENQUEUE,         // 放入任务队列
+    TRACE_DEQUEUE,         // 工作线程取出
+    TRACE_PARSE_DONE,      // 解析完成
+    TRACE_RESPONSE_READY,  // 响应已生成
+    TRACE_FIRST_WRITE,     // 发出第一个字节
+    TRACE_LAST_WRITE,      // 发完最后一个字节
+    TRACE_POINT_NUM
+};
+
+// TSC时钟，启动时对照 CLOCK_MONOTONIC 校准；非x86平台直接使用 CLOCK_MONOTONIC
+class trace_clock {
+public:
+    static void calibrate();
+
+    static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return (uint64_t)t.tv_sec * 1000000000ULL + t.tv_nsec;
+#endif
+    }
+
+    // 两个时间戳之间的纳秒数，乱序或未打点时为0
+    static uint64_t ns_between(uint64_t from, uint64_t to) { return to > from ? (uint64_t)((to - from) * m_ns_per_tick) : 0; }
+
+    // 从校准时刻算起的纳秒数
+    static uint64_t to_ns(uint64_t ticks) { return ns_between(m_base, ticks); }
+
+private:
+    static double   m_ns_per_tick;
+    static uint64_t m_base;
+};
+
+struct request_trace {
+    uint64_t points[TRACE_POINT_NUM];
+
+    void reset() {
+        for (int i = 0; i < TRACE_POINT_NUM; ++i) {
+            points[i] = 0;
+        }
+    }
+
+    void stamp(trace_point p) { points[p] = trace_clock::now(); }
+
+    uint64_t between(trace_point from, trace_point to) const {
+        return trace_clock::ns_between(points[from], points[to]);
+    }
+};
+
+/*
+    把采样到的请求写成 Chrome trace-event 数组，每个阶段一个"X"事件，同一连接的请求在同一行(tid，即连接编号，与抓取文件一致)上。
+    数组不写结尾的']'，查看器允许这种截断的文件，服务器被强行结束时文件仍然可用。
+    与访问日志一样通过 file_writer 成批交给日志后台线程写出，完成请求的线程不会阻塞在 write 上。
+*/
+class trace_dump {
+public:
+    trace_dump();
+
+    // sample_every 为采样间隔，每 sample_every 个请求记录一个；总耗时超过 TRACE_SLOW_NS 的请求总是记录
+    bool open(const char* path, unsigned sample_every);
+
+    // 请求完成时调用，记录所有阶段的耗时并按采样决定是否写入文件
+    void finish(const request_trace& trace, uint32_t conn_id, const char* url, int status);
+
+    void flush();
+
+private:
+    static const uint64_t TRACE_SLOW_NS = 100 * 1000000ULL;  // 慢请求的阈值
+    static const size_t   FLUSH_SIZE    = 64 * 1024;         // 缓冲区攒到这么多字节就交给后台线程写入文件
+
+    unsigned              m_sample_every;
+    std::atomic<unsigned> m_seen;
+    file_writer           m_file;
+};
+
+// 计入各阶段的直方图，dump 非空时按采样写入时间线
+void trace_finish(const request_trace& trace, trace_dump* dump, uint32_t conn_id, const char* url, int status);
+
+#endif
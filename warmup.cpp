@@ -0,0 +1,177 @@
+#include "warmup.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "filecache.h"
+#include "log.h"
+
+warmup_stats warmup_counters;
+
+// 热点列表的写出参数，init_hot_list 之后不再修改
+static std::string       saver_path;
+static file_cache*       saver_cache      = nullptr;
+static size_t            saver_max_files  = 0;
+static bool              saver_background = false;  // 是否由日志后台线程写出
+static std::atomic<bool> saver_requested(false);
+
+struct warmup_task {
+    std::string doc_root;
+    std::string hot_list;
+    size_t      max_bytes;
+};
+
+// 预读一个文件，返回预读的字节数
+static size_t prefetch_file(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    size_t      size = 0;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        size = st.st_size;
+        // readahead 读完才返回，预热线程自然按磁盘速度推进；不支持时只发起异步预读
+        if (readahead(fd, 0, size) != 0) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        }
+        ++warmup_counters.files;
+        warmup_counters.bytes += size;
+    }
+    close(fd);
+    return size;
+}
+
+// 按热点列表预读，列表不存在时返回false
+static bool prefetch_hot_list(const warmup_task* task) {
+    FILE* fp = fopen(task->hot_list.c_str(), "r");
+    if (!fp) {
+        return false;
+    }
+    char line[4096];
+    while (warmup_counters.bytes < task->max_bytes && fgets(line, sizeof(line), fp)) {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] != '\0') {
+            prefetch_file(line);
+        }
+    }
+    fclose(fp);
+    return true;
+}
+
+// 深度优先遍历目录，不跟随符号链接
+static void prefetch_dir(const std::string& dir, size_t max_bytes) {
+    DIR* dp = opendir(dir.c_str());
+    if (!dp) {
+        return;
+    }
+    dirent* entry;
+    while (warmup_counters.bytes < max_bytes && (entry = readdir(dp)) != nullptr) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        std::string path = dir + "/" + entry->d_name;
+        struct stat st;
+        if (lstat(path.c_str(), &st) != 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            prefetch_dir(path, max_bytes);
+        } else if (S_ISREG(st.st_mode) && (st.st_mode & S_IROTH)) {
+            prefetch_file(path.c_str());
+        }
+    }
+    closedir(dp);
+}
+
+static void* warmup_thread(void* arg) {
+    warmup_task* task = (warmup_task*)arg;
+
+    // 降低本线程的调度优先级，预热不与事件循环和工作线程抢CPU
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 10);
+
+    timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    const char* source = "hot list";
+    if (task->hot_list.empty() || !prefetch_hot_list(task)) {
+        source = "doc_root";
+        prefetch_dir(task->doc_root, task->max_bytes);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long ms = (end.tv_sec - begin.tv_sec) * 1000 + (end.tv_nsec - begin.tv_nsec) / 1000000;
+    LOG_INFO("warmup from %s done: %lu files, %lu bytes in %ld ms", source, warmup_counters.files.load(),
+             warmup_counters.bytes.load(), ms);
+
+    warmup_counters.running = false;
+    delete task;
+    return nullptr;
+}
+
+bool start_warmup(const std::string& doc_root, const std::string& hot_list, size_t max_bytes) {
+    warmup_task* task = new warmup_task();
+    task->doc_root    = doc_root;
+    task->hot_list    = hot_list;
+    task->max_bytes   = max_bytes;
+
+    warmup_counters.running = true;
+    pthread_t tid;
+    if (pthread_create(&tid, nullptr, warmup_thread, task) != 0) {
+        warmup_counters.running = false;
+        delete task;
+        return false;
+    }
+    pthread_detach(tid);
+    return true;
+}
+
+bool save_hot_list(const std::string& hot_list, const std::vector<std::string>& paths) {
+    std::string tmp = hot_list + ".tmp";
+    FILE*       fp  = fopen(tmp.c_str(), "w");
+    if (!fp) {
+        LOG_WARN("open hot list %s failed, errno is: %d", tmp.c_str(), errno);
+        return false;
+    }
+    for (const std::string& path : paths) {
+        fprintf(fp, "%s\n", path.c_str());
+    }
+    if (fclose(fp) != 0 || rename(tmp.c_str(), hot_list.c_str()) != 0) {
+        LOG_WARN("write hot list %s failed, errno is: %d", hot_list.c_str(), errno);
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+static void write_hot_list() { save_hot_list(saver_path, saver_cache->hot_paths(saver_max_files)); }
+
+// 日志后台线程每次写出日志后调用，只在有请求时才取命中计数
+static void hot_list_task(void*) {
+    if (saver_requested.exchange(false)) {
+        write_hot_list();
+    }
+}
+
+void init_hot_list(const std::string& hot_list, file_cache* cache, size_t max_files) {
+    saver_path       = hot_list;
+    saver_cache      = cache;
+    saver_max_files  = max_files;
+    saver_background = Log::get_instance()->add_task(hot_list_task, nullptr);
+}
+
+void request_hot_list() {
+    if (!saver_background) {
+        write_hot_list();
+        return;
+    }
+    saver_requested = true;
+    Log::get_instance()->wakeup();
+}
@@ -0,0 +1,43 @@
+#ifndef WARMUP_H
+#define WARMUP_H
+
+#include <stddef.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+/*
+    启动预热:
+        重启后页缓存是冷的，第一波请求会在事件循环的 writev 里缺页。开启预热后启动一个后台线程，
+        按上次运行记录的热点列表(hot_list，每行一个文件路径，按命中次数从高到低)依次预读文件，
+        没有热点列表时遍历 doc_root；预读用 readahead，文件系统不支持时退回 posix_fadvise(WILLNEED)。
+        事件循环不等预热完成就开始accept，预读到的字节数超过上限后停止。
+        热点列表定期从 file_cache 的命中计数写出，先写临时文件再rename，进程随时被杀也不会留下半个文件；
+        定时器tick只设置一个标志，取命中计数与写文件都在日志后台线程中完成，事件循环不会阻塞在磁盘I/O上。
+*/
+
+class file_cache;
+
+// 预热计数器，在定时器tick中输出到日志
+struct warmup_stats {
+    std::atomic<unsigned long> files;    // 已预读的文件数
+    std::atomic<unsigned long> bytes;    // 已预读的字节数
+    std::atomic<bool>          running;  // 预热线程是否还在运行
+};
+
+extern warmup_stats warmup_counters;
+
+// 在后台线程中预读文件，hot_list为空或文件不存在时遍历doc_root
+bool start_warmup(const std::string& doc_root, const std::string& hot_list, size_t max_bytes);
+
+// 把文件路径按顺序写入热点列表，paths 来自 file_cache::hot_paths
+bool save_hot_list(const std::string& hot_list, const std::vector<std::string>& paths);
+
+// 把写热点列表注册到日志后台线程，之后由 request_hot_list 触发
+void init_hot_list(const std::string& hot_list, file_cache* cache, size_t max_files);
+
+// 请求写一次热点列表，在定时器tick中调用；日志为同步模式时在调用线程中直接写
+void request_hot_list();
+
+#endif